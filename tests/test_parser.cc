@@ -19,14 +19,27 @@
 #define BOOST_TEST_MODULE parser_test_suite
 #include <boost/test/included/unit_test.hpp>
 #include <boost/foreach.hpp>
+#include <boost/weak_ptr.hpp>
 #include <boost/lambda/lambda.hpp>
 #include <boost/lambda/bind.hpp>
 
 #include <texpp/parser.h>
 #include <texpp/logger.h>
 #include <texpp/command.h>
+#include <texpp/format.h>
+#include <texpp/inputbuffer.h>
+#include <texpp/filebundle.h>
+#include <texpp/prefetcher.h>
+#include <texpp/tarbundle.h>
+#include <texpp/base/func.h>
 #include <iostream>
 #include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <cstring>
+#include <zlib.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include <tests/testbundle.h>
 
 using namespace texpp;
@@ -35,7 +48,7 @@ class TestLogger: public Logger
 {
 public:
     bool log(Level, const string& message,
-                Parser&, shared_ptr<Token> token) {
+                Parser&, Token::ptr token) {
         logMessages.push_back(message);
         logPositions.push_back(
             token ? std::make_pair(token->lineNo(), token->charPos())
@@ -264,6 +277,1226 @@ BOOST_AUTO_TEST_CASE( parser_symbols )
     BOOST_CHECK_EQUAL(7, parser->symbol("e", 0));
 }
 
+BOOST_AUTO_TEST_CASE( parser_registers )
+{
+    shared_ptr<Parser> parser = create_parser("");
+
+    SymbolKey count12(SymbolKey::COUNT, 12);
+    BOOST_CHECK(count12.isRegister());
+    BOOST_CHECK_EQUAL(string("count12"), count12.str());
+    BOOST_CHECK(SymbolKey("catcode65").isRegister());
+    BOOST_CHECK(!SymbolKey("count256").isRegister());
+    BOOST_CHECK(!SymbolKey("count012").isRegister());
+    BOOST_CHECK(!SymbolKey("countdef").isRegister());
+    BOOST_CHECK(!SymbolKey(SymbolKey::SFCODE, -61).isRegister());
+
+    // register names refer to the same registers as keys
+    parser->setSymbol("count12", 1);
+    BOOST_CHECK_EQUAL(1, parser->symbol(count12, 0));
+
+    parser->beginGroup();
+
+    parser->setSymbol(count12, 2);
+    BOOST_CHECK_EQUAL(2, parser->symbol("count12", 0));
+
+    parser->setSymbol(SymbolKey(SymbolKey::COUNT, 13), 3, true);
+    parser->setSymbol(SymbolKey(SymbolKey::CATCODE, '@'),
+                        int(Token::CC_LETTER));
+    BOOST_CHECK_EQUAL(int(Token::CC_LETTER), parser->lexer()->getCatCode('@'));
+
+    parser->endGroup();
+
+    BOOST_CHECK_EQUAL(1, parser->symbol(count12, 0));
+    BOOST_CHECK_EQUAL(3, parser->symbol("count13", 0));
+    BOOST_CHECK_EQUAL(int(Token::CC_OTHER), parser->lexer()->getCatCode('@'));
+}
+
+BOOST_AUTO_TEST_CASE( parser_values )
+{
+    Value empty;
+    BOOST_CHECK(empty.empty());
+    BOOST_CHECK(!empty.is<int>());
+
+    Value i(12);
+    BOOST_CHECK_EQUAL(i.type(), Value::INT);
+    BOOST_CHECK_EQUAL(i.value(0), 12);
+    BOOST_CHECK_EQUAL(i.value(string("x")), string("x"));
+
+    Value s("text");
+    Value s2 = s;
+    BOOST_CHECK_EQUAL(s2.type(), Value::STRING);
+    BOOST_CHECK_EQUAL(s.get<string>(), s2.get<string>()); // shared
+    s2 = i;
+    BOOST_CHECK_EQUAL(s2.value(0), 12);
+    BOOST_CHECK_EQUAL(*s.get<string>(), string("text"));
+
+    Value d(double(2.5));   // not one of the parser types
+    BOOST_CHECK_EQUAL(d.type(), Value::OTHER);
+    BOOST_CHECK_EQUAL(d.value(double(0)), 2.5);
+    BOOST_CHECK(!d.is<int>());
+    BOOST_CHECK_EQUAL(any_cast<double>(d.toAny()), 2.5);
+
+    Node node("test");
+    node.setValue(string("value"));
+    BOOST_CHECK_EQUAL(node.valueString(), string("value"));
+    node.setValue(Token::list());
+    BOOST_CHECK_EQUAL(node.valueString(), string());
+    BOOST_CHECK(node.valueAny().is<Token::list>());
+}
+
+BOOST_AUTO_TEST_CASE( parser_interned )
+{
+    shared_ptr<Parser> parser = create_parser("\\relax\\relax");
+
+    // control sequences of the file and of the parser share the name
+    Token::ptr relax1 = parser->nextToken();
+    Token::ptr relax2 = parser->nextToken();
+    Token::ptr relax3 = Token::create(Token::TOK_CONTROL,
+                                      Token::CC_ESCAPE, "\\relax");
+    BOOST_CHECK_EQUAL(relax1->internedValue(), relax2->internedValue());
+    BOOST_CHECK_EQUAL(relax1->internedValue(), relax3->internedValue());
+    BOOST_CHECK_EQUAL(relax1->internedValue(), relax1->lcopy()->internedValue());
+    BOOST_CHECK_EQUAL(relax1->internedValue(), Token(*relax1).internedValue());
+    BOOST_CHECK_EQUAL(*relax1->internedValue(), string("\\relax"));
+
+    relax3->setValue("\\foo");
+    BOOST_CHECK_EQUAL(relax3->internedValue(),
+                      InternedString::intern("\\foo"));
+
+    parser->setSymbol(relax3, 5);
+    BOOST_CHECK_EQUAL(5, parser->symbol("\\foo", 0));
+    BOOST_CHECK_EQUAL(5, parser->symbol(SymbolKey::named("\\foo"), 0));
+    BOOST_CHECK_EQUAL(0, parser->symbol("\\bar", 0));
+
+    // the table holds only the names set in it, not every interned name
+    size_t count = parser->namedSymbolCount();
+    for(int n = 0; n < 10000; ++n)
+        InternedString::intern("\\unrelated" + boost::lexical_cast<string>(n));
+    shared_ptr<Parser> parser2(new Parser(shared_ptr<TestBundle>(
+            new TestBundle("<test-name>", shared_ptr<std::istream>(
+                new std::istringstream("")))), parser->dumpFormat()));
+    parser2->setSymbol("\\new", 1);
+    BOOST_CHECK_EQUAL(parser2->namedSymbolCount(), count + 1);
+    BOOST_CHECK_EQUAL(parser->namedSymbolCount(), count);
+}
+
+BOOST_AUTO_TEST_CASE( parser_interned_freed )
+{
+    // the names are freed with the last token or table holding them
+    Token::ptr token = Token::create(Token::TOK_CONTROL,
+                                     Token::CC_ESCAPE, "\\transient");
+    BOOST_CHECK(InternedString::find("\\transient"));
+    token.reset();
+    BOOST_CHECK(!InternedString::find("\\transient"));
+
+    shared_ptr<Parser> parser = create_parser(
+        "\\expandafter\\def\\csname r@label\\endcsname{1}");
+    Node::ptr document = parser->parse();
+    BOOST_CHECK(InternedString::find("\\r@label"));
+    parser.reset();
+    document.reset();
+    BOOST_CHECK(!InternedString::find("\\r@label"));
+}
+
+BOOST_AUTO_TEST_CASE( parser_format )
+{
+    shared_ptr<Parser> parser = create_parser(
+        "\\catcode`\\@=11 \\count10=5 \\countdef\\cnt=11 "
+        "\\chardef\\ch=65 \\font\\tenrm=cmr10 \\let\\rel=\\relax");
+    parser->parse();
+    Token::list_ptr params(new Token::list(1,
+                    Token::create(Token::TOK_CHARACTER, Token::CC_OTHER, "x")));
+    Token::list_ptr definition(new Token::list(1,
+                    Token::create(Token::TOK_CHARACTER, Token::CC_LETTER, "y")));
+    parser->setSymbol("\\foo@", Command::ptr(new base::UserMacro("\\foo@",
+                    params, definition, false, true)));
+    shared_ptr<const Format> format = parser->dumpFormat();
+    BOOST_REQUIRE(format);
+    BOOST_CHECK_EQUAL(format->catCode('@'), int(Token::CC_LETTER));
+
+    // the tables are shared and copied on the first change
+    boost::shared_ptr<std::istream> ifile(new std::istringstream(""));
+    Parser parser1(shared_ptr<TestBundle>(new TestBundle("<test-name>", ifile)),
+                   format);
+    BOOST_CHECK_EQUAL(parser1.symbol("\\foo@", Command::ptr()),
+                      parser->symbol("\\foo@", Command::ptr()));
+    BOOST_CHECK_EQUAL(parser1.lexer()->getCatCode('@'), int(Token::CC_LETTER));
+    parser1.setSymbol("count10", int(7));
+    parser1.setSymbol("\\foo@", int(1));
+    BOOST_CHECK_EQUAL(parser1.symbol("count10", 0), 7);
+    BOOST_CHECK_EQUAL(parser->symbol("count10", 0), 5);
+    BOOST_CHECK(parser->symbol("\\foo@", Command::ptr()));
+
+    // saving relative to the format of a new parser and loading back
+    shared_ptr<const Format> base = create_parser("")->dumpFormat();
+    std::ostringstream saved;
+    BOOST_REQUIRE(format->save(saved, *base));
+    std::istringstream input(saved.str());
+    shared_ptr<const Format> loaded = Format::load(input, *base);
+    BOOST_REQUIRE(loaded);
+    std::ostringstream resaved;
+    BOOST_CHECK(loaded->save(resaved, *base));
+    BOOST_CHECK_EQUAL(resaved.str(), saved.str());
+
+    shared_ptr<std::istream> ifile2(new std::istringstream(
+                                    "\\cnt=3 \\tenrm\\rel\\ch"));
+    Parser parser2(shared_ptr<TestBundle>(
+                    new TestBundle("<test-name>", ifile2)), loaded);
+    BOOST_CHECK_EQUAL(parser2.symbol("count10", 0), 5);
+    BOOST_CHECK(parser2.symbol("\\ch", Command::ptr()));
+    BOOST_CHECK(parser2.symbol("\\tenrm", Command::ptr()));
+    BOOST_CHECK_EQUAL(parser2.symbol("\\rel", Command::ptr()),
+                      parser2.symbol("\\relax", Command::ptr()));
+    BOOST_CHECK_EQUAL(parser2.symbol("\\foo@", Command::ptr())->texRepr(),
+                      parser->symbol("\\foo@", Command::ptr())->texRepr());
+    parser2.parse();
+    BOOST_CHECK_EQUAL(parser2.symbol("count11", 0), 3);
+
+    // \inputlineno and the date are kept by each parser
+    shared_ptr<std::istream> ifile3(new std::istringstream(
+            "\\relax\n{\\time=5 \\global\\count2=\\time}\n"
+            "\\count3=\\inputlineno \\count4=\\time"));
+    Parser parser3(shared_ptr<TestBundle>(
+                    new TestBundle("<test-name>", ifile3)), format);
+    parser3.parse();
+    BOOST_CHECK_EQUAL(parser3.symbol("count2", 0), 5);
+    BOOST_CHECK_EQUAL(parser3.symbol("count3", 0), 3);
+    BOOST_CHECK(parser3.symbol("count4", 0) != 5);
+    BOOST_CHECK_EQUAL(parser3.symbol("inputlineno", 0), 3);
+    BOOST_CHECK(parser->symbol("inputlineno", 0) != 3);
+
+    std::istringstream broken(saved.str().substr(0, saved.str().size() / 2));
+    BOOST_CHECK(!Format::load(broken, *base));
+
+    // corrupted lengths, token types and catcodes are rejected
+    std::ostringstream same;
+    BOOST_REQUIRE(base->save(same, *base));
+    string header = same.str().substr(0, same.str().rfind(" end"));
+    std::istringstream valid(header + " N 2:\\a T 1 11 1:a end\n");
+    BOOST_CHECK(Format::load(valid, *base));
+    const char* corrupted[] = {
+        " N 2:\\a T 3 11 1:a end\n",
+        " N 2:\\a T 1 17 1:a end\n",
+        " N 2:\\a T 1 -1 1:a end\n",
+        " N 2:\\a S 4000000000:a end\n",
+        " N 2:\\a L 2000000000 1 11 1:a end\n"
+    };
+    BOOST_FOREACH(const char* entry, corrupted) {
+        std::istringstream is(header + entry);
+        BOOST_CHECK(!Format::load(is, *base));
+    }
+    string badCatcode = header + " end\n";
+    size_t first = badCatcode.find(" catcodes ") + 10;
+    badCatcode.replace(first, badCatcode.find(' ', first) - first, "16");
+    std::istringstream badCatcodeInput(badCatcode);
+    BOOST_CHECK(!Format::load(badCatcodeInput, *base));
+}
+
+BOOST_AUTO_TEST_CASE( parser_parameters )
+{
+    shared_ptr<Parser> parser = create_parser(
+        "\\globaldefs=1 \\globaldefs=0 {\\tracingmacros=2 \\escapechar=`\\!}"
+        "\\newlinechar=10 ");
+    BOOST_CHECK_EQUAL(parser->escapechar(), int('\\'));
+    parser->parse();
+    BOOST_CHECK_EQUAL(parser->tracingmacros(), 0);
+    BOOST_CHECK_EQUAL(parser->escapechar(), int('\\'));
+    BOOST_CHECK_EQUAL(parser->globaldefs(), 0);
+    BOOST_CHECK_EQUAL(parser->newlinechar(), int('\n'));
+
+    parser->setSymbol("tracingcommands", int(2));
+    BOOST_CHECK_EQUAL(parser->tracingcommands(), 2);
+    parser->setSymbol("tracingcommands", string("x"));
+    BOOST_CHECK_EQUAL(parser->tracingcommands(), 0);
+
+    // the parameters are read from a format
+    parser->setSymbol("tracingrestores", int(1));
+    boost::shared_ptr<std::istream> ifile(new std::istringstream(""));
+    Parser parser1(shared_ptr<TestBundle>(new TestBundle("<test-name>", ifile)),
+                   parser->dumpFormat());
+    BOOST_CHECK_EQUAL(parser1.tracingrestores(), 1);
+    BOOST_CHECK_EQUAL(parser1.newlinechar(), int('\n'));
+
+    // and stay mirrored in the parsers created from a loaded format
+    shared_ptr<const Format> base = create_parser("")->dumpFormat();
+    std::ostringstream saved;
+    BOOST_REQUIRE(parser->dumpFormat()->save(saved, *base));
+    std::istringstream input(saved.str());
+    shared_ptr<const Format> loaded = Format::load(input, *base);
+    BOOST_REQUIRE(loaded);
+    boost::shared_ptr<std::istream> ifile2(new std::istringstream(
+                                    "{\\tracingrestores=0 }\\escapechar=`\\! "));
+    Parser parser2(shared_ptr<TestBundle>(new TestBundle("<test-name>", ifile2)),
+                   loaded);
+    BOOST_CHECK_EQUAL(parser2.tracingrestores(), 1);
+    parser2.parse();
+    BOOST_CHECK_EQUAL(parser2.tracingrestores(), 1);
+    BOOST_CHECK_EQUAL(parser2.escapechar(), int('!'));
+}
+
+BOOST_AUTO_TEST_CASE( parser_command_kinds )
+{
+    shared_ptr<Parser> parser = create_parser("");
+    Command::ptr ifx = parser->symbol("\\ifx", Command::ptr());
+    BOOST_REQUIRE(ifx);
+    BOOST_CHECK(ifx->is(Command::MACRO));
+    BOOST_CHECK(ifx->is(Command::CONDITIONAL_BEGIN));
+    BOOST_CHECK(!ifx->is(Command::CONDITIONAL_END));
+    BOOST_CHECK_EQUAL(parser->symbol("\\fi", Command::ptr())->kind(),
+                unsigned(Command::MACRO | Command::CONDITIONAL_END));
+    BOOST_CHECK(parser->symbol("\\global", Command::ptr())->is(
+                Command::PREFIX));
+    BOOST_CHECK(parser->symbol("\\let", Command::ptr())->is(
+                Command::ASSIGNMENT));
+    BOOST_CHECK(parser->symbol("\\count", Command::ptr())->is(
+                Command::ASSIGNMENT));
+    BOOST_CHECK(parser->symbol("\\begingroup", Command::ptr())->is(
+                Command::BEGINGROUP));
+    BOOST_CHECK_EQUAL(parser->symbol("\\relax", Command::ptr())->kind(), 0u);
+}
+
+BOOST_AUTO_TEST_CASE( parser_skip_conditional )
+{
+    string text = "\\iffalse \\count1=1 % \\fi\n"
+                  "\\iftrue \\count2=1 \\else \\count3=1 \\fi\n\n"
+                  "\\count4=1 \\else \\count5=1 \\fi\n"
+                  "\\catcode`\\~=13 \\let~=\\fi \\iffalse\\count6=1 ~\\count7=1 ";
+    shared_ptr<Parser> parser = create_parser(text);
+    Node::ptr document = parser->parse();
+    BOOST_CHECK_EQUAL(document->source(), text);
+    BOOST_CHECK_EQUAL(parser->symbol("count1", int(0)), 0);
+    BOOST_CHECK_EQUAL(parser->symbol("count2", int(0)), 0);
+    BOOST_CHECK_EQUAL(parser->symbol("count3", int(0)), 0);
+    BOOST_CHECK_EQUAL(parser->symbol("count4", int(0)), 0);
+    BOOST_CHECK_EQUAL(parser->symbol("count5", int(0)), 1);
+    BOOST_CHECK_EQUAL(parser->symbol("count6", int(0)), 0);
+    BOOST_CHECK_EQUAL(parser->symbol("count7", int(0)), 1);
+}
+
+BOOST_AUTO_TEST_CASE( parser_user_macro )
+{
+    // \m#1.#2 -> \count#2=#1#1 ##
+    Token::list_ptr params(new Token::list());
+    params->push_back(Token::create(Token::TOK_CHARACTER, Token::CC_PARAM, "#"));
+    params->push_back(Token::create(Token::TOK_CHARACTER, Token::CC_OTHER, "1"));
+    params->push_back(Token::create(Token::TOK_CHARACTER, Token::CC_OTHER, "."));
+    params->push_back(Token::create(Token::TOK_CHARACTER, Token::CC_PARAM, "#"));
+    params->push_back(Token::create(Token::TOK_CHARACTER, Token::CC_OTHER, "2"));
+    Token::list_ptr definition(new Token::list());
+    definition->push_back(Token::create(Token::TOK_CONTROL,
+                                        Token::CC_ESCAPE, "\\count"));
+    definition->push_back(params->at(3));
+    definition->push_back(params->at(4));
+    definition->push_back(Token::create(Token::TOK_CHARACTER, Token::CC_OTHER, "="));
+    definition->push_back(params->at(0));
+    definition->push_back(params->at(1));
+    definition->push_back(params->at(0));
+    definition->push_back(params->at(1));
+    definition->push_back(Token::create(Token::TOK_CHARACTER, Token::CC_SPACE, " "));
+    definition->push_back(params->at(0));
+    definition->push_back(params->at(0));
+
+    shared_ptr<Parser> parser = create_parser(
+            "\\m {12}.3\\m4.{5}\\relax");
+    Command::ptr macro(new base::UserMacro("\\m", params, definition,
+                                           false, false));
+    parser->setSymbol("\\m", macro);
+    parser->parse();
+    BOOST_CHECK_EQUAL(parser->symbol("count3", int(0)), 1212);
+    BOOST_CHECK_EQUAL(parser->symbol("count5", int(0)), 44);
+
+    // the macros which use no arguments share one expansion
+    parser = create_parser("\\count1=\\n.\\n. \\count2=\\n. ");
+    parser->setSymbol("\\n", Command::ptr(new base::UserMacro("\\n",
+            Token::list_ptr(new Token::list(1, params->at(2))),
+            Token::list_ptr(new Token::list(1, params->at(4))))));
+    parser->parse();
+    BOOST_CHECK_EQUAL(parser->symbol("count1", int(0)), 22);
+    BOOST_CHECK_EQUAL(parser->symbol("count2", int(0)), 2);
+
+    // \noexpand marks only its own expansion of such a macro:
+    // \m -> \n (read from a file), \n -> 7
+    Token::ptr seven = Token::create(Token::TOK_CHARACTER,
+                                     Token::CC_OTHER, "7");
+    Token::ptr n = Token::create(Token::TOK_CONTROL, Token::CC_ESCAPE,
+                                 "\\n", "\\n", 0, 1, 0, 2);
+    boost::shared_ptr<std::istream> ifile(new std::istringstream(
+        "\\catcode`\\{=1 \\catcode`\\}=2 "
+        "\\message{\\expandafter\\noexpand\\m\\m}"));
+    TestLogger* logger = new TestLogger;
+    Parser parser2(shared_ptr<TestBundle>(new TestBundle("<test-name>",
+                                    ifile)), shared_ptr<Logger>(logger));
+    parser2.setSymbol("\\n", Command::ptr(new base::UserMacro("\\n",
+            Token::list_ptr(new Token::list()),
+            Token::list_ptr(new Token::list(1, seven)))));
+    parser2.setSymbol("\\m", Command::ptr(new base::UserMacro("\\m",
+            Token::list_ptr(new Token::list()),
+            Token::list_ptr(new Token::list(1, n)))));
+    parser2.parse();
+    BOOST_REQUIRE_EQUAL(logger->logMessages.size(), size_t(5));
+    BOOST_CHECK_EQUAL(logger->logMessages[3], "\\n 7");
+
+    // both expansions return the same token, which is not marked itself
+    Command::ptr m = parser2.symbol("\\m", Command::ptr());
+    Node::ptr node1(new Node("m")), node2(new Node("m"));
+    static_pointer_cast<Macro>(m)->expand(parser2, node1);
+    static_pointer_cast<Macro>(m)->expand(parser2, node2);
+    Token::ptr a = node1->value(Token::list_ptr())->at(0);
+    Token::ptr b = node2->value(Token::list_ptr())->at(0);
+    BOOST_CHECK_EQUAL(a, b);
+    Token::ptr marked = parser2.addNoexpand(a);
+    BOOST_CHECK(marked->isNoexpand());
+    BOOST_CHECK(!b->isNoexpand());
+    parser2.resetNoexpand();
+    BOOST_CHECK(!marked->isNoexpand());
+}
+
+BOOST_AUTO_TEST_CASE( parser_expansion_source )
+{
+    // nested expansions: \a -> \b, \b -> x
+    string text = "\\a\\b \\a";
+    shared_ptr<Parser> parser = create_parser(text);
+    parser->setSymbol("\\b", Command::ptr(new base::UserMacro("\\b",
+            Token::list_ptr(new Token::list()),
+            Token::list_ptr(new Token::list(1, Token::create(
+                    Token::TOK_CHARACTER, Token::CC_LETTER, "x"))))));
+    parser->setSymbol("\\a", Command::ptr(new base::UserMacro("\\a",
+            Token::list_ptr(new Token::list()),
+            Token::list_ptr(new Token::list(1, Token::create(
+                    Token::TOK_CONTROL, Token::CC_ESCAPE, "\\b"))))));
+    Node::ptr document = parser->parse();
+    BOOST_CHECK_EQUAL(document->source(), text);
+
+    // the source of a token made of the tokens of two files
+    shared_ptr<string> file1(new string("file1"));
+    shared_ptr<string> file2(new string("file2"));
+    shared_ptr<Token::list> parts(new Token::list());
+    parts->push_back(Token::create(Token::TOK_CONTROL, Token::CC_ESCAPE,
+                                   "\\a", "\\a", 0, 1, 0, 2, false, file1));
+    parts->push_back(Token::create(Token::TOK_CHARACTER, Token::CC_LETTER,
+                                   "y", "y", 0, 1, 0, 1, false, file2));
+    Token::ptr token = Token::create(Token::TOK_SKIPPED, Token::CC_ESCAPE,
+                                   "\\a", "", 0, 0, 0, 0, false, file1);
+    token->setSourceTokens(parts);
+    BOOST_CHECK_EQUAL(token->source(), "\\ay");
+
+    Node node("test");
+    node.tokens().push_back(token);
+    BOOST_CHECK_EQUAL(node.source("file1"), "\\a");
+    BOOST_CHECK_EQUAL(node.source("file2"), "y");
+    BOOST_CHECK_EQUAL(node.sources()[file2], "y");
+}
+
+BOOST_AUTO_TEST_CASE( parser_token_queue )
+{
+    Token::list_ptr list(new Token::list());
+    for(char ch = 'a'; ch <= 'c'; ++ch)
+        list->push_back(Token::create(Token::TOK_CHARACTER,
+                                Token::CC_LETTER, string(1, ch)));
+    Token::ptr x = Token::create(Token::TOK_CHARACTER, Token::CC_LETTER, "x");
+    Token::ptr y = Token::create(Token::TOK_CHARACTER, Token::CC_LETTER, "y");
+
+    TokenQueue queue;
+    queue.push_front(x);
+    queue.push_front(list, 1);
+    queue.push_front(list, 3);
+    queue.push_back(y);
+
+    // the frames share the list
+    BOOST_CHECK_EQUAL(queue.front(), list->at(1));
+    BOOST_CHECK_EQUAL(queue.take(), list->at(1));
+    queue.pop_front();
+    BOOST_CHECK_EQUAL(queue.take(), x);
+    BOOST_CHECK_EQUAL(queue.take(), y);
+    BOOST_CHECK(queue.empty());
+    BOOST_CHECK_EQUAL(list->size(), size_t(3));
+
+    // the tokens added at the end are read in order
+    for(size_t n = 0; n < 1000; ++n)
+        queue.push_back(n % 2 ? x : y);
+    queue.push_front(list, 2);
+    BOOST_CHECK_EQUAL(queue.take(), list->at(2));
+    for(size_t n = 0; n < 1000; ++n)
+        BOOST_CHECK_EQUAL(queue.take(), n % 2 ? x : y);
+    BOOST_CHECK(queue.empty());
+}
+
+BOOST_AUTO_TEST_CASE( parser_noexpand )
+{
+    shared_ptr<Parser> parser = create_parser(
+            "\\if\\noexpand\\m\\relax \\count1=1 \\fi"
+            "\\if\\m\\relax \\else \\count2=\\m \\fi");
+    parser->setSymbol("\\m", Command::ptr(new base::UserMacro("\\m",
+            Token::list_ptr(new Token::list()),
+            Token::list_ptr(new Token::list(1, Token::create(
+                    Token::TOK_CHARACTER, Token::CC_OTHER, "5"))))));
+    parser->parse();
+    BOOST_CHECK_EQUAL(parser->symbol("count1", int(0)), 1);
+    BOOST_CHECK_EQUAL(parser->symbol("count2", int(0)), 5);
+}
+
+BOOST_AUTO_TEST_CASE( parser_groups )
+{
+    shared_ptr<Parser> parser = create_parser(
+            "\\count1=1 {\\count1=2 \\catcode`\\@=11 \\sfcode`\\@=5 "
+            "{\\global\\count2=3 \\count1=4 \\escapechar=`\\!}"
+            "\\count3=\\count1 }");
+    parser->parse();
+    BOOST_CHECK_EQUAL(parser->groupLevel(), 0);
+    BOOST_CHECK_EQUAL(parser->symbol("count1", int(0)), 1);
+    BOOST_CHECK_EQUAL(parser->symbol("count2", int(0)), 3);
+    BOOST_CHECK_EQUAL(parser->symbol("count3", int(0)), 0);
+    BOOST_CHECK_EQUAL(parser->lexer()->getCatCode('@'), int(Token::CC_OTHER));
+    BOOST_CHECK_EQUAL(parser->sfcode('@'), 1000);
+    BOOST_CHECK_EQUAL(parser->escapechar(), int('\\'));
+}
+
+BOOST_AUTO_TEST_CASE( parser_spacefactor )
+{
+    shared_ptr<Parser> parser = create_parser(
+            "\\sfcode`\\.=3000 a.\\count1=\\spacefactor "
+            "A\\count2=\\spacefactor \\par aA\\count3=\\spacefactor ");
+    parser->parse();
+    BOOST_CHECK_EQUAL(parser->sfcode('.'), 3000);
+    BOOST_CHECK_EQUAL(parser->sfcode('A'), 999);
+    BOOST_CHECK_EQUAL(parser->symbol("count1", int(0)), 3000);
+    // the letters with sfcode below 1000 do not lower it below 1000
+    BOOST_CHECK_EQUAL(parser->symbol("count2", int(0)), 1000);
+    BOOST_CHECK_EQUAL(parser->symbol("count3", int(0)), 999);
+    BOOST_CHECK_EQUAL(parser->spacefactor(),
+                      parser->symbol("spacefactor", int(0)));
+}
+
+// provides the text in memory, as the preamble cache needs
+class BufferBundle: public TestBundle
+{
+public:
+    explicit BufferBundle(const string& text,
+                          const string& fileName = "<test-name>")
+        : TestBundle(fileName, shared_ptr<std::istream>(
+                        new std::istringstream(text))), m_text(text) {}
+
+    shared_ptr<InputBuffer> get_file_buffer(const string&) {
+        return InputBuffer::fromString(m_text);
+    }
+
+protected:
+    string m_text;
+};
+
+BOOST_AUTO_TEST_CASE( parser_preamble_cache )
+{
+    string preamble = "\\catcode`\\@=11 \\count10=5\n"
+                      "\\let\\rel=\\relax {\\count1=2}\n\\iftrue\n";
+    string text1 = preamble + "\\begin{document}\nHello\\rel\\fi\n";
+    string text2 = preamble + "\\begin{document}\nWorld\\fi \\count11=3\n";
+
+    Parser reference(shared_ptr<Bundle>(new BufferBundle(text2)));
+    string referenceRepr = reference.parse()->treeRepr();
+
+    shared_ptr<PreambleCache> cache(new PreambleCache);
+    Parser parser1(shared_ptr<Bundle>(new BufferBundle(text1)));
+    parser1.setPreambleCache(cache);
+    string repr1 = parser1.parse()->treeRepr();
+    BOOST_CHECK_EQUAL(cache->size(), size_t(1));
+    BOOST_CHECK_EQUAL(cache->hits(), size_t(0));
+
+    // the second document starts from the state saved by the first one
+    Parser parser2(shared_ptr<Bundle>(new BufferBundle(text2)));
+    parser2.setPreambleCache(cache);
+    string repr2 = parser2.parse()->treeRepr();
+    BOOST_CHECK_EQUAL(cache->hits(), size_t(1));
+    BOOST_CHECK_EQUAL(repr2, referenceRepr);
+    BOOST_CHECK(repr2 != repr1);
+    BOOST_CHECK_EQUAL(parser2.symbol("count10", 0), 5);
+    BOOST_CHECK_EQUAL(parser2.symbol("count11", 0), 3);
+    BOOST_CHECK_EQUAL(parser2.symbol("count1", 0), 0);
+    BOOST_CHECK_EQUAL(parser2.lexer()->getCatCode('@'), int(Token::CC_LETTER));
+    BOOST_CHECK_EQUAL(parser1.symbol("count11", 0), 0);
+
+    // a different preamble is parsed
+    Parser parser3(shared_ptr<Bundle>(new BufferBundle("\\relax\n" + text1)));
+    parser3.setPreambleCache(cache);
+    parser3.parse();
+    BOOST_CHECK_EQUAL(cache->hits(), size_t(1));
+    BOOST_CHECK_EQUAL(cache->size(), size_t(2));
+}
+
+std::set<string> fileNames(const Node::ptr& node)
+{
+    std::set<string> names;
+    BOOST_FOREACH(const shared_ptr<string>& name, node->files())
+        names.insert(name ? *name : string());
+    return names;
+}
+
+BOOST_AUTO_TEST_CASE( parser_preamble_cache_files )
+{
+    string preamble = "\\def\\x{a}\\count10=5\n";
+    string text = preamble + "\\begin{document}\nHello\\x\n";
+
+    Parser reference(shared_ptr<Bundle>(new BufferBundle(text, "doc2.tex")));
+    Node::ptr referenceTree = reference.parse();
+
+    shared_ptr<PreambleCache> cache(new PreambleCache);
+    weak_ptr<SourceFile> file1;
+    {
+        Parser parser1(shared_ptr<Bundle>(
+                    new BufferBundle(text, "doc1.tex")));
+        parser1.setPreambleCache(cache);
+        parser1.parse();
+        file1 = parser1.lexer()->sourceFile();
+    }
+
+    // the entry does not keep the file of the parse which saved it
+    BOOST_CHECK_EQUAL(cache->size(), size_t(1));
+    BOOST_CHECK(file1.expired());
+
+    // the tokens of a cache hit belong to the file being parsed
+    Parser parser2(shared_ptr<Bundle>(new BufferBundle(text, "doc2.tex")));
+    parser2.setPreambleCache(cache);
+    Node::ptr tree = parser2.parse();
+    BOOST_CHECK_EQUAL(cache->hits(), size_t(1));
+    BOOST_CHECK_EQUAL(tree->treeRepr(), referenceTree->treeRepr());
+    BOOST_CHECK_EQUAL(tree->isOneFile(), referenceTree->isOneFile());
+    BOOST_CHECK(fileNames(tree) == fileNames(referenceTree));
+    BOOST_CHECK_EQUAL(tree->files().size(), size_t(1));
+    BOOST_CHECK_EQUAL(tree->source("doc2.tex"),
+                      referenceTree->source("doc2.tex"));
+    BOOST_CHECK_EQUAL(tree->source("doc2.tex"), text);
+}
+
+
+void writeFile(const string& fileName, const string& text)
+{
+    std::ofstream file(fileName.c_str(), std::ios::out | std::ios::binary);
+    file << text;
+}
+
+string readFile(const string& fileName)
+{
+    std::ifstream file(fileName.c_str(), std::ios::in | std::ios::binary);
+    std::ostringstream text;
+    text << file.rdbuf();
+    return text.str();
+}
+
+class StreamFileBundle: public FileBundle
+{
+public:
+    explicit StreamFileBundle(const string& mainFileName)
+        : FileBundle(mainFileName) {}
+
+    shared_ptr<InputBuffer> get_file_buffer(const string&) {
+        return shared_ptr<InputBuffer>();
+    }
+};
+
+BOOST_AUTO_TEST_CASE( parser_file_bundle )
+{
+    string main = "\\input parser_file_bundle_part\r\n"
+                  "\\count1=\\count2 \\relax % comment\r\n"
+                  "\\count3=1\\count4=2";
+    string part = "\\count2=7\n\n";
+    writeFile("parser_file_bundle.tex", main);
+    writeFile("parser_file_bundle_part.tex", part);
+
+    FileBundle::ptr bundle(new FileBundle("parser_file_bundle.tex"));
+    BOOST_CHECK_EQUAL(bundle->get_tex_filename("parser_file_bundle_part"),
+                      "parser_file_bundle_part.tex");
+    shared_ptr<InputBuffer> buffer =
+            bundle->get_file_buffer("parser_file_bundle.tex");
+    BOOST_REQUIRE(buffer);
+    BOOST_CHECK_EQUAL(string(buffer->data(), buffer->size()), main);
+    BOOST_CHECK(InputBuffer::isMapped("parser_file_bundle.tex"));
+    buffer.reset();
+    BOOST_CHECK(!InputBuffer::isMapped("parser_file_bundle.tex"));
+    BOOST_CHECK(!bundle->get_file_buffer("parser_file_bundle_none.tex"));
+
+    // the mapped files are parsed as the streams are
+    Parser parser(bundle);
+    Node::ptr document = parser.parse();
+    Parser reference(shared_ptr<Bundle>(
+                new StreamFileBundle("parser_file_bundle.tex")));
+    Node::ptr referenceDocument = reference.parse();
+
+    BOOST_CHECK(parser.lexer()->buffer());
+    BOOST_CHECK_EQUAL(document->treeRepr(), referenceDocument->treeRepr());
+    BOOST_CHECK_EQUAL(document->source("parser_file_bundle.tex"), main);
+    BOOST_CHECK_EQUAL(document->source("parser_file_bundle_part.tex"), part);
+    BOOST_CHECK_EQUAL(document->source(),
+                      referenceDocument->source());
+    BOOST_CHECK_EQUAL(parser.symbol("count1", 0), 7);
+    BOOST_CHECK_EQUAL(parser.symbol("count4", 0), 2);
+
+    std::remove("parser_file_bundle.tex");
+    std::remove("parser_file_bundle_part.tex");
+}
+
+BOOST_AUTO_TEST_CASE( parser_file_bundle_openout )
+{
+    // the second line is read after the file is rewritten; it lies past
+    // the end of the new file
+    writeFile("parser_file_bundle.aux",
+              "\\count1=1\n" + string(20000, ' ') + "42\n");
+    ::chmod("parser_file_bundle.aux", 0600);
+    ::symlink("parser_file_bundle.aux", "parser_file_bundle_link.aux");
+    writeFile("parser_file_bundle_openout.tex",
+              "\\catcode`\\{=1 \\catcode`\\}=2 \\count3=5 "
+              "\\openin1=parser_file_bundle_link.aux \\read1to\\x\n"
+              "\\immediate\\openout2=parser_file_bundle_link.aux "
+              "\\immediate\\write2{new}\\immediate\\closeout2\n"
+              "\\read1to\\y \\count3=\\y\\relax\n");
+
+    struct stat before;
+    BOOST_REQUIRE(::stat("parser_file_bundle.aux", &before) == 0);
+
+    Parser parser(shared_ptr<Bundle>(
+                new FileBundle("parser_file_bundle_openout.tex")),
+                shared_ptr<Logger>(new TestLogger));
+    parser.parse();
+    BOOST_CHECK_EQUAL(parser.symbol("count3", 0), 42);
+
+    // the file is rewritten in place, through the link
+    struct stat after;
+    BOOST_REQUIRE(::lstat("parser_file_bundle_link.aux", &after) == 0);
+    BOOST_CHECK(S_ISLNK(after.st_mode));
+    BOOST_REQUIRE(::stat("parser_file_bundle.aux", &after) == 0);
+    BOOST_CHECK_EQUAL(after.st_ino, before.st_ino);
+    BOOST_CHECK_EQUAL(after.st_mode & 0777, mode_t(0600));
+    BOOST_CHECK_EQUAL(readFile("parser_file_bundle.aux"), "new\n");
+
+    std::remove("parser_file_bundle_link.aux");
+    std::remove("parser_file_bundle.aux");
+    std::remove("parser_file_bundle_openout.tex");
+}
+
+// holds the worker of the prefetcher in get_file_buffer() of one file
+class BlockingFileBundle: public FileBundle
+{
+public:
+    BlockingFileBundle(const string& mainFileName, const string& blocked)
+        : FileBundle(mainFileName), m_blocked(blocked),
+          m_entered(false), m_released(false) {}
+
+    shared_ptr<InputBuffer> get_file_buffer(const string& fname) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_loaded.push_back(fname);
+        if(fname == m_blocked) {
+            m_entered = true;
+            m_cond.notify_all();
+            while(!m_released)
+                m_cond.wait(lock);
+        }
+        lock.unlock();
+        return FileBundle::get_file_buffer(fname);
+    }
+
+    void waitEntered() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while(!m_entered)
+            m_cond.wait(lock);
+    }
+
+    void release(int delayMs) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(delayMs));
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_released = true;
+        m_cond.notify_all();
+    }
+
+    vector<string> loaded() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_loaded;
+    }
+
+protected:
+    string m_blocked;
+    bool m_entered;
+    bool m_released;
+    vector<string> m_loaded;
+    std::mutex m_mutex;
+    std::condition_variable m_cond;
+};
+
+BOOST_AUTO_TEST_CASE( parser_prefetcher )
+{
+    writeFile("parser_prefetcher_a.tex", "\\count1=1\n");
+    writeFile("parser_prefetcher_b.tex", "\\count2=2\n");
+    writeFile("parser_prefetcher.tex",
+              "\\input parser_prefetcher_a % \\input parser_prefetcher_c\n"
+              "\\input{parser_prefetcher_b.tex}\\count3=3\n");
+
+    vector<string> names = Prefetcher::scanInputs(
+                *InputBuffer::mapFile("parser_prefetcher.tex"));
+    BOOST_REQUIRE_EQUAL(names.size(), size_t(2));
+    BOOST_CHECK_EQUAL(names[0], "parser_prefetcher_a");
+    BOOST_CHECK_EQUAL(names[1], "parser_prefetcher_b.tex");
+
+    shared_ptr<BlockingFileBundle> bundle(new BlockingFileBundle(
+                "parser_prefetcher.tex", "parser_prefetcher_a.tex"));
+    {
+        Prefetcher prefetcher(bundle);
+        BOOST_CHECK(!prefetcher.take("parser_prefetcher_a.tex"));
+
+        // a is LOADING on the worker, b is QUEUED behind it
+        prefetcher.request("parser_prefetcher_a.tex");
+        bundle->waitEntered();
+        prefetcher.request("parser_prefetcher_b.tex");
+        prefetcher.request("parser_prefetcher_a.tex");
+
+        // a queued file is left to the caller and never loaded
+        BOOST_CHECK(!prefetcher.take("parser_prefetcher_b.tex"));
+
+        // a file being loaded is waited for
+        std::thread releaser(&BlockingFileBundle::release, bundle.get(), 20);
+        shared_ptr<InputBuffer> buffer =
+                prefetcher.take("parser_prefetcher_a.tex");
+        releaser.join();
+        BOOST_REQUIRE(buffer);
+        BOOST_CHECK_EQUAL(string(buffer->data(), buffer->size()),
+                          "\\count1=1\n");
+        BOOST_CHECK(!prefetcher.take("parser_prefetcher_a.tex"));
+    }
+    BOOST_REQUIRE_EQUAL(bundle->loaded().size(), size_t(1));
+    BOOST_CHECK_EQUAL(bundle->loaded()[0], "parser_prefetcher_a.tex");
+
+    // the parser takes the prefetched files of a file bundle
+    Parser parser(shared_ptr<Bundle>(new FileBundle("parser_prefetcher.tex")));
+    parser.setPrefetch(true);
+    BOOST_CHECK(parser.prefetch());
+    Node::ptr document = parser.parse();
+    Parser reference(shared_ptr<Bundle>(
+                new StreamFileBundle("parser_prefetcher.tex")));
+    BOOST_CHECK_EQUAL(document->treeRepr(), reference.parse()->treeRepr());
+    BOOST_CHECK_EQUAL(parser.symbol("count1", 0), 1);
+    BOOST_CHECK_EQUAL(parser.symbol("count2", 0), 2);
+    BOOST_CHECK_EQUAL(parser.symbol("count3", 0), 3);
+
+    std::remove("parser_prefetcher.tex");
+    std::remove("parser_prefetcher_a.tex");
+    std::remove("parser_prefetcher_b.tex");
+}
+
+// the tokens read from a buffer cut their source from the text of the file
+BOOST_AUTO_TEST_CASE( parser_token_source_view )
+{
+    string text = "\\a  b%c\r\n \\de{f}\n\n\\g";
+    Token::list tokens;
+    {
+        Lexer lexer("source.tex", InputBuffer::fromString(text));
+        std::istringstream stream(text);
+        Lexer streamLexer("source.tex", &stream);
+        string source;
+        while(Token::ptr token = lexer.nextToken()) {
+            BOOST_CHECK_EQUAL(token->source(), text.substr(
+                    token->linePos() + token->charPos(),
+                    token->charEnd() - token->charPos()));
+            Token::ptr streamToken = streamLexer.nextToken();
+            BOOST_REQUIRE(streamToken);
+            BOOST_CHECK_EQUAL(token->repr(), streamToken->repr());
+            source += token->source();
+            tokens.push_back(token);
+        }
+        BOOST_CHECK(!streamLexer.nextToken());
+        BOOST_CHECK_EQUAL(source, text);
+    }
+
+    // the tokens keep the file alive, the copies own their text
+    BOOST_REQUIRE_EQUAL(tokens[3]->source(), "%c\r\n");
+    Token copy(*tokens[3]);
+    tokens[3]->setValue("x");
+    BOOST_CHECK_EQUAL(tokens[3]->source(), "%c\r\n");
+    BOOST_CHECK_EQUAL(tokens[3]->value(), "x");
+    BOOST_CHECK_EQUAL(copy.value(), "%");
+    BOOST_CHECK_EQUAL(copy.source(), "%c\r\n");
+    BOOST_CHECK_EQUAL(copy.fileName(), "source.tex");
+    BOOST_CHECK_EQUAL(tokens.back()->fileName(), "source.tex");
+}
+
+BOOST_AUTO_TEST_CASE( parser_token_arena )
+{
+    TokenArena::ptr arena(new TokenArena);
+    Token::list tokens;
+    for(size_t n = 0; n < 10000; ++n)
+        tokens.push_back(arena->create(Token::TOK_CHARACTER,
+                    Token::CC_LETTER, string(1, 'a' + n % 26)));
+    size_t blocks = arena->blockCount();
+    BOOST_CHECK(blocks > 1);
+    BOOST_CHECK(TokenArena::of(tokens.front().get()) == arena.get());
+    BOOST_CHECK(TokenArena::of(tokens.back().get()) == arena.get());
+    BOOST_CHECK_EQUAL(tokens[27]->value(), "b");
+
+    // the slots of the released tokens are reused
+    tokens.clear();
+    for(size_t n = 0; n < 10000; ++n)
+        tokens.push_back(arena->create(Token::TOK_CHARACTER,
+                    Token::CC_OTHER, "1"));
+    BOOST_CHECK_EQUAL(arena->blockCount(), blocks);
+
+    // the tokens keep the arena alive
+    TokenArena* rawArena = arena.get();
+    arena.reset();
+    BOOST_CHECK(TokenArena::of(tokens.back().get()) == rawArena);
+    BOOST_CHECK_EQUAL(tokens.back()->value(), "1");
+    tokens.clear();
+
+    // and the document keeps the tokens of the parse
+    string text = "\\count1=5 abc{d}\n\\relax";
+    Node::ptr document;
+    string repr;
+    {
+        shared_ptr<Parser> parser = create_parser(text);
+        document = parser->parse();
+        repr = document->treeRepr();
+    }
+    BOOST_CHECK_EQUAL(document->treeRepr(), repr);
+    BOOST_CHECK_EQUAL(document->source(), text);
+}
+
+BOOST_AUTO_TEST_CASE( parser_token_layout )
+{
+    if(sizeof(void*) == 8)
+        BOOST_CHECK_EQUAL(sizeof(Token), size_t(32));
+
+    // the tokens of the files of one arena find their files by index
+    TokenArena::ptr arena(new TokenArena);
+    Lexer lexer1("one.tex", InputBuffer::fromString("\\a b\n"));
+    Lexer lexer2("two.tex", InputBuffer::fromString("c \\d\n"));
+    lexer1.setTokenArena(arena);
+    lexer2.setTokenArena(arena);
+    Token::ptr token1 = lexer1.nextToken();
+    Token::ptr token2 = lexer2.nextToken();
+    BOOST_CHECK(TokenArena::of(token1.get()) == arena.get());
+    BOOST_CHECK(TokenArena::of(token2.get()) == arena.get());
+    BOOST_CHECK_EQUAL(token1->fileName(), "one.tex");
+    BOOST_CHECK_EQUAL(token2->fileName(), "two.tex");
+    BOOST_CHECK(token1->fileNamePtr() == lexer1.fileNamePtr());
+    BOOST_CHECK_EQUAL(token1->source(), "\\a");
+    BOOST_CHECK_EQUAL(token2->source(), "c");
+
+    // when the file table is full the lexer keeps its own arena
+    while(arena->addFile(lexer1.sourceFile()) != 0);
+    size_t files = arena->fileCount();
+    Lexer lexer3("three.tex", InputBuffer::fromString("\\e f\n"));
+    lexer3.setTokenArena(arena);
+    BOOST_CHECK_EQUAL(arena->fileCount(), files);
+    BOOST_CHECK(lexer3.tokenArena() != arena);
+    Token::ptr token3 = lexer3.nextToken();
+    BOOST_CHECK_EQUAL(token3->fileName(), "three.tex");
+    BOOST_CHECK_EQUAL(token3->source(), "\\e");
+}
+
+// the vectorized letter and space runs end where the scalar ones do
+BOOST_AUTO_TEST_CASE( parser_lexer_runs )
+{
+    string letters = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    string text;
+    for(size_t n = 1; n < 40; ++n) {
+        string word = letters.substr(n % 11, n);
+        text += string(n % 5, ' ') + "\\" + word + string(n, ' ') + word +
+                (n % 3 ? "1" : "\\" + word) + string(n % 17, ' ') +
+                word + "\n";
+    }
+    text += "\\" + letters;
+
+    Lexer lexer("runs.tex", InputBuffer::fromString(text));
+    // characters above 0x7f make the sets of letters and spaces
+    // too complex for the vectorized scan
+    Lexer scalarLexer("runs.tex", InputBuffer::fromString(text));
+    scalarLexer.assignCatCode(0xfe, Token::CC_SPACE);
+    scalarLexer.assignCatCode(0xff, Token::CC_LETTER);
+
+    size_t count = 0;
+    while(Token::ptr token = lexer.nextToken()) {
+        Token::ptr scalarToken = scalarLexer.nextToken();
+        BOOST_REQUIRE(scalarToken);
+        BOOST_CHECK_EQUAL(token->repr(), scalarToken->repr());
+        ++count;
+    }
+    BOOST_CHECK(!scalarLexer.nextToken());
+    BOOST_CHECK(count > 200);
+}
+
+BOOST_AUTO_TEST_CASE( parser_lexer_batch )
+{
+    string text = "\\a b{c} %d\n\n  e@f\\g@h i\r\n\\j";
+    Lexer lexer("batch.tex", InputBuffer::fromString(text));
+    Lexer batchLexer("batch.tex", InputBuffer::fromString(text));
+
+    // the batches give the tokens of nextToken(), one line at most
+    Token::list tokens;
+    vector<Lexer::LinePosition> positions;
+    size_t count;
+    while((count = batchLexer.nextTokens(tokens, 3, &positions)) != 0) {
+        BOOST_CHECK(count <= 3);
+        BOOST_CHECK_EQUAL(positions.size(), tokens.size());
+        for(size_t n = tokens.size() - count; n < tokens.size(); ++n) {
+            if(n > tokens.size() - count)
+                BOOST_CHECK_EQUAL(tokens[n]->lineNo(), tokens[n-1]->lineNo());
+            Token::ptr token = lexer.nextToken();
+            BOOST_REQUIRE(token);
+            BOOST_CHECK_EQUAL(tokens[n]->repr(), token->repr());
+        }
+    }
+    BOOST_CHECK(!lexer.nextToken());
+
+    // the tokens lexed again after a rewind are the same
+    Lexer lineLexer("batch.tex", InputBuffer::fromString(text));
+    Token::list line;
+    positions.clear();
+    lineLexer.tokenizeLine(line, &positions);
+    line.clear();
+    positions.clear();
+    lineLexer.tokenizeLine(line, &positions);
+    line.clear();
+    positions.clear();
+    BOOST_REQUIRE(lineLexer.tokenizeLine(line, &positions) > 4);
+    lineLexer.rewind(positions[1]);
+    Token::ptr token = lineLexer.nextToken();
+    BOOST_CHECK_EQUAL(token->repr(), line[2]->repr());
+    BOOST_CHECK_EQUAL(token->source(), line[2]->source());
+    BOOST_CHECK_EQUAL(token->source(), "@");
+
+    // and they follow the catcodes changed before the rewind
+    BOOST_CHECK_EQUAL(line[4]->value(), "\\g");
+    lineLexer.rewind(positions[3]);
+    lineLexer.assignCatCode('@', Token::CC_LETTER);
+    token = lineLexer.nextToken();
+    BOOST_CHECK_EQUAL(token->value(), "\\g@h");
+    BOOST_CHECK_EQUAL(token->source(), "\\g@h");
+
+    // the parser drops its batch when the catcodes change in the line
+    shared_ptr<Parser> parser = create_parser(
+            "\\catcode`\\@=11 \\let\\a@b=\\relax\\a@b");
+    Node::ptr document = parser->parse();
+    BOOST_CHECK(parser->symbol("\\a@b", Command::ptr()));
+    BOOST_CHECK(!parser->symbol("\\a", Command::ptr()));
+}
+
+BOOST_AUTO_TEST_CASE( parser_lexer_lines )
+{
+    string text = "\\a b\n\r\nc\rd \\e\r\n\n%f\ng";
+    const char* lines[] = { "\\a b\n", "\r\n", "c\r", "d \\e\r\n",
+                            "\n", "%f\n", "g" };
+    size_t lineStarts[] = { 0, 5, 7, 9, 15, 16, 19 };
+
+    std::istringstream stream(text);
+    Lexer streamLexer("lines.tex", &stream, false, true);
+    Lexer lexer("lines.tex", InputBuffer::fromString(text), false, true);
+    BOOST_CHECK(lexer.line(1).empty());
+
+    while(Token::ptr token = lexer.nextToken()) {
+        // the lines below the current one are not read yet
+        BOOST_CHECK_EQUAL(token->lineNo(), lexer.lineNo());
+        BOOST_CHECK(lexer.line(lexer.lineNo() + 1).empty());
+
+        size_t n = token->lineNo();
+        BOOST_REQUIRE(n >= 1 && n <= 7);
+        BOOST_CHECK_EQUAL(lexer.line(n).to_string(), lines[n-1]);
+        BOOST_CHECK_EQUAL(token->linePos(), lineStarts[n-1]);
+
+        Token::ptr streamToken = streamLexer.nextToken();
+        BOOST_REQUIRE(streamToken);
+        BOOST_CHECK_EQUAL(streamToken->repr(), token->repr());
+        BOOST_CHECK_EQUAL(streamLexer.line(n).to_string(), lines[n-1]);
+    }
+
+    // all the lines stay available in any order
+    for(size_t n = 7; n >= 1; --n) {
+        BOOST_CHECK_EQUAL(lexer.line(n).to_string(), lines[n-1]);
+        BOOST_CHECK_EQUAL(streamLexer.line(n).to_string(), lines[n-1]);
+    }
+    BOOST_CHECK(lexer.line(0).empty());
+    BOOST_CHECK(lexer.line(8).empty());
+
+    // without saveLines there is no index
+    Lexer noLines("lines.tex", InputBuffer::fromString(text));
+    noLines.nextToken();
+    BOOST_CHECK(noLines.line(1).empty());
+}
+
+// changes the catcodes after the second line
+void changeCatCodes(Lexer& lexer, const Token::ptr& token)
+{
+    if(token->isLastInLine() && token->lineNo() == 2) {
+        lexer.assignCatCode('@', Token::CC_LETTER);
+        lexer.setEndlinechar(-1);
+    }
+}
+
+BOOST_AUTO_TEST_CASE( parser_lexer_checkpoint )
+{
+    string text = "\\a b@c\n\n\\d@e f\r\n  g%h\n\\i@j";
+    Lexer lexer("checkpoint.tex", InputBuffer::fromString(text), false, true);
+
+    // checkpoints after the last token of each line
+    Token::list tokens;
+    vector<Lexer::Checkpoint> checkpoints;
+    vector<size_t> next;
+    while(Token::ptr token = lexer.nextToken()) {
+        tokens.push_back(token);
+        if(token->isLastInLine()) {
+            changeCatCodes(lexer, token);
+            checkpoints.push_back(lexer.checkpoint());
+            next.push_back(tokens.size());
+        }
+    }
+    BOOST_REQUIRE_EQUAL(checkpoints.size(), size_t(4));
+    BOOST_CHECK_EQUAL(tokens.back()->value(), "\\i@j");
+
+    // a fresh lexer continues from each checkpoint as the first one did
+    for(size_t n = 0; n < checkpoints.size(); ++n) {
+        Lexer restored("checkpoint.tex",
+                       InputBuffer::fromString(text), false, true);
+        BOOST_REQUIRE(restored.restore(checkpoints[n]));
+        BOOST_CHECK_EQUAL(restored.lineNo(), checkpoints[n].lineNo);
+        size_t pos = next[n];
+        while(Token::ptr token = restored.nextToken()) {
+            BOOST_REQUIRE(pos < tokens.size());
+            BOOST_CHECK_EQUAL(token->repr(), tokens[pos]->repr());
+            BOOST_CHECK_EQUAL(restored.line(token->lineNo()).to_string(),
+                              lexer.line(token->lineNo()).to_string());
+            changeCatCodes(restored, token);
+            ++pos;
+        }
+        BOOST_CHECK_EQUAL(pos, tokens.size());
+    }
+
+    // the lexer goes back to its own checkpoint
+    BOOST_REQUIRE(lexer.restore(checkpoints[0]));
+    BOOST_CHECK_EQUAL(lexer.getCatCode('@'), int(Token::CC_OTHER));
+    for(size_t pos = next[0]; pos < tokens.size(); ++pos) {
+        Token::ptr token = lexer.nextToken();
+        BOOST_REQUIRE(token);
+        BOOST_CHECK_EQUAL(token->repr(), tokens[pos]->repr());
+        changeCatCodes(lexer, token);
+    }
+    BOOST_CHECK(!lexer.nextToken());
+
+    // streams can not be repositioned
+    std::istringstream stream(text);
+    Lexer streamLexer("checkpoint.tex", &stream);
+    BOOST_CHECK(!streamLexer.restore(checkpoints[0]));
+
+    Lexer::Checkpoint pastEnd = checkpoints[0];
+    pastEnd.linePos = text.size() + 1;
+    BOOST_CHECK(!lexer.restore(pastEnd));
+}
+
+// appends a member to a tar archive
+void tarMember(string& archive, const string& name, const string& data,
+               char type = '0', const string& prefix = string())
+{
+    char header[512];
+    std::memset(header, 0, sizeof(header));
+    std::strncpy(header, name.c_str(), 100);
+    std::sprintf(header + 100, "%07o", 0644);
+    std::sprintf(header + 124, "%011o", unsigned(data.size()));
+    std::sprintf(header + 136, "%011o", 0u);
+    header[156] = type;
+    std::memcpy(header + 257, "ustar\0" "00", 8);
+    std::strncpy(header + 345, prefix.c_str(), 155);
+
+    size_t sum = 0;
+    std::memset(header + 148, ' ', 8);
+    for(size_t n = 0; n < sizeof(header); ++n)
+        sum += (unsigned char) header[n];
+    std::sprintf(header + 148, "%06o", unsigned(sum));
+
+    archive.append(header, sizeof(header));
+    archive += data;
+    archive.append((512 - data.size() % 512) % 512, '\0');
+}
+
+// record of a pax extended header
+string paxRecord(const string& keyword, const string& value)
+{
+    string record = " " + keyword + "=" + value + "\n";
+    size_t len = record.size() + 1;
+    while(len != record.size() + std::to_string(len).size())
+        len = record.size() + std::to_string(len).size();
+    return std::to_string(len) + record;
+}
+
+void gzipFile(const string& fileName, const string& data, const char* mode)
+{
+    gzFile file = gzopen(fileName.c_str(), mode);
+    gzwrite(file, data.data(), data.size());
+    gzclose(file);
+}
+
+BOOST_AUTO_TEST_CASE( parser_tar_bundle )
+{
+    string longDir = "a/" + string(120, 'd') + "/";
+    string archive;
+    tarMember(archive, "sec", "", '5');
+    tarMember(archive, "sec/intro.tex", "\\count2=1 ");
+    tarMember(archive, "pax_global_header", paxRecord("comment", "x"), 'g');
+    tarMember(archive, "main.tex",
+              "%\\documentclass\n\\input sec/intro \\count1=\\count2\n");
+    tarMember(archive, "././@LongLink", longDir + "gnu.tex", 'L');
+    tarMember(archive, longDir.substr(0, 99), "gnu");
+    tarMember(archive, "PaxHeaders/pax.tex",
+              paxRecord("mtime", "1") + paxRecord("path", longDir + "pax.tex"),
+              'x');
+    tarMember(archive, "pax.tex", "pax");
+    tarMember(archive, "ustar.tex", "ustar", '0', longDir.substr(0, 120));
+    tarMember(archive, "./sec/../sec/intro.tex", "\\count2=7 ");
+    archive.append(1024, '\0');
+
+    writeFile("parser_tar_bundle.tar", archive);
+    gzipFile("parser_tar_bundle.tar.gz", archive.substr(0, 1000), "wb");
+    gzipFile("parser_tar_bundle.tar.gz", archive.substr(1000), "ab");
+
+    const char* archives[] = { "parser_tar_bundle.tar",
+                               "parser_tar_bundle.tar.gz" };
+    BOOST_FOREACH(const char* archiveName, archives) {
+        TarBundle::ptr bundle(new TarBundle(archiveName));
+        BOOST_REQUIRE(bundle->isValid());
+        BOOST_REQUIRE_EQUAL(bundle->members().size(), size_t(5));
+        BOOST_CHECK_EQUAL(bundle->members()[0], "sec/intro.tex");
+        BOOST_CHECK_EQUAL(bundle->members()[1], "main.tex");
+        BOOST_CHECK_EQUAL(bundle->members()[2], longDir + "gnu.tex");
+        BOOST_CHECK_EQUAL(bundle->members()[3], longDir + "pax.tex");
+        BOOST_CHECK_EQUAL(bundle->members()[4],
+                          longDir.substr(0, 120) + "/ustar.tex");
+        BOOST_CHECK_EQUAL(bundle->get_mainfile_name(), "main.tex");
+        BOOST_CHECK_EQUAL(bundle->get_tex_filename("./sec/intro"),
+                          "sec/intro.tex");
+
+        shared_ptr<InputBuffer> buffer =
+                bundle->get_file_buffer(longDir + "pax.tex");
+        BOOST_REQUIRE(buffer);
+        BOOST_CHECK_EQUAL(string(buffer->data(), buffer->size()), "pax");
+        std::ostringstream gnu;
+        gnu << bundle->get_file(longDir + "gnu.tex")->rdbuf();
+        BOOST_CHECK_EQUAL(gnu.str(), "gnu");
+        BOOST_CHECK(!bundle->get_file_buffer("none.tex"));
+        BOOST_CHECK(bundle->get_file("none.tex")->fail());
+
+        // the later copy of a member replaces the earlier one
+        Parser parser(bundle, shared_ptr<Logger>(new TestLogger));
+        parser.parse();
+        BOOST_CHECK_EQUAL(parser.symbol("count1", 0), 7);
+    }
+
+    // a compressed file which is not an archive
+    gzipFile("parser_tar_bundle.tex.gz", "\\count1=3 ", "wb");
+    TarBundle single("parser_tar_bundle.tex.gz");
+    BOOST_REQUIRE(single.isValid());
+    BOOST_REQUIRE_EQUAL(single.members().size(), size_t(1));
+    BOOST_CHECK_EQUAL(single.members()[0], "main.tex");
+    shared_ptr<InputBuffer> buffer = single.get_file_buffer("main.tex");
+    BOOST_REQUIRE(buffer);
+    BOOST_CHECK_EQUAL(string(buffer->data(), buffer->size()), "\\count1=3 ");
+
+    BOOST_CHECK(!TarBundle("parser_tar_bundle_none.tar").isValid());
+
+    std::remove("parser_tar_bundle.tar");
+    std::remove("parser_tar_bundle.tar.gz");
+    std::remove("parser_tar_bundle.tex.gz");
+}
 
 #include <texpp/base/bibliography.h>
 #include <texpp/token.h>
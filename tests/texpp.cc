@@ -22,19 +22,17 @@
 
 #include <texpp/parser.h>
 #include <texpp/logger.h>
-#include <tests/testbundle.h>
+#include <texpp/filebundle.h>
 
 int main(int argc, char** argv)
 {
     std::string fileName;
-    std::istream *file;
 
     if(argc >= 2) {
         fileName = argv[1];
-        file = new std::ifstream(argv[1], std::fstream::in);
-        if(file->fail()) {
+        std::ifstream file(argv[1], std::fstream::in);
+        if(file.fail()) {
             std::cerr << "Can not open file " << argv[1] << std::endl;
-            delete file;
             return 255;
         }
     } else {
@@ -43,19 +41,10 @@ int main(int argc, char** argv)
     }
 
     texpp::Parser parser(boost::shared_ptr<texpp::Bundle>(
-            new TestBundle(fileName, boost::shared_ptr<std::istream>(file))),
+            new texpp::FileBundle(fileName)),
             texpp::Logger::ptr(new texpp::ConsoleLogger));
-    texpp::Node::ptr document = parser.parse();
-
-    if(file == &std::cin) {
-        std::cout << "Parsed document: " << std::endl;
-        std::cout << document->treeRepr();
-    }
-    
-    if(file != &std::cin) {
-        static_cast<std::ifstream*>(file)->close();
-        delete file;
-    }
+    parser.setPrefetch(true);
+    parser.parse();
 
     return 0;
 }
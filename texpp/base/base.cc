@@ -20,12 +20,6 @@
 namespace texpp {
 namespace base {
 
-std::string toString(int i){
-    std::stringstream ss;
-    ss << i;
-    return ss.str();
-}
-
 #define __TEXPP_SET_COMMAND(name, T, ...) \
     parser.setSymbol("\\" name, \
         Command::ptr(new T("\\" name, ##__VA_ARGS__)))
@@ -35,10 +29,11 @@ std::string toString(int i){
  */
 void initLaTeXstyle(Parser& parser)
 {
-    parser.setSymbol("catcode" + toString('{'), int(Token::CC_BGROUP));
-    parser.setSymbol("catcode" + toString('}'), int(Token::CC_EGROUP));
-    parser.setSymbol("catcode" + toString('$'), int(Token::CC_MATHSHIFT));
-    parser.setSymbol("catcode" + toString('\t'),int(Token::CC_SPACE));
+    parser.setSymbol(SymbolKey(SymbolKey::CATCODE, '{'), int(Token::CC_BGROUP));
+    parser.setSymbol(SymbolKey(SymbolKey::CATCODE, '}'), int(Token::CC_EGROUP));
+    parser.setSymbol(SymbolKey(SymbolKey::CATCODE, '$'),
+                     int(Token::CC_MATHSHIFT));
+    parser.setSymbol(SymbolKey(SymbolKey::CATCODE, '\t'), int(Token::CC_SPACE));
 
     __TEXPP_SET_COMMAND("begin", BeginCommand);
     __TEXPP_SET_COMMAND("end", EndCommand);
@@ -528,54 +523,51 @@ void initSymbols(Parser& parser)
     // INITEX context
     // init lookup table. Category code for every every one of 256 values
     for(int i=0; i<256; ++i) {
-        string n = boost::lexical_cast<string>(i);
-
         parser.lexer()->assignCatCode(i, Token::CC_OTHER);
-        parser.setSymbol("catcode"+n, int(Token::CC_OTHER));
-        parser.setSymbol("sfcode"+n, int(1000));
+        parser.setSymbol(SymbolKey(SymbolKey::CATCODE, i),
+                         int(Token::CC_OTHER));
+        parser.setSymbol(SymbolKey(SymbolKey::SFCODE, i), int(1000));
 
-        parser.setSymbol("delcode"+n, int(-1));
-        parser.setSymbol("mathcode"+n, int(i));
+        parser.setSymbol(SymbolKey(SymbolKey::DELCODE, i), int(-1));
+        parser.setSymbol(SymbolKey(SymbolKey::MATHCODE, i), int(i));
     }
 
     for(int i='a'; i<='z'; ++i) {
-        string n = boost::lexical_cast<string>(i);
-
         parser.lexer()->assignCatCode(i, Token::CC_LETTER);
-        parser.setSymbol("catcode"+n, int(Token::CC_LETTER));
+        parser.setSymbol(SymbolKey(SymbolKey::CATCODE, i),
+                         int(Token::CC_LETTER));
 
-        parser.setSymbol("lccode"+n, int(i));
-        parser.setSymbol("uccode"+n, int(i - 'a' + 'A'));
-        parser.setSymbol("mathcode"+n, int(0x7100 + i));
+        parser.setSymbol(SymbolKey(SymbolKey::LCCODE, i), int(i));
+        parser.setSymbol(SymbolKey(SymbolKey::UCCODE, i), int(i - 'a' + 'A'));
+        parser.setSymbol(SymbolKey(SymbolKey::MATHCODE, i), int(0x7100 + i));
     }
 
     for(int i='A'; i<='Z'; ++i) {
-        string n = boost::lexical_cast<string>(i);
-
         parser.lexer()->assignCatCode(i, Token::CC_LETTER);
-        parser.setSymbol("catcode"+n, int(Token::CC_LETTER));
+        parser.setSymbol(SymbolKey(SymbolKey::CATCODE, i),
+                         int(Token::CC_LETTER));
 
-        parser.setSymbol("sfcode"+n, int(999));
-        parser.setSymbol("lccode"+n, int(i + 'a' - 'A'));
-        parser.setSymbol("uccode"+n, int(i));
-        parser.setSymbol("mathcode"+n, int(0x7100 + i));
+        parser.setSymbol(SymbolKey(SymbolKey::SFCODE, i), int(999));
+        parser.setSymbol(SymbolKey(SymbolKey::LCCODE, i), int(i + 'a' - 'A'));
+        parser.setSymbol(SymbolKey(SymbolKey::UCCODE, i), int(i));
+        parser.setSymbol(SymbolKey(SymbolKey::MATHCODE, i), int(0x7100 + i));
     }
 
     for(int i='0'; i<='9'; ++i) {
-        string n = boost::lexical_cast<string>(i);
-        parser.setSymbol("mathcode"+n, int(0x7000 + i));
+        parser.setSymbol(SymbolKey(SymbolKey::MATHCODE, i), int(0x7000 + i));
     }
 
     parser.lexer()->assignCatCode(0x7f,   Token::CC_INVALID);   // invalid symbol
-    parser.setSymbol("catcode127", int(Token::CC_INVALID));
+    parser.setSymbol(SymbolKey(SymbolKey::CATCODE, 127),
+                     int(Token::CC_INVALID));
     parser.lexer()->assignCatCode('\\',   Token::CC_ESCAPE);    // "begin command" symbol
-    parser.setSymbol("catcode92",  int(Token::CC_ESCAPE));
+    parser.setSymbol(SymbolKey(SymbolKey::CATCODE, 92), int(Token::CC_ESCAPE));
     parser.lexer()->assignCatCode('\r',   Token::CC_EOL);       // end of line
-    parser.setSymbol("catcode13",  int(Token::CC_EOL));
+    parser.setSymbol(SymbolKey(SymbolKey::CATCODE, 13), int(Token::CC_EOL));
     parser.lexer()->assignCatCode(' ',    Token::CC_SPACE);     // space
-    parser.setSymbol("catcode32",  int(Token::CC_SPACE));
+    parser.setSymbol(SymbolKey(SymbolKey::CATCODE, 32), int(Token::CC_SPACE));
     parser.lexer()->assignCatCode('%',    Token::CC_COMMENT);   // begin comment
-    parser.setSymbol("catcode37",  int(Token::CC_COMMENT));
+    parser.setSymbol(SymbolKey(SymbolKey::CATCODE, 37), int(Token::CC_COMMENT));
 
     // NOTE: usually for TeX curve brackets {} are the essence of the characters.
     // In LaTeX they mean begin group and end group character respectively. So
@@ -585,7 +577,7 @@ void initSymbols(Parser& parser)
     parser.lexer()->assignCatCode('{', Token::CC_BGROUP);
     parser.lexer()->assignCatCode('}', Token::CC_EGROUP);
 
-    parser.setSymbol("delcode96", int(0));
+    parser.setSymbol(SymbolKey(SymbolKey::DELCODE, 96), int(0));
 
     parser.lexer()->setEndlinechar('\r');   // character mean "end of line"
     parser.setSymbol("endlinechar", int('\r'));
@@ -596,19 +588,27 @@ void initSymbols(Parser& parser)
     parser.setSymbol("mag", int(1000));
     parser.setSymbol("maxdeadcycles", int(25));
 
-    // set time stamp of initialisation
-    std::time_t t; std::time(&t);
-    std::tm* time = std::localtime(&t);
-    parser.setSymbol("year", int(1900+time->tm_year));
-    parser.setSymbol("month", int(1+time->tm_mon));
-    parser.setSymbol("day", int(time->tm_mday));
-    parser.setSymbol("time", int(time->tm_hour*60 + time->tm_min));
+    initTime(parser);
 
     parser.setSymbol("hangafter", int(1));
+    parser.setSymbol("spacefactor", int(0));
 
     initLaTeXstyle(parser);
 }
 
+void initTime(Parser& parser)
+{
+    std::time_t t; std::time(&t);
+    std::tm* time = std::localtime(&t);
+    const char* names[] = { "year", "month", "day", "time" };
+    int values[] = { 1900+time->tm_year, 1+time->tm_mon, time->tm_mday,
+                     time->tm_hour*60 + time->tm_min };
+
+    // the values are kept by the parser, not in the shared table
+    for(int n = 0; n < 4; ++n)
+        parser.setSymbol(names[n], values[n]);
+}
+
 } // namespace base
 } // namespace texpp
 
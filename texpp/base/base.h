@@ -60,6 +60,12 @@ namespace base {
  */
 void initSymbols(Parser& parser);
 
+/**
+ * @brief initTime - sets \\year, \\month, \\day and \\time to the
+ *  current local time
+ */
+void initTime(Parser& parser);
+
 } // namespace base
 } // namespace texpp
 
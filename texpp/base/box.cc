@@ -28,7 +28,7 @@ bool BoxVariable::invokeOperation(Parser& parser,
 {
     // TODO: box should not derive from Variable!
     if(op == ASSIGN || op == GET) {
-        string name = parseName(parser, node);
+        SymbolKey name = parseName(parser, node);
         Box box = parser.symbol(name, Box());
         node->setValue(box);
         return true;
@@ -50,9 +50,9 @@ bool Lastbox::invokeOperation(Parser& parser,
     return BoxVariable::invokeOperation(parser, node, op, global);
 }
 
-string Vsplit::parseName(Parser& parser, shared_ptr<Node> node)
+SymbolKey Vsplit::parseName(Parser& parser, shared_ptr<Node> node)
 {
-    string s = Register<BoxVariable>::parseName(parser, node);
+    SymbolKey s = Register<BoxVariable>::parseName(parser, node);
     static vector<string> kw_to(1, "to");
     Node::ptr to = parser.parseKeyword(kw_to);
     if(!to) {
@@ -68,7 +68,7 @@ string Vsplit::parseName(Parser& parser, shared_ptr<Node> node)
     return s;
 }
 
-string Setbox::parseName(Parser& parser, shared_ptr<Node> node)
+SymbolKey Setbox::parseName(Parser& parser, shared_ptr<Node> node)
 {
     shared_ptr<Node> number = parser.parseNumber();
     node->appendChild("variable_number", number);
@@ -81,17 +81,16 @@ string Setbox::parseName(Parser& parser, shared_ptr<Node> node)
         n = 0;
     }
 
-    string s = this->name().substr(1) + boost::lexical_cast<string>(n);
-    if(s.substr(0, 6) == "setbox")
-        parser.setSymbolDefault(s.substr(3), m_initValue);
-    return s;
+    SymbolKey key(SymbolKey::BOX, n);
+    parser.setSymbolDefault(key, m_initValue);
+    return key;
 }
 
 bool Setbox::invokeOperation(Parser& parser,
                 shared_ptr<Node> node, Operation op, bool global)
 {
     if(op == ASSIGN) {
-        string name = parseName(parser, node);
+        SymbolKey name = parseName(parser, node);
 
         node->appendChild("equals", parser.parseOptionalEquals());
         node->appendChild("filler", parser.parseFiller(true));
@@ -109,8 +108,6 @@ bool Setbox::invokeOperation(Parser& parser,
         node->appendChild("rvalue", rvalue);
         node->setValue(rvalue->valueAny());
 
-        if(name.substr(0, 6) == "setbox")
-            name = name.substr(3);
         parser.setSymbol(name, rvalue->valueAny(), global);
         return true;
     }
@@ -121,7 +118,7 @@ bool BoxSpec::invokeOperation(Parser& parser,
                 shared_ptr<Node> node, Operation op, bool)
 {
     if(op == ASSIGN || op == GET) {
-        string name = parseName(parser, node);
+        parseName(parser, node);
 
         static vector<string> kw_spec;
         if(kw_spec.empty()) {
@@ -51,7 +51,7 @@ class BoxVariable: public Variable
 {
 public:
     BoxVariable(const string& name,
-        const any& initValue = any(Box()))
+        const Value& initValue = Value(Box()))
         : Variable(name, initValue) {}
 
     bool invokeOperation(Parser& parser,
@@ -62,7 +62,7 @@ class Lastbox: public BoxVariable
 {
 public:
     Lastbox(const string& name,
-        const any& initValue = any(Box()))
+        const Value& initValue = Value(Box()))
         : BoxVariable(name, initValue) {}
 
     bool invokeOperation(Parser& parser,
@@ -73,20 +73,20 @@ class Vsplit: public Register<BoxVariable>
 {
 public:
     Vsplit(const string& name,
-        const any& initValue = any(Box()))
+        const Value& initValue = Value(Box()))
         : Register<BoxVariable>(name, initValue) {}
 
-    string parseName(Parser& parser, shared_ptr<Node> node);
+    SymbolKey parseName(Parser& parser, shared_ptr<Node> node);
 };
 
 class Setbox: public Variable
 {
 public:
     Setbox(const string& name,
-        const any& initValue = any(Box()))
+        const Value& initValue = Value(Box()))
         : Variable(name, initValue) {}
 
-    string parseName(Parser& parser, shared_ptr<Node> node);
+    SymbolKey parseName(Parser& parser, shared_ptr<Node> node);
     bool invokeOperation(Parser& parser,
                 shared_ptr<Node> node, Operation op, bool global);
 };
@@ -251,8 +251,8 @@ bool Ifvoid::evaluate(Parser& parser, shared_ptr<Node> node)
     Node::ptr number = parser.parseNumber();
     node->appendChild("number", number);
 
-    string s = "box" + boost::lexical_cast<string>(number->value(int(0)));
-    node->setValue(bool(!parser.symbol(s, Box()).value));
+    SymbolKey key(SymbolKey::BOX, number->value(int(0)));
+    node->setValue(bool(!parser.symbol(key, Box()).value));
     return true;
 }
 
@@ -261,8 +261,8 @@ bool Ifhbox::evaluate(Parser& parser, shared_ptr<Node> node)
     Node::ptr number = parser.parseNumber();
     node->appendChild("number", number);
 
-    string s = "box" + boost::lexical_cast<string>(number->value(int(0)));
-    Box box = parser.symbol(s, Box());
+    SymbolKey key(SymbolKey::BOX, number->value(int(0)));
+    Box box = parser.symbol(key, Box());
     node->setValue(bool(box.value && box.mode == Parser::RHORIZONTAL));
     return true;
 }
@@ -272,8 +272,8 @@ bool Ifvbox::evaluate(Parser& parser, shared_ptr<Node> node)
     Node::ptr number = parser.parseNumber();
     node->appendChild("number", number);
 
-    string s = "box" + boost::lexical_cast<string>(number->value(int(0)));
-    Box box = parser.symbol(s, Box());
+    SymbolKey key(SymbolKey::BOX, number->value(int(0)));
+    Box box = parser.symbol(key, Box());
     node->setValue(bool(box.value && box.mode == Parser::RVERTICAL));
     return true;
 }
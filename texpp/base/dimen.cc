@@ -29,7 +29,7 @@ bool InternalDimen::invokeOperation(Parser& parser,
                 shared_ptr<Node> node, Operation op, bool global)
 {
     if(op == ASSIGN) {
-        string name = parseName(parser, node);
+        SymbolKey name = parseName(parser, node);
 
         node->appendChild("equals", parser.parseOptionalEquals());
         Node::ptr rvalue = parser.parseDimen();
@@ -39,7 +39,7 @@ bool InternalDimen::invokeOperation(Parser& parser,
         parser.setSymbol(name, rvalue->valueAny(), global);
         return true;
     } else if(op == EXPAND) {
-        string name = parseName(parser, node);
+        SymbolKey name = parseName(parser, node);
         Dimen val = parser.symbol(name, Dimen(0));
         node->setValue(dimenToString(val));
         return true;
@@ -53,7 +53,7 @@ bool DimenVariable::invokeOperation(Parser& parser,
 {
     static vector<string> kw_by(1, "by");
     if(op == ADVANCE) {
-        string name = parseName(parser, node);
+        SymbolKey name = parseName(parser, node);
         
         node->appendChild("by", parser.parseOptionalKeyword(kw_by));
 
@@ -68,7 +68,7 @@ bool DimenVariable::invokeOperation(Parser& parser,
         return true;
 
     } else if(op == MULTIPLY || op == DIVIDE) {
-        string name = parseName(parser, node);
+        SymbolKey name = parseName(parser, node);
 
         node->appendChild("by", parser.parseOptionalKeyword(kw_by));
 
@@ -143,7 +143,7 @@ bool SpecialDimen::invokeOperation(Parser& parser,
                 shared_ptr<Node> node, Operation op, bool global)
 {
     if(op == ASSIGN) {
-        string name = parseName(parser, node);
+        SymbolKey name = parseName(parser, node);
 
         node->appendChild("equals", parser.parseOptionalEquals());
         Node::ptr rvalue = parser.parseDimen();
@@ -153,12 +153,12 @@ bool SpecialDimen::invokeOperation(Parser& parser,
         parser.setSymbol(name, rvalue->valueAny(), true); // global
         return true;
     } else if(op == GET) {
-        string name = parseName(parser, node);
-        const any& ret = parser.symbolAny(name);
+        SymbolKey name = parseName(parser, node);
+        const Value& ret = parser.symbolAny(name);
         node->setValue(ret.empty() ? m_initValue : ret);
         return true;
     } else if(op == EXPAND) {
-        string name = parseName(parser, node);
+        SymbolKey name = parseName(parser, node);
         Dimen val = parser.symbol(name, Dimen(0));
         node->setValue(dimenToString(val));
         return true;
@@ -167,7 +167,7 @@ bool SpecialDimen::invokeOperation(Parser& parser,
     }
 }
 
-string BoxDimen::parseName(Parser& parser, shared_ptr<Node> node)
+SymbolKey BoxDimen::parseName(Parser& parser, shared_ptr<Node> node)
 {
     Node::ptr number = parser.parseNumber();
     node->appendChild("variable_number", number);
@@ -180,16 +180,17 @@ string BoxDimen::parseName(Parser& parser, shared_ptr<Node> node)
         n = 0;
     }
 
-    string s = name().substr(1) + boost::lexical_cast<string>(n);
-    parser.setSymbolDefault(s, m_initValue);
-    return s;
+    SymbolKey key = SymbolKey::named(
+                name().substr(1) + boost::lexical_cast<string>(n));
+    parser.setSymbolDefault(key, m_initValue);
+    return key;
 }
 
 bool BoxDimen::invokeOperation(Parser& parser,
                 shared_ptr<Node> node, Operation op, bool global)
 {
     if(op == ASSIGN) {
-        string name = parseName(parser, node);
+        parseName(parser, node);
 
         node->appendChild("equals", parser.parseOptionalEquals());
         Node::ptr rvalue = parser.parseDimen();
@@ -41,7 +41,7 @@ struct Dimen
 class InternalDimen: public Variable
 {
 public:
-    InternalDimen(const string& name, const any& initValue = any(Dimen(0)))
+    InternalDimen(const string& name, const Value& initValue = Value(Dimen(0)))
         : Variable(name, initValue) {}
 
     bool invokeOperation(Parser& parser,
@@ -54,7 +54,7 @@ public:
 class DimenVariable: public InternalDimen
 {
 public:
-    DimenVariable(const string& name, const any& initValue = any(Dimen(0)))
+    DimenVariable(const string& name, const Value& initValue = Value(Dimen(0)))
         : InternalDimen(name, initValue) {}
 
     bool invokeOperation(Parser& parser,
@@ -64,7 +64,7 @@ public:
 class SpecialDimen: public InternalDimen
 {
 public:
-    SpecialDimen(const string& name, const any& initValue = any(Dimen(0)))
+    SpecialDimen(const string& name, const Value& initValue = Value(Dimen(0)))
         : InternalDimen(name, initValue) {}
 
     bool invokeOperation(Parser& parser,
@@ -75,10 +75,10 @@ class BoxDimen: public InternalDimen
 {
 public:
     BoxDimen(const string& name,
-        const any& initValue = any())
+        const Value& initValue = Value())
         : InternalDimen(name, initValue) {}
 
-    string parseName(Parser& parser, shared_ptr<Node> node);
+    SymbolKey parseName(Parser& parser, shared_ptr<Node> node);
     bool invokeOperation(Parser& parser,
                 shared_ptr<Node> node, Operation op, bool global);
 };
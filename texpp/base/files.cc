@@ -20,6 +20,7 @@
 #include <texpp/parser.h>
 #include <texpp/logger.h>
 #include <texpp/kpsewhich.h>
+#include <texpp/inputbuffer.h>
 
 #include <boost/lexical_cast.hpp>
 #include <boost/foreach.hpp>
@@ -55,8 +56,17 @@ bool Openin::invoke(Parser& parser, shared_ptr<Node> node)
     //std::cout << "fullname: '" << fullname << "'\n";
 
     //shared_ptr<std::istream> istream(new std::ifstream(fullname.c_str()));
-    shared_ptr<std::istream> istream(parser.getBundle()->get_file(fullname));
-    if(!istream->fail()) {
+    shared_ptr<InputBuffer> buffer(
+                    parser.getBundle()->get_file_buffer(fullname));
+    shared_ptr<std::istream> istream;
+    if(!buffer)
+        istream = parser.getBundle()->get_file(fullname);
+
+    if(buffer) {
+        shared_ptr<Lexer> lexer(new Lexer(fullname, buffer));
+        parser.setSymbol("read" + boost::lexical_cast<string>(stream),
+                                    InFile(lexer), true);
+    } else if(!istream->fail()) {
         shared_ptr<Lexer> lexer(new Lexer(fullname, istream));
         parser.setSymbol("read" + boost::lexical_cast<string>(stream),
                                     InFile(lexer), true);
@@ -147,6 +157,7 @@ bool Read::invokeWithPrefixes(Parser& parser, shared_ptr<Node> node,
     }
 
     // prepare the lexer
+    lexer->setTokenArena(parser.tokenArena());
     lexer->setEndlinechar(parser.lexer()->endlinechar());
     for(int n=0; n<256; ++n) {
         lexer->assignCatCode(n, parser.lexer()->getCatCode(n));
@@ -261,6 +272,11 @@ bool Openout::invokeWithPrefixes(Parser& parser,
 
     string fname = kpseextend(fnameNode->value(string()));
 
+    // the file may be read through a memory mapping made by this process,
+    // which would crash when the file is truncated: the mapping takes its
+    // own copy of the text, and the file is rewritten in place
+    InputBuffer::detachFile(fname);
+
     shared_ptr<std::ostream> ostream(new std::ofstream(fname.c_str()));
     if(!ostream->fail()) {
         parser.setSymbol("write" + boost::lexical_cast<string>(stream),
@@ -352,7 +368,7 @@ bool Write::invokeWithPrefixes(Parser& parser,
     node->appendChild("number", number);
     int stream = number->value(int(0));
 
-    if(parser.symbol("tracingmacros", int(0)) >= 2) {
+    if(parser.tracingmacros() >= 2) {
         // read the tokens without expanding to show them in the trace
         Node::ptr text = parser.parseGeneralText(false);
         Token::list_ptr tokens =
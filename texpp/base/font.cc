@@ -65,7 +65,7 @@ bool Font::invokeOperation(Parser& parser,
                 shared_ptr<Node> node, Operation op, bool global)
 {
     if(op == EXPAND) {
-        string name = parseName(parser, node);
+        SymbolKey name = parseName(parser, node);
         FontInfo::ptr fontInfo = parser.symbol(name, defaultFontInfo);
 
         string str = fontInfo->selector;
@@ -79,7 +79,7 @@ bool Font::invokeOperation(Parser& parser,
         return true;
 
     } else if(op == ASSIGN) {
-        string name = parseName(parser, node);
+        parseName(parser, node);
 
         Node::ptr lvalue = parser.parseControlSequence(false);
         Token::ptr ltoken = lvalue->value(Token::ptr());
@@ -145,8 +145,8 @@ bool Font::invokeOperation(Parser& parser,
         return true;
 
     } else if(op == GET) {
-        string name = parseName(parser, node);
-        const any& ret = parser.symbolAny(name);
+        SymbolKey name = parseName(parser, node);
+        const Value& ret = parser.symbolAny(name);
         node->setValue(ret.empty() ? m_initValue : ret);
         return true;
     }
@@ -157,7 +157,7 @@ bool FontFamily::invokeOperation(Parser& parser,
                 shared_ptr<Node> node, Operation op, bool global)
 {
     if(op == EXPAND) {
-        string name = parseName(parser, node);
+        SymbolKey name = parseName(parser, node);
         FontInfo::ptr fontInfo = parser.symbol(name, defaultFontInfo);
 
         string str = fontInfo->selector;
@@ -171,7 +171,7 @@ bool FontFamily::invokeOperation(Parser& parser,
         return true;
 
     } else if(op == ASSIGN) {
-        string name = parseName(parser, node);
+        SymbolKey name = parseName(parser, node);
 
         node->appendChild("equals", parser.parseOptionalEquals());
 
@@ -192,15 +192,15 @@ bool FontFamily::invokeOperation(Parser& parser,
         return true;
 
     } else if(op == GET) {
-        string name = parseName(parser, node);
-        const any& ret = parser.symbolAny(name);
+        SymbolKey name = parseName(parser, node);
+        const Value& ret = parser.symbolAny(name);
         node->setValue(ret.empty() ? m_initValue : ret);
         return true;
     }
     return false;
 }
 
-string FontFamily::parseName(Parser& parser, shared_ptr<Node> node)
+SymbolKey FontFamily::parseName(Parser& parser, shared_ptr<Node> node)
 {
     shared_ptr<Node> number = parser.parseNumber();
     node->appendChild("family_number", number);
@@ -213,12 +213,13 @@ string FontFamily::parseName(Parser& parser, shared_ptr<Node> node)
         n = 0;
     }
 
-    string s = this->name().substr(1) + boost::lexical_cast<string>(n);
-    parser.setSymbolDefault(s, m_initValue);
-    return s;
+    SymbolKey key = SymbolKey::named(
+                this->name().substr(1) + boost::lexical_cast<string>(n));
+    parser.setSymbolDefault(key, m_initValue);
+    return key;
 }
 
-string FontChar::parseName(Parser& parser, shared_ptr<Node> node)
+SymbolKey FontChar::parseName(Parser& parser, shared_ptr<Node> node)
 {
     Node::ptr font =
         Variable::tryParseVariableValue<base::FontVariable>(parser);
@@ -231,12 +232,13 @@ string FontChar::parseName(Parser& parser, shared_ptr<Node> node)
     }
     node->appendChild("variable_font", font);
 
-    string s = name().substr(1) + font->value(defaultFontInfo)->selector;
-    parser.setSymbolDefault(s, m_initValue);
-    return s;
+    SymbolKey key = SymbolKey::named(
+                name().substr(1) + font->value(defaultFontInfo)->selector);
+    parser.setSymbolDefault(key, m_initValue);
+    return key;
 }
 
-string FontDimen::parseName(Parser& parser, shared_ptr<Node> node)
+SymbolKey FontDimen::parseName(Parser& parser, shared_ptr<Node> node)
 {
     Node::ptr number = parser.parseNumber();
     node->appendChild("variable_number", number);
@@ -269,24 +271,24 @@ string FontDimen::parseName(Parser& parser, shared_ptr<Node> node)
         n = 0;
     }
 
-    string s = name().substr(1) + boost::lexical_cast<string>(n)
-                            + fontInfo->selector;
-    parser.setSymbolDefault(s, m_initValue);
-    return s;
+    SymbolKey key = SymbolKey::named(name().substr(1) +
+                boost::lexical_cast<string>(n) + fontInfo->selector);
+    parser.setSymbolDefault(key, m_initValue);
+    return key;
 }
 
 bool FontDimen::invokeOperation(Parser& parser,
                 shared_ptr<Node> node, Operation op, bool global)
 {
     if(op == ASSIGN) {
-        string name = parseName(parser, node);
+        SymbolKey name = parseName(parser, node);
 
         node->appendChild("equals", parser.parseOptionalEquals());
         Node::ptr rvalue = parser.parseDimen();
         node->appendChild("rvalue", rvalue);
 
         node->setValue(rvalue->valueAny());
-        if(name.substr(0, 11) != "fontdimen0\\")
+        if(name.name().substr(0, 11) != "fontdimen0\\")
             parser.setSymbol(name, rvalue->valueAny(), true); // global
         return true;
     } else {
@@ -49,7 +49,7 @@ class FontVariable: public Variable
 {
 public:
     FontVariable(const string& name,
-        const any& initValue = any(defaultFontInfo))
+        const Value& initValue = Value(defaultFontInfo))
         : Variable(name, initValue) {}
 
     static string fontToString(const FontInfo& fontInfo);
@@ -59,12 +59,11 @@ class FontSelector: public FontVariable
 {
 public:
     FontSelector(const string& name,
-        const any& initValue = any(defaultFontInfo))
+        const Value& initValue = Value(defaultFontInfo))
         : FontVariable(name, initValue) {}
 
     FontInfo::ptr initFontInfo() const {
-        return m_initValue.type() == typeid(FontInfo::ptr) ?
-            *unsafe_any_cast<FontInfo::ptr>(&m_initValue) : defaultFontInfo;
+        return m_initValue.value(defaultFontInfo);
     }
 
     bool invokeOperation(Parser& parser,
@@ -77,7 +76,7 @@ class Font: public FontVariable
 {
 public:
     Font(const string& name,
-        const any& initValue = any(defaultFontInfo))
+        const Value& initValue = Value(defaultFontInfo))
         : FontVariable(name, initValue) {}
 
     bool invokeOperation(Parser& parser,
@@ -88,32 +87,32 @@ class FontFamily: public FontVariable
 {
 public:
     FontFamily(const string& name,
-        const any& initValue = any(defaultFontInfo))
+        const Value& initValue = Value(defaultFontInfo))
         : FontVariable(name, initValue) {}
 
     bool invokeOperation(Parser& parser,
                 shared_ptr<Node> node, Operation op, bool global);
-    string parseName(Parser& parser, shared_ptr<Node> node);
+    SymbolKey parseName(Parser& parser, shared_ptr<Node> node);
 };
 
 class FontChar: public SpecialInteger
 {
 public:
-    FontChar(const string& name, const any& initValue = any(0))
+    FontChar(const string& name, const Value& initValue = Value(0))
         : SpecialInteger(name, initValue) {}
 
-    string parseName(Parser& parser, shared_ptr<Node> node);
+    SymbolKey parseName(Parser& parser, shared_ptr<Node> node);
 };
 
 class FontDimen: public SpecialDimen
 {
 public:
-    FontDimen(const string& name, const any& initValue = any(0))
+    FontDimen(const string& name, const Value& initValue = Value(0))
         : SpecialDimen(name, initValue) {}
 
     bool invokeOperation(Parser& parser,
                 shared_ptr<Node> node, Operation op, bool global);
-    string parseName(Parser& parser, shared_ptr<Node> node);
+    SymbolKey parseName(Parser& parser, shared_ptr<Node> node);
 };
 
 class FontnameMacro: public Macro
@@ -61,7 +61,7 @@ bool Assignment::checkPrefixes(Parser& parser,
         }
     }
 
-    int globaldefs = parser.symbol("globaldefs", int(0));
+    int globaldefs = parser.globaldefs();
     if(globaldefs > 0) global = true;
     else if(globaldefs < 0) global = false;
 
@@ -301,10 +301,64 @@ string UserMacro::texRepr(Parser* parser) const
     return texRepr(parser, true, 0);
 }
 
+void UserMacro::compile()
+{
+    // the parameter text, read as expand() used to read it: # and the
+    // digit give an argument delimited by the token after them
+    const Token::list& params = *m_params;
+    size_t paramCount = 0;
+    for(size_t n = 0; n < params.size(); ++n) {
+        PatternItem item;
+        item.param = params[n]->isCharacterCat(Token::CC_PARAM);
+        if(item.param) {
+            ++n;
+            if(n+1 < params.size() &&
+                    !params[n+1]->isCharacterCat(Token::CC_PARAM))
+                item.token = params[n+1];
+            ++paramCount;
+        } else {
+            item.token = params[n];
+        }
+        m_pattern.push_back(item);
+    }
+
+    // the definition: ## gives #, #1..#9 give the arguments, other
+    // tokens after # are dropped
+    const Token::list& definition = *m_definition;
+    m_body.reserve(definition.size());
+    for(size_t n = 0; n < definition.size(); ++n) {
+        const Token::ptr& token = definition[n];
+        if(!token->isCharacterCat(Token::CC_PARAM)) {
+            m_body.push_back(token);
+            continue;
+        }
+        if(++n >= definition.size())
+            break;
+        const Token::ptr& next = definition[n];
+        if(next->isCharacterCat(Token::CC_PARAM)) {
+            m_body.push_back(next);
+        } else if(next->isCharacter()) {
+            char ch = next->value()[0];
+            if(isdigit(ch) && ch != '0' && size_t(ch-'0') <= paramCount)
+                m_slots.push_back(std::make_pair(m_body.size(),
+                                                 size_t(ch-'0'-1)));
+        }
+    }
+
+    // the same list is returned by all expansions; a redefinition
+    // creates a new macro with its own list
+    if(m_slots.empty()) {
+        m_expansion = Token::list_ptr(new Token::list());
+        m_expansion->reserve(m_body.size());
+        BOOST_FOREACH(const Token::ptr& token, m_body)
+            m_expansion->push_back(token->lineNo() ? token->lcopy() : token);
+    }
+}
+
 bool UserMacro::expand(Parser& parser, shared_ptr<Node> node)
 {
     // TODO: implement \long and \outer
-    if(parser.symbol("tracingmacros", int(0)) > 0) {
+    if(parser.tracingmacros() > 0) {
         Token::ptr t = node->child("control_sequence")->value(Token::ptr());
         string str(1, '\n');
         str += //Token::texReprControl(name(), &parser, true) +
@@ -320,9 +374,8 @@ bool UserMacro::expand(Parser& parser, shared_ptr<Node> node)
     Token::list_ptr params[9];
     size_t paramNum = 0;
 
-    Token::list::iterator end = m_params->end();
-    for(Token::list::iterator it = m_params->begin(); it < end; ++it) {
-        if((*it)->isCharacterCat(Token::CC_PARAM)) {
+    BOOST_FOREACH(const PatternItem& item, m_pattern) {
+        if(item.param) {
             child = Node::ptr(new Node("arg"));
             node->appendChild("arg" +
                 boost::lexical_cast<string>(paramNum+1), child);
@@ -330,11 +383,7 @@ bool UserMacro::expand(Parser& parser, shared_ptr<Node> node)
             Token::list_ptr tokens(new Token::list());
             child->setValue(tokens);
 
-            Token::ptr etoken;
-            ++it;
-            if(it+1 < end && !(*(it+1))->isCharacterCat(Token::CC_PARAM))
-                etoken = *(it+1);
-
+            const Token::ptr& etoken = item.token;
             if(!etoken) {
                 while(parser.peekToken(false) &&
                         parser.helperIsImplicitCharacter(
@@ -394,9 +443,9 @@ bool UserMacro::expand(Parser& parser, shared_ptr<Node> node)
             parser.nextToken(&child->tokens(), false);
 
             if(!ntoken ||
-                    ntoken->type() != (*it)->type() ||
-                    ntoken->catCode() != (*it)->catCode() ||
-                    ntoken->value() != (*it)->value()) {
+                    ntoken->type() != item.token->type() ||
+                    ntoken->catCode() != item.token->catCode() ||
+                    ntoken->value() != item.token->value()) {
                 parser.logger()->log(Logger::ERROR,
                     "Use of " + Command::texRepr(&parser) +
                     " doesn't match its definition",
@@ -406,7 +455,7 @@ bool UserMacro::expand(Parser& parser, shared_ptr<Node> node)
         }
     }
 
-    if(parser.symbol("tracingmacros", int(0)) > 0) {
+    if(parser.tracingmacros() > 0) {
         for(size_t n = 0; n < paramNum; ++n) {
             string str("#");
             str += boost::lexical_cast<string>(n+1);
@@ -418,25 +467,28 @@ bool UserMacro::expand(Parser& parser, shared_ptr<Node> node)
         }
     }
 
+    if(m_expansion) {
+        node->setValue(m_expansion);
+        return true;
+    }
+
+    // splice the arguments into the body; the tokens read from a file
+    // are copied without their position
     Token::list_ptr result(new Token::list());
-    result->reserve(m_definition->size());
-
-    end = m_definition->end();
-    for(Token::list::iterator it = m_definition->begin();
-                                            it < end; ++it) {
-        if((*it)->isCharacterCat(Token::CC_PARAM)) {
-            if(++it >= end) break;
-            if((*it)->isCharacterCat(Token::CC_PARAM)) {
-                result->push_back((*it)->lineNo() ? (*it)->lcopy() : *it);
-            } else if((*it)->isCharacter()) {
-                char ch = (*it)->value()[0];
-                if(!isdigit(ch) || ch == '0' || !params[ch-'0'-1]) continue;
-                BOOST_FOREACH(Token::ptr token, *params[ch-'0'-1]) {
-                    result->push_back(token->lineNo() ? token->lcopy() : token);
-                }
+    result->reserve(m_body.size());
+
+    size_t pos = 0;
+    for(size_t n = 0; n <= m_slots.size(); ++n) {
+        size_t slotPos = n < m_slots.size() ? m_slots[n].first : m_body.size();
+        for(; pos < slotPos; ++pos) {
+            const Token::ptr& token = m_body[pos];
+            result->push_back(token->lineNo() ? token->lcopy() : token);
+        }
+        if(n < m_slots.size() && params[m_slots[n].second]) {
+            BOOST_FOREACH(const Token::ptr& token,
+                                *params[m_slots[n].second]) {
+                result->push_back(token->lineNo() ? token->lcopy() : token);
             }
-        } else {
-            result->push_back((*it)->lineNo() ? (*it)->lcopy() : *it);
         }
     }
 
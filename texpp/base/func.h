@@ -33,7 +33,7 @@ namespace base {
 class Prefix: public Command
 {
 public:
-    explicit Prefix(const string& name): Command(name) {}
+    explicit Prefix(const string& name): Command(name) { m_kind |= PREFIX; }
     bool invoke(Parser&, shared_ptr<Node>) { return false; }
     bool invokeWithPrefixes(Parser&, shared_ptr<Node>,
                                 std::set<string>& prefixes);
@@ -48,7 +48,9 @@ public:
 class Assignment: public Command
 {
 public:
-    explicit Assignment(const string& name = string()): Command(name) {}
+    explicit Assignment(const string& name = string()): Command(name) {
+        m_kind |= ASSIGNMENT;
+    }
     bool invoke(Parser& parser, shared_ptr<Node> node);
 
 protected:
@@ -137,7 +139,7 @@ public:
         Token::list_ptr params, Token::list_ptr definition,
         bool outerAttr = false, bool longAttr = false)
         : Macro(name), m_params(params), m_definition(definition),
-          m_outerAttr(outerAttr), m_longAttr(longAttr) {}
+          m_outerAttr(outerAttr), m_longAttr(longAttr) { compile(); }
 
     Token::list params() { return *m_params; }
     Token::list definition() { return *m_definition; }
@@ -150,10 +152,31 @@ public:
     bool expand(Parser& parser, shared_ptr<Node> node);
 
 protected:
+    /**
+     * @brief prepares m_pattern, m_body and m_slots from the parameter
+     *      text and the definition, so expand() does not interpret them
+     */
+    void compile();
+
+    // one step of matching the parameter text
+    struct PatternItem {
+        bool        param;  // reads an argument, or matches the token
+        Token::ptr  token;  // the token to match, or the delimiter of
+                            // the argument (empty if undelimited)
+    };
+
     Token::list_ptr m_params;
     Token::list_ptr m_definition;
     bool m_outerAttr;
     bool m_longAttr;
+
+    vector<PatternItem> m_pattern;
+    Token::list m_body;     // the definition without the parameters
+    vector<pair<size_t, size_t> > m_slots;  // (position in m_body,
+                                            //  argument number)
+    Token::list_ptr m_expansion;    // the result of every expansion if the
+                                    // body uses no arguments; it is shared
+                                    // and must not be changed
 };
 
 } // namespace base
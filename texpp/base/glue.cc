@@ -31,7 +31,7 @@ bool invokeGlueOperation(Variable& var, Parser& parser,
         shared_ptr<Node> node, Variable::Operation op, bool global, bool mu)
 {
     if(op == Variable::ASSIGN) {
-        string name = var.parseName(parser, node);
+        SymbolKey name = var.parseName(parser, node);
 
         node->appendChild("equals", parser.parseOptionalEquals());
         Node::ptr rvalue = parser.parseGlue(mu);
@@ -41,7 +41,7 @@ bool invokeGlueOperation(Variable& var, Parser& parser,
         parser.setSymbol(name, rvalue->valueAny(), global);
         return true;
     } else if(op == Variable::EXPAND) {
-        string name = var.parseName(parser, node);
+        SymbolKey name = var.parseName(parser, node);
         Glue val = parser.symbol(name, Glue(mu,0));
         node->setValue(InternalGlue::glueToString(val));
         return true;
@@ -55,7 +55,7 @@ bool invokeGlueVarOperation(Variable& var, Parser& parser,
 {
     static vector<string> kw_by(1, "by");
     if(op == Variable::ADVANCE) {
-        string name = var.parseName(parser, node);
+        SymbolKey name = var.parseName(parser, node);
         
         node->appendChild("by", parser.parseOptionalKeyword(kw_by));
 
@@ -88,7 +88,7 @@ bool invokeGlueVarOperation(Variable& var, Parser& parser,
         return true;
 
     } else if(op == Variable::MULTIPLY || op == Variable::DIVIDE) {
-        string name = var.parseName(parser, node);
+        SymbolKey name = var.parseName(parser, node);
 
         node->appendChild("by", parser.parseOptionalKeyword(kw_by));
 
@@ -50,7 +50,7 @@ struct Glue
 class InternalGlue: public Variable
 {
 public:
-    InternalGlue(const string& name, const any& initValue = any(Glue(0,0)))
+    InternalGlue(const string& name, const Value& initValue = Value(Glue(0,0)))
         : Variable(name, initValue) {}
 
     bool invokeOperation(Parser& parser,
@@ -62,7 +62,7 @@ public:
 class GlueVariable: public InternalGlue
 {
 public:
-    GlueVariable(const string& name, const any& initValue = any(Glue(0,0)))
+    GlueVariable(const string& name, const Value& initValue = Value(Glue(0,0)))
         : InternalGlue(name, initValue) {}
 
     bool invokeOperation(Parser& parser,
@@ -72,7 +72,7 @@ public:
 class InternalMuGlue: public Variable
 {
 public:
-    InternalMuGlue(const string& name, const any& initValue = any(Glue(1,0)))
+    InternalMuGlue(const string& name, const Value& initValue = Value(Glue(1,0)))
         : Variable(name, initValue) {}
 
     bool invokeOperation(Parser& parser,
@@ -82,7 +82,7 @@ public:
 class MuGlueVariable: public InternalMuGlue
 {
 public:
-    MuGlueVariable(const string& name, const any& initValue = any(Glue(1,0)))
+    MuGlueVariable(const string& name, const Value& initValue = Value(Glue(1,0)))
         : InternalMuGlue(name, initValue) {}
 
     bool invokeOperation(Parser& parser,
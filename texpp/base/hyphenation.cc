@@ -27,7 +27,7 @@ bool Hyphenation::invokeOperation(Parser& parser,
                         shared_ptr<Node> node, Operation op, bool)
 {
     if(op == ASSIGN) {
-        string name = parseName(parser, node);
+        parseName(parser, node);
 
         Node::ptr internal = parser.parseGeneralText(true);
         //Token::list_ptr tokens = internal->child("balanced_text")
@@ -30,7 +30,7 @@ class Hyphenation: public Variable
 {
 public:
     explicit Hyphenation(const string& name,
-        const any& initValue = any(Token::list()))
+        const Value& initValue = Value(Token::list()))
         : Variable(name, initValue) {}
     bool invokeOperation(Parser& parser,
                 shared_ptr<Node> node, Operation op, bool global);
@@ -30,7 +30,7 @@ bool InternalInteger::invokeOperation(Parser& parser,
                 shared_ptr<Node> node, Operation op, bool global)
 {
     if(op == ASSIGN) {
-        string name = parseName(parser, node);
+        SymbolKey name = parseName(parser, node);
 
         node->appendChild("equals", parser.parseOptionalEquals());
         Node::ptr rvalue = parser.parseNumber();
@@ -40,7 +40,7 @@ bool InternalInteger::invokeOperation(Parser& parser,
         parser.setSymbol(name, rvalue->valueAny(), global);
         return true;
     } else if(op == Variable::EXPAND) {
-        string name = parseName(parser, node);
+        SymbolKey name = parseName(parser, node);
         int val = parser.symbol(name, int(0));
         node->setValue(boost::lexical_cast<string>(val));
         return true;
@@ -53,7 +53,7 @@ bool IntegerVariable::invokeOperation(Parser& parser,
                 shared_ptr<Node> node, Operation op, bool global)
 {
     if(op == ADVANCE || op == MULTIPLY || op == DIVIDE) {
-        string name = parseName(parser, node);
+        SymbolKey name = parseName(parser, node);
 
         static vector<string> kw_by(1, "by");
         node->appendChild("by", parser.parseOptionalKeyword(kw_by));
@@ -89,7 +89,7 @@ bool IntegerVariable::invokeOperation(Parser& parser,
     return InternalInteger::invokeOperation(parser, node, op, global);
 }
 
-string CharcodeVariable::parseName(Parser& parser, shared_ptr<Node> node)
+SymbolKey CharcodeVariable::parseName(Parser& parser, shared_ptr<Node> node)
 {
     Node::ptr number = parser.parseNumber();
     node->appendChild("variable_number", number);
@@ -102,16 +102,17 @@ string CharcodeVariable::parseName(Parser& parser, shared_ptr<Node> node)
         n = 0;
     }
 
-    string s = name().substr(1) + boost::lexical_cast<string>(n);
-    parser.setSymbolDefault(s, m_initValue);
-    return s;
+    SymbolKey key = m_bank != SymbolKey::NONE ? SymbolKey(m_bank, n) :
+        SymbolKey::named(name().substr(1) + boost::lexical_cast<string>(n));
+    parser.setSymbolDefault(key, m_initValue);
+    return key;
 }
 
 bool CharcodeVariable::invokeOperation(Parser& parser,
                 shared_ptr<Node> node, Operation op, bool global)
 {
     if(op == ASSIGN) {
-        string name = parseName(parser, node);
+        SymbolKey name = parseName(parser, node);
 
         node->appendChild("equals", parser.parseOptionalEquals());
         Node::ptr rvalue = parser.parseNumber();
@@ -140,7 +141,7 @@ bool SpecialInteger::invokeOperation(Parser& parser,
                 shared_ptr<Node> node, Operation op, bool global)
 {
     if(op == ASSIGN) {
-        string name = parseName(parser, node);
+        SymbolKey name = parseName(parser, node);
 
         node->appendChild("equals", parser.parseOptionalEquals());
         Node::ptr rvalue = parser.parseNumber();
@@ -150,12 +151,12 @@ bool SpecialInteger::invokeOperation(Parser& parser,
         parser.setSymbol(name, rvalue->valueAny(), true); // global
         return true;
     } else if(op == GET) {
-        string name = parseName(parser, node);
-        const any& ret = parser.symbolAny(name);
+        SymbolKey name = parseName(parser, node);
+        const Value& ret = parser.symbolAny(name);
         node->setValue(ret.empty() ? m_initValue : ret);
         return true;
     } else if(op == EXPAND) {
-        string name = parseName(parser, node);
+        SymbolKey name = parseName(parser, node);
         int val = parser.symbol(name, int(0));
         node->setValue(boost::lexical_cast<string>(val));
         return true;
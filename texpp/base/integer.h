@@ -30,7 +30,7 @@ namespace base {
 class InternalInteger: public Variable
 {
 public:
-    InternalInteger(const string& name, const any& initValue = any(0))
+    InternalInteger(const string& name, const Value& initValue = Value(0))
         : Variable(name, initValue) {}
 
     bool invokeOperation(Parser& parser,
@@ -40,7 +40,7 @@ public:
 class IntegerVariable: public InternalInteger
 {
 public:
-    IntegerVariable(const string& name, const any& initValue = any(0))
+    IntegerVariable(const string& name, const Value& initValue = Value(0))
         : InternalInteger(name, initValue) {}
 
     bool invokeOperation(Parser& parser,
@@ -51,10 +51,11 @@ class CharcodeVariable: public InternalInteger
 {
 public:
     CharcodeVariable(const string& name,
-        const any& initValue = any(), int min=0, int max=0)
-        : InternalInteger(name, initValue), m_min(min), m_max(max) {}
+        const Value& initValue = Value(), int min=0, int max=0)
+        : InternalInteger(name, initValue), m_min(min), m_max(max),
+          m_bank(SymbolKey::bankByName(name.empty() ? name : name.substr(1))) {}
 
-    string parseName(Parser& parser, shared_ptr<Node> node);
+    SymbolKey parseName(Parser& parser, shared_ptr<Node> node);
     bool invokeOperation(Parser& parser,
                 shared_ptr<Node> node, Operation op, bool global);
 
@@ -64,12 +65,13 @@ public:
 protected:
     int m_min;
     int m_max;
+    SymbolKey::Bank m_bank;
 };
 
 class SpecialInteger: public InternalInteger
 {
 public:
-    SpecialInteger(const string& name, const any& initValue = any(0))
+    SpecialInteger(const string& name, const Value& initValue = Value(0))
         : InternalInteger(name, initValue) {}
 
     bool invokeOperation(Parser& parser,
@@ -79,7 +81,7 @@ public:
 class Spacefactor: public SpecialInteger
 {
 public:
-    Spacefactor(const string& name, const any& initValue = any(0))
+    Spacefactor(const string& name, const Value& initValue = Value(0))
         : SpecialInteger(name, initValue) {}
 
     bool invokeOperation(Parser& parser,
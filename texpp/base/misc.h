@@ -75,11 +75,11 @@ class Changecase: public Command
 {
 public:
     explicit Changecase(const string& name, const string& table)
-        : Command(name), m_table(table) {}
+        : Command(name), m_table(SymbolKey::bankByName(table)) {}
     bool invoke(Parser& parser, shared_ptr<Node> node);
 
 protected:
-    string m_table;
+    SymbolKey::Bank m_table;
 };
 
 class SetInteraction: public Command
@@ -138,12 +138,10 @@ bool ExpandafterMacro::expand(Parser& parser, shared_ptr<Node> node)
 
     Token::ptr token2 = child2->value(Token::ptr());
     if(token2) {
-        Node::ptr enode = parser.rawExpandToken(token2->lcopy());
-        if(enode) {
-            Token::list_ptr newTokens = enode->value(Token::list_ptr());
-            assert(newTokens && !newTokens->empty());
-            tokens.insert(tokens.end(),
-                    newTokens->begin(), newTokens->end());
+        // the expansion itself is already in the queue
+        Token::ptr sourceToken = parser.rawExpandToken(token2->lcopy());
+        if(sourceToken) {
+            tokens.push_back(sourceToken);
         } else {
             tokens.push_back(token2->lcopy());
         }
@@ -159,8 +157,7 @@ bool NoexpandMacro::expand(Parser& parser, shared_ptr<Node> node)
     Node::ptr child = parser.parseToken(false);
     node->appendChild("token", child);
 
-    Token::ptr token = child->value(Token::ptr())->lcopy();
-    parser.addNoexpand(token);
+    Token::ptr token = parser.addNoexpand(child->value(Token::ptr()));
     node->setValue(Token::list_ptr(new Token::list(1, token)));
 
     return true;
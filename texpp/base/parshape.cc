@@ -29,7 +29,7 @@ bool Parshape::invokeOperation(Parser& parser,
                         shared_ptr<Node> node, Operation op, bool global)
 {
     if(op == ASSIGN) {
-        string name = parseName(parser, node);
+        SymbolKey name = parseName(parser, node);
 
         node->appendChild("equals", parser.parseOptionalEquals());
 
@@ -54,13 +54,13 @@ bool Parshape::invokeOperation(Parser& parser,
         return true;
 
     } else if(op == GET) {
-        string name = parseName(parser, node);
+        SymbolKey name = parseName(parser, node);
         ParshapeInfo info = parser.symbol(name, ParshapeInfo());
         node->setValue(info.parshape.size());
         return true;
 
     } else if(op == EXPAND) {
-        string name = parseName(parser, node);
+        SymbolKey name = parseName(parser, node);
         ParshapeInfo info = parser.symbol(name, ParshapeInfo());
         node->setValue(boost::lexical_cast<string>(info.parshape.size()));
         return true;
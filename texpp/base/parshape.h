@@ -36,7 +36,7 @@ class Parshape: public InternalInteger
 {
 public:
     explicit Parshape(const string& name,
-        const any& initValue = any(ParshapeInfo()))
+        const Value& initValue = Value(ParshapeInfo()))
         : InternalInteger(name, initValue) {}
     bool invokeOperation(Parser& parser,
                 shared_ptr<Node> node, Operation op, bool global);
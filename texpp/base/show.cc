@@ -86,7 +86,7 @@ bool parseThe(Parser& parser, shared_ptr<Node> node, bool show)
                         dynamic_pointer_cast<base::Message>(c) ||
                         (dynamic_pointer_cast<base::Def>(c) &&
                          static_pointer_cast<base::Def>(c)->expand())) {
-                    parser.addNoexpand((*toks_copy)[n]);
+                    (*toks_copy)[n] = parser.addNoexpand(toks[n]);
                 }
             }
         }
@@ -30,7 +30,7 @@ bool InternalToks::invokeOperation(Parser& parser,
                 shared_ptr<Node> node, Operation op, bool global)
 {
     if(op == ASSIGN) {
-        string name = parseName(parser, node);
+        SymbolKey name = parseName(parser, node);
 
         node->appendChild("equals", parser.parseOptionalEquals());
 
@@ -49,7 +49,7 @@ bool InternalToks::invokeOperation(Parser& parser,
         return true;
 
     } else if(op == EXPAND) {
-        string name = parseName(parser, node);
+        SymbolKey name = parseName(parser, node);
         Token::list toks = parser.symbol(name, Token::list());
         node->setValue(toksToString(parser, toks));
         return true;
@@ -62,8 +62,8 @@ string InternalToks::toksToString(Parser& parser, const Token::list& toks)
 {
     return Token::texReprList(toks, &parser);
     /*
-    char newlinechar = parser.symbol("newlinechar", int(0));
-    char escapechar = parser.symbol("escapechar", int(0));
+    char newlinechar = parser.newlinechar();
+    char escapechar = parser.escapechar();
     BOOST_FOREACH(Token::ptr token, toks) {
         if(token->isControl()) {
             str += token->texRepr(escapechar);
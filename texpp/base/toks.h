@@ -32,7 +32,7 @@ class InternalToks: public Variable
 {
 public:
     InternalToks(const string& name,
-        const any& initValue = any(Token::list()))
+        const Value& initValue = Value(Token::list()))
         : Variable(name, initValue) {}
 
     bool invokeOperation(Parser& parser,
@@ -45,7 +45,7 @@ class ToksVariable: public InternalToks
 {
 public:
     ToksVariable(const string& name,
-        const any& initValue = any(Token::list()))
+        const Value& initValue = Value(Token::list()))
         : InternalToks(name, initValue) {}
 };
 
@@ -26,17 +26,17 @@
 namespace texpp {
 namespace base {
 
-string Variable::parseName(Parser&, shared_ptr<Node>)
+SymbolKey Variable::parseName(Parser&, shared_ptr<Node>)
 {
-    return name().substr(1);
+    return m_symbolKey;
 }
 
 bool Variable::invokeOperation(Parser& parser,
                 shared_ptr<Node> node, Operation op, bool)
 {
     if(op == GET) {
-        string name = parseName(parser, node);
-        const any& ret = parser.symbolAny(name);
+        SymbolKey name = parseName(parser, node);
+        const Value& ret = parser.symbolAny(name);
         node->setValue(ret.empty() ? m_initValue : ret);
         return true;
     }
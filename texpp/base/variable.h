@@ -34,12 +34,13 @@ class Variable: public Assignment
 public:
     enum Operation { GET, ASSIGN, ADVANCE, MULTIPLY, DIVIDE, EXPAND };
 
-    Variable(const string& name, const any& initValue = any())
-        : Assignment(name), m_initValue(initValue) {}
+    Variable(const string& name, const Value& initValue = Value())
+        : Assignment(name), m_initValue(initValue),
+          m_symbolKey(name.empty() ? name : name.substr(1)) {}
 
-    const any& initValue() const { return m_initValue; }
+    const Value& initValue() const { return m_initValue; }
 
-    virtual string parseName(Parser& parser, shared_ptr<Node> node);
+    virtual SymbolKey parseName(Parser& parser, shared_ptr<Node> node);
     virtual bool invokeOperation(Parser& parser,
                 shared_ptr<Node> node, Operation op, bool global);
 
@@ -50,7 +51,8 @@ public:
     static Node::ptr tryParseVariableValue(Parser& parser);
 
 protected:
-    any m_initValue;
+    Value m_initValue;
+    SymbolKey m_symbolKey;  // parseName() of the plain variable
 };
 
 class ArithmeticCommand: public Assignment
@@ -71,19 +73,23 @@ template<class Var>
 class Register: public Var
 {
 public:
-    Register(const string& name, const any& initValue)
-        : Var(name, initValue) {}
+    Register(const string& name, const Value& initValue)
+        : Var(name, initValue),
+          m_bank(SymbolKey::bankByName(name.empty() ? name : name.substr(1))) {}
 
-    string parseName(Parser& parser, shared_ptr<Node> node);
-    bool createDef(Parser& parser, shared_ptr<Token> token,
+    SymbolKey parseName(Parser& parser, shared_ptr<Node> node);
+    bool createDef(Parser& parser, Token::ptr token,
                             int num, bool global);
+
+protected:
+    SymbolKey::Bank m_bank;     // NONE for registers without a bank
 };
 
 template<class Var>
 class ReadOnlyVariable: public Var
 {
 public:
-    ReadOnlyVariable(const string& name, const any& initValue = any(0))
+    ReadOnlyVariable(const string& name, const Value& initValue = Value(0))
         : Var(name, initValue) {}
 
     bool invokeOperation(Parser& parser,
@@ -106,7 +112,7 @@ Node::ptr Variable::tryParseVariableValue(Parser& parser)
 }
 
 template<class Var>
-string Register<Var>::parseName(Parser& parser, shared_ptr<Node> node)
+SymbolKey Register<Var>::parseName(Parser& parser, shared_ptr<Node> node)
 {
     shared_ptr<Node> number = parser.parseNumber();
     node->appendChild("variable_number", number);
@@ -119,9 +125,11 @@ string Register<Var>::parseName(Parser& parser, shared_ptr<Node> node)
         n = 0;
     }
 
-    string s = this->name().substr(1) + boost::lexical_cast<string>(n);
-    parser.setSymbolDefault(s, this->m_initValue);
-    return s;
+    SymbolKey key = m_bank != SymbolKey::NONE ? SymbolKey(m_bank, n) :
+        SymbolKey::named(this->name().substr(1) +
+                            boost::lexical_cast<string>(n));
+    parser.setSymbolDefault(key, this->m_initValue);
+    return key;
 }
 
 template<class Var>
@@ -20,13 +20,13 @@
 #define __TEXPP_COMMAND_H
 
 #include <texpp/common.h>
+#include <texpp/token.h>
 
 #include <set>
 #include <boost/lexical_cast.hpp>
 
 namespace texpp {
 
-class Token;
 class Node;
 class Parser;
 
@@ -35,11 +35,31 @@ class Command
 public:
     typedef shared_ptr<Command> ptr;
 
-    Command(const string& name = string()): m_name(name) {}
+    /**
+     * @brief the base classes the parser dispatches on. Each of them adds
+     *      its bit in the constructor, so testing the class of a command
+     *      does not need dynamic_pointer_cast.
+     */
+    enum Kind {
+        MACRO               = 1 << 0,
+        CONDITIONAL_BEGIN   = 1 << 1,
+        CONDITIONAL_OR      = 1 << 2,
+        CONDITIONAL_ELSE    = 1 << 3,
+        CONDITIONAL_END     = 1 << 4,
+        BEGINGROUP          = 1 << 5,
+        ENDGROUP            = 1 << 6,
+        PREFIX              = 1 << 7,
+        ASSIGNMENT          = 1 << 8
+    };
+
+    Command(const string& name = string()): m_name(name), m_kind(0) {}
     virtual ~Command() {}
 
     const string& name() const { return m_name; }
 
+    unsigned int kind() const { return m_kind; }
+    bool is(Kind kind) const { return (m_kind & kind) != 0; }
+
     virtual string repr() const;
 
     /**
@@ -57,6 +77,7 @@ public:
 
 protected:
     string m_name;
+    unsigned int m_kind;
 };
 
 // \par
@@ -65,16 +86,16 @@ class TokenCommand: public Command
 public:
     typedef shared_ptr<TokenCommand> ptr;
 
-    TokenCommand(shared_ptr<Token> token)
+    TokenCommand(Token::ptr token)
         : Command("token_command"), m_token(token) {}
 
-    const shared_ptr<Token>& token() const { return m_token; }
+    const Token::ptr& token() const { return m_token; }
 
     string texRepr(Parser* parser = NULL) const;
     bool invoke(Parser& parser, shared_ptr<Node> node);
 
 protected:
-    shared_ptr<Token> m_token;
+    Token::ptr m_token;
 };
 
 // class witch describe behavior of macro define command "\macro"
@@ -83,13 +104,13 @@ class Macro: public Command
 public:
     typedef shared_ptr<Macro> ptr;
 
-    Macro(const string& name = string()): Command(name) {}
+    Macro(const string& name = string()): Command(name) { m_kind |= MACRO; }
 
     bool invokeWithPrefixes(Parser&, shared_ptr<Node>,
                                 std::set<string>&) { return true; }
     virtual bool expand(Parser&, shared_ptr<Node>) { return false; }
 
-    static shared_ptr<vector<shared_ptr<Token> > >
+    static Token::list_ptr
                         stringToTokens(const string& str);
 };
 
@@ -97,7 +118,9 @@ class ConditionalBegin: public Macro
 {
 public:
     typedef shared_ptr<ConditionalBegin> ptr;
-    ConditionalBegin(const string& name = string()): Macro(name) {}
+    ConditionalBegin(const string& name = string()): Macro(name) {
+        m_kind |= CONDITIONAL_BEGIN;
+    }
     virtual bool evaluate(Parser&, shared_ptr<Node>) { return true; }
 };
 
@@ -105,21 +128,27 @@ class ConditionalOr: public Macro
 {
 public:
     typedef shared_ptr<ConditionalOr> ptr;
-    ConditionalOr(const string& name = string()): Macro(name) {}
+    ConditionalOr(const string& name = string()): Macro(name) {
+        m_kind |= CONDITIONAL_OR;
+    }
 };
 
 class ConditionalElse: public Macro
 {
 public:
     typedef shared_ptr<ConditionalElse> ptr;
-    ConditionalElse(const string& name = string()): Macro(name) {}
+    ConditionalElse(const string& name = string()): Macro(name) {
+        m_kind |= CONDITIONAL_ELSE;
+    }
 };
 
 class ConditionalEnd: public Macro
 {
 public:
     typedef shared_ptr<ConditionalEnd> ptr;
-    ConditionalEnd(const string& name = string()): Macro(name) {}
+    ConditionalEnd(const string& name = string()): Macro(name) {
+        m_kind |= CONDITIONAL_END;
+    }
 };
 
 /**
@@ -128,7 +157,9 @@ public:
 class Begingroup: public Command
 {
 public:
-    Begingroup(const string& name = string()): Command(name) {}
+    Begingroup(const string& name = string()): Command(name) {
+        m_kind |= BEGINGROUP;
+    }
     bool invoke(Parser &, shared_ptr<Node>);
 };
 
@@ -138,7 +169,9 @@ public:
 class Endgroup: public Command
 {
 public:
-    Endgroup(const string& name = string()): Command(name) {}
+    Endgroup(const string& name = string()): Command(name) {
+        m_kind |= ENDGROUP;
+    }
     bool invoke(Parser &, shared_ptr<Node>);
 };
 
@@ -26,6 +26,8 @@
 
 //#include <tr1/memory>
 #include <boost/shared_ptr.hpp>
+#include <boost/intrusive_ptr.hpp>
+#include <boost/utility/string_ref.hpp>
 #include <boost/any.hpp>
 
 #include <unordered_map>
@@ -53,6 +55,8 @@ namespace texpp {
     using boost::weak_ptr;
     using boost::dynamic_pointer_cast;
     using boost::static_pointer_cast;
+    using boost::intrusive_ptr;
+    using boost::string_ref;
 
     using boost::any;
     using boost::any_cast;
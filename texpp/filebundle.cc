@@ -0,0 +1,79 @@
+/*  This file is part of texpp library.
+    Copyright (C) 2009 Vladimir Kuznetsov <ks.vladimir@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#include <texpp/filebundle.h>
+#include <texpp/inputbuffer.h>
+#include <texpp/kpsewhich.h>
+
+#include <fstream>
+
+namespace texpp {
+
+string FileBundle::path(const string& fname) const
+{
+    if(m_workdir.empty() || fname.empty() || fname[0] == '/')
+        return fname;
+    return m_workdir + "/" + fname;
+}
+
+bool FileBundle::exists(const string& fname) const
+{
+    std::ifstream file(path(fname).c_str());
+    return bool(file);
+}
+
+shared_ptr<std::istream> FileBundle::get_file(const string& fname)
+{
+    return shared_ptr<std::istream>(new std::ifstream(
+                    path(fname).c_str(), std::ios::in | std::ios::binary));
+}
+
+shared_ptr<InputBuffer> FileBundle::get_file_buffer(const string& fname)
+{
+    return InputBuffer::mapFile(path(fname));
+}
+
+string FileBundle::get_tex_filename(const string& fname)
+{
+    if(exists(fname))
+        return fname;
+    string extended = kpseextend(fname);
+    if(exists(extended))
+        return extended;
+    return fname;
+}
+
+string FileBundle::get_bib_filename(const string& fname)
+{
+    if(exists(fname))
+        return fname;
+    if(exists(fname + ".bbl"))
+        return fname + ".bbl";
+
+    // bibtex writes the bibliography to <jobname>.bbl
+    size_t dot = m_mainFileName.rfind('.');
+    string jobBbl = m_mainFileName.substr(0, dot) + ".bbl";
+    if(exists(jobBbl))
+        return jobBbl;
+
+    return fname + ".bbl";
+}
+
+} // namespace texpp
+
@@ -0,0 +1,80 @@
+/*  This file is part of texpp library.
+    Copyright (C) 2009 Vladimir Kuznetsov <ks.vladimir@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+
+#ifndef __TEXPP_FILEBUNDLE_H
+#define __TEXPP_FILEBUNDLE_H
+
+#include <texpp/common.h>
+#include <texpp/parser.h>
+
+namespace texpp {
+
+/**
+ * @brief bundle serving the files of a directory on disk. The files are
+ *      memory-mapped, see InputBuffer::mapFile(). Names which are not
+ *      absolute are relative to the working directory of the bundle.
+ */
+class FileBundle: public Bundle
+{
+public:
+    typedef shared_ptr<FileBundle> ptr;
+
+    /**
+     * @param mainFileName - file to parse
+     * @param workdir - directory of the relative names, or empty for
+     *      the current directory
+     */
+    explicit FileBundle(const string& mainFileName,
+                        const string& workdir = string())
+        : m_mainFileName(mainFileName), m_workdir(workdir) {}
+
+    const string& workdir() const { return m_workdir; }
+
+    string get_mainfile_name() { return m_mainFileName; }
+
+    /**
+     * @brief returns a stream reading the file; the stream is in the
+     *      failed state if there is no such file
+     */
+    shared_ptr<std::istream> get_file(const string& fname);
+
+    /**
+     * @brief maps the file into memory; thread-safe
+     */
+    shared_ptr<InputBuffer> get_file_buffer(const string& fname);
+
+    string get_bib_filename(const string& fname);
+    string get_tex_filename(const string& fname);
+
+    /**
+     * @brief returns the path of the file named fname
+     */
+    string path(const string& fname) const;
+
+protected:
+    bool exists(const string& fname) const;
+
+    string m_mainFileName;
+    string m_workdir;
+};
+
+} // namespace texpp
+
+#endif
+
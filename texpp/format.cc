@@ -0,0 +1,869 @@
+/*  This file is part of texpp library.
+    Copyright (C) 2009 Vladimir Kuznetsov <ks.vladimir@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <texpp/format.h>
+#include <texpp/command.h>
+
+#include <texpp/base/integer.h>
+#include <texpp/base/dimen.h>
+#include <texpp/base/glue.h>
+#include <texpp/base/toks.h>
+#include <texpp/base/box.h>
+#include <texpp/base/char.h>
+#include <texpp/base/font.h>
+#include <texpp/base/parshape.h>
+#include <texpp/base/func.h>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <typeinfo>
+#include <map>
+
+#include <boost/foreach.hpp>
+#include <boost/functional/hash.hpp>
+
+namespace texpp {
+namespace {
+
+using namespace base;
+
+typedef Parser::NamedSymbolTable SymbolTable;
+
+// the value of the named symbol in the table, or NULL
+const Value* namedValue(const SymbolTable& table, const InternedString* name)
+{
+    SymbolTable::const_iterator it = table.find(name);
+    return it != table.end() ? &it->second.entry.second : NULL;
+}
+
+bool nameLess(const InternedString* name1, const InternedString* name2)
+{
+    return *name1 < *name2;
+}
+
+const char* FORMAT_MAGIC = "texpp-format";
+const int FORMAT_VERSION = 1;
+
+template<class V>
+Command::ptr makeVariable(const string& name, const Value& initValue)
+{
+    return Command::ptr(new V(name, initValue));
+}
+
+// the variables created by \countdef, \chardef, \font, ... are saved
+// as their class, name and initial value
+struct VariableClass
+{
+    const char* tag;
+    const std::type_info* type;
+    Command::ptr (*make)(const string& name, const Value& initValue);
+};
+
+const VariableClass variableClasses[] = {
+    { "integer", &typeid(IntegerVariable), makeVariable<IntegerVariable> },
+    { "dimen", &typeid(DimenVariable), makeVariable<DimenVariable> },
+    { "boxdimen", &typeid(BoxDimen), makeVariable<BoxDimen> },
+    { "glue", &typeid(GlueVariable), makeVariable<GlueVariable> },
+    { "muglue", &typeid(MuGlueVariable), makeVariable<MuGlueVariable> },
+    { "toks", &typeid(ToksVariable), makeVariable<ToksVariable> },
+    { "box", &typeid(BoxVariable), makeVariable<BoxVariable> },
+    { "chardef", &typeid(CharDef), makeVariable<CharDef> },
+    { "font", &typeid(FontSelector), makeVariable<FontSelector> },
+};
+
+const size_t variableClassCount =
+            sizeof(variableClasses) / sizeof(variableClasses[0]);
+
+class FormatWriter
+{
+public:
+    FormatWriter(std::ostream& os, const SymbolTable& baseSymbols)
+        : m_os(os), m_baseSymbols(baseSymbols)
+    {
+        // primitives are referenced by the name they have in the base;
+        // the first name in alphabetical order is taken, as the order of
+        // the table is not fixed
+        BOOST_FOREACH(const SymbolTable::value_type& item, baseSymbols) {
+            const Command::ptr* cmd =
+                        item.second.entry.second.get<Command::ptr>();
+            if(!cmd || !*cmd)
+                continue;
+            const InternedString*& name = m_primitives[cmd->get()];
+            if(!name || nameLess(item.first, name))
+                name = item.first;
+        }
+    }
+
+    const InternedString* primitiveName(const Command::ptr& cmd) const;
+    bool sameValue(const Value& value1, const Value& value2) const;
+
+    void writeInt(int n) { m_os << ' ' << n; }
+    void writeString(const string& s) { m_os << ' ' << s.size() << ':' << s; }
+    void writeTag(const char* tag) { m_os << ' ' << tag; }
+
+    void writeToken(const Token::ptr& token) {
+        if(!token) {
+            writeInt(-1);
+        } else {
+            writeInt(token->type());
+            writeInt(token->catCode());
+            writeString(token->value());
+        }
+    }
+
+    void writeTokenList(const Token::list& list) {
+        writeInt(int(list.size()));
+        BOOST_FOREACH(const Token::ptr& token, list)
+            writeToken(token);
+    }
+
+    void writeTokenListPtr(const Token::list_ptr& list) {
+        writeInt(list ? 1 : 0);
+        if(list) writeTokenList(*list);
+    }
+
+    bool writeCommand(const Command::ptr& cmd);
+    bool writeValue(const Value& value);
+
+protected:
+    std::ostream& m_os;
+    const SymbolTable& m_baseSymbols;
+    std::map<const Command*, const InternedString*> m_primitives;
+};
+
+const InternedString* FormatWriter::primitiveName(
+                                const Command::ptr& cmd) const
+{
+    std::map<const Command*, const InternedString*>::const_iterator it =
+                                    m_primitives.find(cmd.get());
+    if(it != m_primitives.end())
+        return it->second;
+
+    // a parser created without the base has its own primitives, they
+    // are matched by the name, the class and the initial value; the
+    // name returned is kept by the table of the base
+    InternedString::ptr name = InternedString::find(cmd->name());
+    const Value* value = name ? namedValue(m_baseSymbols, name.get()) : NULL;
+    if(!value)
+        return NULL;
+    const Command::ptr* primitive = value->get<Command::ptr>();
+    if(!primitive || !*primitive || typeid(**primitive) != typeid(*cmd))
+        return NULL;
+
+    shared_ptr<Variable> var = dynamic_pointer_cast<Variable>(cmd);
+    if(var && !sameValue(var->initValue(),
+                static_pointer_cast<Variable>(*primitive)->initValue()))
+        return NULL;
+    return name.get();
+}
+
+bool FormatWriter::sameValue(const Value& value1, const Value& value2) const
+{
+    if(value1.same(value2))
+        return true;
+
+    // objects set by base::initSymbols() (such as the TokenCommand of \()
+    if(value1.type() == Value::OTHER && value2.type() == Value::OTHER)
+        return value1.repr() == value2.repr();
+
+    std::ostringstream os1, os2;
+    FormatWriter writer1(os1, m_baseSymbols), writer2(os2, m_baseSymbols);
+    return writer1.writeValue(value1) && writer2.writeValue(value2) &&
+                os1.str() == os2.str();
+}
+
+bool FormatWriter::writeCommand(const Command::ptr& cmd)
+{
+    if(!cmd) {
+        writeTag("0");
+        return true;
+    }
+
+    if(const InternedString* name = primitiveName(cmd)) {
+        writeTag("=");
+        writeString(*name);
+        return true;
+    }
+
+    if(typeid(*cmd) == typeid(UserMacro)) {
+        shared_ptr<UserMacro> macro = static_pointer_cast<UserMacro>(cmd);
+        writeTag("M");
+        writeString(macro->name());
+        writeInt(macro->outerAttr());
+        writeInt(macro->longAttr());
+        writeTokenList(macro->params());
+        writeTokenList(macro->definition());
+        return true;
+    }
+
+    if(typeid(*cmd) == typeid(TokenCommand)) {
+        writeTag("K");
+        writeToken(static_pointer_cast<TokenCommand>(cmd)->token());
+        return true;
+    }
+
+    for(size_t n = 0; n < variableClassCount; ++n) {
+        if(typeid(*cmd) == *variableClasses[n].type) {
+            writeTag("V");
+            writeTag(variableClasses[n].tag);
+            writeString(cmd->name());
+            return writeValue(static_pointer_cast<Variable>(cmd)->initValue());
+        }
+    }
+
+    return false;
+}
+
+bool FormatWriter::writeValue(const Value& value)
+{
+    switch(value.type()) {
+        case Value::EMPTY:
+            writeTag("E");
+            break;
+        case Value::INT:
+            writeTag("I");
+            writeInt(*value.get<int>());
+            break;
+        case Value::DIMEN:
+            writeTag("D");
+            writeInt(value.get<Dimen>()->value);
+            break;
+        case Value::GLUE: {
+            const Glue* glue = value.get<Glue>();
+            writeTag("G");
+            writeInt(glue->mu);
+            writeInt(glue->width.value);
+            writeInt(glue->stretch.value);
+            writeInt(glue->stretchOrder);
+            writeInt(glue->shrink.value);
+            writeInt(glue->shrinkOrder);
+            break;
+        }
+        case Value::STRING:
+            writeTag("S");
+            writeString(*value.get<string>());
+            break;
+        case Value::TOKEN:
+            writeTag("T");
+            writeToken(*value.get<Token::ptr>());
+            break;
+        case Value::TOKEN_LIST:
+            writeTag("L");
+            writeTokenList(*value.get<Token::list>());
+            break;
+        case Value::TOKEN_LIST_PTR:
+            writeTag("P");
+            writeTokenListPtr(*value.get<Token::list_ptr>());
+            break;
+        case Value::FONT: {
+            const FontInfo::ptr& font = *value.get<FontInfo::ptr>();
+            writeTag("F");
+            if(!font) {
+                writeInt(0);
+            } else if(font == defaultFontInfo) {
+                writeInt(2);
+            } else {
+                writeInt(1);
+                writeString(font->selector);
+                writeString(font->file);
+                writeInt(font->at.value);
+            }
+            break;
+        }
+        case Value::BOX: {
+            const Box* box = value.get<Box>();
+            writeTag("B");
+            writeInt(box->mode);
+            writeInt(box->top);
+            writeInt(box->width.value);
+            writeInt(box->height.value);
+            writeInt(box->skip.value);
+            writeTokenListPtr(box->value);
+            break;
+        }
+        case Value::PARSHAPE: {
+            const ParshapeInfo* parshape = value.get<ParshapeInfo>();
+            writeTag("H");
+            writeInt(int(parshape->parshape.size()));
+            for(size_t n = 0; n < parshape->parshape.size(); ++n) {
+                writeInt(parshape->parshape[n].first);
+                writeInt(parshape->parshape[n].second);
+            }
+            break;
+        }
+        case Value::COMMAND:
+            writeTag("C");
+            return writeCommand(*value.get<Command::ptr>());
+        case Value::OTHER:
+            return false;
+    }
+    return true;
+}
+
+class FormatReader
+{
+public:
+    FormatReader(std::istream& is, const SymbolTable& baseSymbols)
+        : m_is(is), m_baseSymbols(baseSymbols) {}
+
+    bool readInt(int& n) { return bool(m_is >> n); }
+
+    // the string grows by chunks read from the stream, so a corrupted
+    // length fails at the end of the stream instead of allocating it
+    bool readString(string& s) {
+        size_t len; char colon;
+        if(!(m_is >> len) || !m_is.get(colon) || colon != ':')
+            return false;
+        s.clear();
+        char chunk[4096];
+        while(s.size() < len) {
+            size_t n = std::min(len - s.size(), sizeof(chunk));
+            if(!m_is.read(chunk, n))
+                return false;
+            s.append(chunk, n);
+        }
+        return true;
+    }
+    bool readTag(string& tag) { return bool(m_is >> tag); }
+
+    bool readToken(Token::ptr& token) {
+        int type, catCode; string value;
+        if(!readInt(type)) return false;
+        if(type == -1) {
+            token.reset();
+            return true;
+        }
+        if(type < Token::TOK_SKIPPED || type > Token::TOK_CONTROL ||
+                !readInt(catCode) || catCode < Token::CC_ESCAPE ||
+                catCode > Token::CC_NONE || !readString(value))
+            return false;
+        token = Token::create(Token::Type(type),
+                              Token::CatCode(catCode), value);
+        return true;
+    }
+
+    bool readTokenList(Token::list& list) {
+        int size;
+        if(!readInt(size) || size < 0) return false;
+        list.clear();
+        for(int n = 0; n < size; ++n) {
+            Token::ptr token;
+            if(!readToken(token)) return false;
+            list.push_back(token);
+        }
+        return true;
+    }
+
+    bool readTokenListPtr(Token::list_ptr& list) {
+        int notNull;
+        if(!readInt(notNull)) return false;
+        list.reset();
+        if(!notNull) return true;
+        list.reset(new Token::list);
+        return readTokenList(*list);
+    }
+
+    bool readCommand(Command::ptr& cmd);
+    bool readValue(Value& value);
+
+protected:
+    std::istream& m_is;
+    const SymbolTable& m_baseSymbols;
+};
+
+bool FormatReader::readCommand(Command::ptr& cmd)
+{
+    string tag, name;
+    if(!readTag(tag)) return false;
+
+    cmd.reset();
+    if(tag == "0") {
+        return true;
+
+    } else if(tag == "=") {
+        if(!readString(name)) return false;
+        InternedString::ptr interned = InternedString::find(name);
+        const Value* value =
+                    interned ? namedValue(m_baseSymbols, interned.get()) : NULL;
+        if(!value) return false;
+        const Command::ptr* primitive = value->get<Command::ptr>();
+        if(!primitive || !*primitive) return false;
+        cmd = *primitive;
+        return true;
+
+    } else if(tag == "M") {
+        int outerAttr, longAttr;
+        Token::list_ptr params(new Token::list);
+        Token::list_ptr definition(new Token::list);
+        if(!readString(name) || !readInt(outerAttr) || !readInt(longAttr) ||
+                !readTokenList(*params) || !readTokenList(*definition))
+            return false;
+        cmd = Command::ptr(new UserMacro(name, params, definition,
+                                         outerAttr, longAttr));
+        return true;
+
+    } else if(tag == "K") {
+        Token::ptr token;
+        if(!readToken(token)) return false;
+        cmd = Command::ptr(new TokenCommand(token));
+        return true;
+
+    } else if(tag == "V") {
+        Value initValue;
+        if(!readTag(tag) || !readString(name) || !readValue(initValue))
+            return false;
+        for(size_t n = 0; n < variableClassCount; ++n) {
+            if(tag == variableClasses[n].tag) {
+                cmd = variableClasses[n].make(name, initValue);
+                return true;
+            }
+        }
+    }
+
+    return false;
+}
+
+bool FormatReader::readValue(Value& value)
+{
+    string tag;
+    if(!readTag(tag) || tag.size() != 1) return false;
+
+    switch(tag[0]) {
+        case 'E':
+            value = Value();
+            return true;
+        case 'I': {
+            int n;
+            if(!readInt(n)) return false;
+            value = n;
+            return true;
+        }
+        case 'D': {
+            int n;
+            if(!readInt(n)) return false;
+            value = Dimen(n);
+            return true;
+        }
+        case 'G': {
+            int mu, w, st, sto, sh, sho;
+            if(!readInt(mu) || !readInt(w) || !readInt(st) ||
+                    !readInt(sto) || !readInt(sh) || !readInt(sho))
+                return false;
+            value = Glue(mu, w, Dimen(st), sto, Dimen(sh), sho);
+            return true;
+        }
+        case 'S': {
+            string s;
+            if(!readString(s)) return false;
+            value = s;
+            return true;
+        }
+        case 'T': {
+            Token::ptr token;
+            if(!readToken(token)) return false;
+            value = token;
+            return true;
+        }
+        case 'L': {
+            Token::list list;
+            if(!readTokenList(list)) return false;
+            value = list;
+            return true;
+        }
+        case 'P': {
+            Token::list_ptr list;
+            if(!readTokenListPtr(list)) return false;
+            value = list;
+            return true;
+        }
+        case 'F': {
+            int kind, at;
+            string selector, file;
+            if(!readInt(kind)) return false;
+            if(kind == 0) {
+                value = FontInfo::ptr();
+            } else if(kind == 2) {
+                value = defaultFontInfo;
+            } else {
+                if(!readString(selector) || !readString(file) || !readInt(at))
+                    return false;
+                value = FontInfo::ptr(new FontInfo(selector, file, Dimen(at)));
+            }
+            return true;
+        }
+        case 'B': {
+            int mode, top, w, h, s;
+            Box box;
+            if(!readInt(mode) || mode < Parser::NULLMODE ||
+                    mode > Parser::DMATH || !readInt(top) || !readInt(w) ||
+                    !readInt(h) || !readInt(s) || !readTokenListPtr(box.value))
+                return false;
+            box.mode = Parser::Mode(mode);
+            box.top = top;
+            box.width = Dimen(w);
+            box.height = Dimen(h);
+            box.skip = Dimen(s);
+            value = box;
+            return true;
+        }
+        case 'H': {
+            int size;
+            ParshapeInfo parshape;
+            if(!readInt(size) || size < 0) return false;
+            for(int n = 0; n < size; ++n) {
+                int indent, length;
+                if(!readInt(indent) || !readInt(length))
+                    return false;
+                parshape.parshape.push_back(std::make_pair(indent, length));
+            }
+            value = parshape;
+            return true;
+        }
+        case 'C': {
+            Command::ptr cmd;
+            if(!readCommand(cmd)) return false;
+            value = cmd;
+            return true;
+        }
+    }
+    return false;
+}
+
+// copies the tokens read from the files of a parse to the heap, as
+// FormatReader creates them, so the copies do not keep the TokenArena
+// of the parse (its blocks and its files) alive. Tokens and commands
+// shared by several values stay shared, the values without such
+// tokens are returned as they are.
+class TokenDetach
+{
+public:
+    Token::ptr token(const Token::ptr& token);
+    Token::list tokens(const Token::list& tokens);
+    Token::list_ptr tokens(const Token::list_ptr& tokens);
+    Command::ptr command(const Command::ptr& cmd);
+    Value value(const Value& value);
+    Node::ptr node(const Node::ptr& node);
+
+protected:
+    std::unordered_map<const Token*, Token::ptr> m_tokens;
+    std::unordered_map<const Command*, Command::ptr> m_commands;
+};
+
+Token::ptr TokenDetach::token(const Token::ptr& token)
+{
+    if(!token || (!token->sourceFile() && !token->sourceTokens()))
+        return token;
+    Token::ptr& copy = m_tokens[token.get()];
+    if(copy) return copy;
+    copy.reset(new Token(*token));
+    if(const Token::list* parts = token->sourceTokens())
+        copy->setSourceTokens(shared_ptr<Token::list>(
+                    new Token::list(tokens(*parts))));
+    return copy;
+}
+
+Token::list TokenDetach::tokens(const Token::list& tokens)
+{
+    Token::list copy;
+    copy.reserve(tokens.size());
+    BOOST_FOREACH(const Token::ptr& t, tokens)
+        copy.push_back(token(t));
+    return copy;
+}
+
+Token::list_ptr TokenDetach::tokens(const Token::list_ptr& tokens)
+{
+    if(!tokens) return tokens;
+    Token::list copy = this->tokens(*tokens);
+    return copy == *tokens ? tokens : Token::list_ptr(new Token::list(copy));
+}
+
+Command::ptr TokenDetach::command(const Command::ptr& cmd)
+{
+    if(!cmd) return cmd;
+    std::unordered_map<const Command*, Command::ptr>::const_iterator it =
+                                            m_commands.find(cmd.get());
+    if(it != m_commands.end())
+        return it->second;
+
+    Command::ptr copy = cmd;
+    if(typeid(*cmd) == typeid(UserMacro)) {
+        shared_ptr<UserMacro> macro = static_pointer_cast<UserMacro>(cmd);
+        Token::list params = macro->params();
+        Token::list definition = macro->definition();
+        Token::list_ptr params1(new Token::list(tokens(params)));
+        Token::list_ptr definition1(new Token::list(tokens(definition)));
+        if(*params1 != params || *definition1 != definition)
+            copy.reset(new UserMacro(macro->name(), params1, definition1,
+                                macro->outerAttr(), macro->longAttr()));
+
+    } else if(typeid(*cmd) == typeid(TokenCommand)) {
+        Token::ptr t = static_pointer_cast<TokenCommand>(cmd)->token();
+        Token::ptr t1 = token(t);
+        if(t1 != t)
+            copy.reset(new TokenCommand(t1));
+
+    } else {
+        for(size_t n = 0; n < variableClassCount; ++n) {
+            if(typeid(*cmd) == *variableClasses[n].type) {
+                const Value& initValue =
+                        static_pointer_cast<Variable>(cmd)->initValue();
+                Value initValue1 = value(initValue);
+                if(!initValue1.same(initValue))
+                    copy = variableClasses[n].make(cmd->name(), initValue1);
+                break;
+            }
+        }
+    }
+
+    m_commands[cmd.get()] = copy;
+    return copy;
+}
+
+Value TokenDetach::value(const Value& value)
+{
+    switch(value.type()) {
+        case Value::TOKEN:
+            return token(*value.get<Token::ptr>());
+        case Value::TOKEN_LIST: {
+            const Token::list& list = *value.get<Token::list>();
+            Token::list copy = tokens(list);
+            return copy == list ? value : Value(copy);
+        }
+        case Value::TOKEN_LIST_PTR:
+            return tokens(*value.get<Token::list_ptr>());
+        case Value::COMMAND:
+            return command(*value.get<Command::ptr>());
+        case Value::BOX: {
+            const Box* box = value.get<Box>();
+            Token::list_ptr list = tokens(box->value);
+            if(list == box->value)
+                return value;
+            Box copy(*box);
+            copy.value = list;
+            return copy;
+        }
+        default:
+            return value;
+    }
+}
+
+Node::ptr TokenDetach::node(const Node::ptr& node)
+{
+    Node::ptr copy(new Node(node->type()));
+    copy->setValue(value(node->valueAny()));
+    copy->tokens() = tokens(node->tokens());
+    BOOST_FOREACH(const Node::ChildrenList::value_type& child,
+                                                node->children())
+        copy->appendChild(child.first, this->node(child.second));
+    return copy;
+}
+
+} // namespace
+
+bool Format::save(std::ostream& os, const Format& base) const
+{
+    FormatWriter writer(os, *base.m_symbols);
+
+    os << FORMAT_MAGIC << ' ' << FORMAT_VERSION << '\n';
+    writer.writeTag("catcodes");
+    for(int ch = 0; ch < 256; ++ch)
+        writer.writeInt(m_catCodes[ch]);
+    writer.writeInt(m_endlinechar);
+    os << '\n';
+
+    // the names of both tables in alphabetical order, so the same
+    // format is always saved the same way
+    vector<const InternedString*> names;
+    BOOST_FOREACH(const SymbolTable::value_type& item, *m_symbols)
+        names.push_back(item.first);
+    BOOST_FOREACH(const SymbolTable::value_type& item, *base.m_symbols)
+        if(!m_symbols->count(item.first))
+            names.push_back(item.first);
+    std::sort(names.begin(), names.end(), nameLess);
+
+    const Value empty;
+    BOOST_FOREACH(const InternedString* name, names) {
+        const Value* v = namedValue(*m_symbols, name);
+        const Value* b = namedValue(*base.m_symbols, name);
+        const Value& value = v ? *v : empty;
+        const Value& baseValue = b ? *b : empty;
+        if(writer.sameValue(value, baseValue))
+            continue;
+
+        const Command::ptr* cmd = value.get<Command::ptr>();
+        if(cmd && *cmd && baseValue.is<Command::ptr>() &&
+                writer.primitiveName(*cmd) == name)
+            continue;
+
+        writer.writeTag("N");
+        writer.writeString(*name);
+        if(!writer.writeValue(value))
+            return false;
+        os << '\n';
+    }
+
+    for(size_t slot = 0; slot < m_registers->size(); ++slot) {
+        const Value& value = (*m_registers)[slot].second;
+        if(writer.sameValue(value, (*base.m_registers)[slot].second))
+            continue;
+
+        writer.writeTag("R");
+        writer.writeInt(int(slot));
+        if(!writer.writeValue(value))
+            return false;
+        os << '\n';
+    }
+
+    writer.writeTag("end");
+    os << '\n';
+    return bool(os);
+}
+
+bool Format::save(const string& fileName, const Format& base) const
+{
+    std::ofstream os(fileName.c_str(), std::ios::out | std::ios::binary);
+    return os && save(os, base);
+}
+
+Format::ptr Format::load(std::istream& is, const Format& base)
+{
+    FormatReader reader(is, *base.m_symbols);
+    shared_ptr<Format> format(new Format);
+    format->m_symbols.reset(new Parser::NamedSymbolTable(*base.m_symbols));
+    format->m_registers.reset(new Parser::SymbolTable(*base.m_registers));
+
+    string tag;
+    int version;
+    if(!reader.readTag(tag) || tag != FORMAT_MAGIC ||
+            !reader.readInt(version) || version != FORMAT_VERSION ||
+            !reader.readTag(tag) || tag != "catcodes")
+        return ptr();
+
+    for(int ch = 0; ch < 256; ++ch) {
+        int catCode;
+        if(!reader.readInt(catCode) || catCode < Token::CC_ESCAPE ||
+                catCode > Token::CC_INVALID)
+            return ptr();
+        format->m_catCodes[ch] = catCode;
+    }
+    if(!reader.readInt(format->m_endlinechar))
+        return ptr();
+
+    while(reader.readTag(tag)) {
+        if(tag == "end") {
+            return format;
+
+        } else if(tag == "N") {
+            string name;
+            Value value;
+            if(!reader.readString(name) || !reader.readValue(value))
+                return ptr();
+            Parser::namedSymbol(*format->m_symbols,
+                    InternedString::intern(name).get()).entry =
+                                                std::make_pair(0, value);
+
+        } else if(tag == "R") {
+            int slot;
+            Value value;
+            if(!reader.readInt(slot) || slot < 0 ||
+                    size_t(slot) >= format->m_registers->size() ||
+                    !reader.readValue(value))
+                return ptr();
+            (*format->m_registers)[slot] = std::make_pair(0, value);
+
+        } else {
+            return ptr();
+        }
+    }
+
+    return ptr();
+}
+
+Format::ptr Format::load(const string& fileName, const Format& base)
+{
+    std::ifstream is(fileName.c_str(), std::ios::in | std::ios::binary);
+    if(!is) return ptr();
+    return load(is, base);
+}
+
+size_t PreambleCache::preambleSize(const char* text, size_t size)
+{
+    static const char tag[] = "\\begin{document}";
+    const char* end = text + size;
+    for(const char* p = text;
+            (p = std::search(p, end, tag, tag + sizeof(tag) - 1)) != end; ++p) {
+        if(p == text || p[-1] == '\n' || p[-1] == '\r')
+            return p - text;
+    }
+    return string::npos;
+}
+
+size_t PreambleCache::hash(const char* text, size_t size)
+{
+    return boost::hash_range(text, text + size);
+}
+
+shared_ptr<const PreambleCache::Entry> PreambleCache::find(
+        const char* text, size_t size, const Format::ptr& initFormat)
+{
+    size_t h = hash(text, size);
+    std::list<shared_ptr<const Entry> >::iterator it = m_entries.begin();
+    for(; it != m_entries.end(); ++it) {
+        const Entry& entry = **it;
+        if(entry.hash == h && entry.text.size() == size &&
+                entry.initFormat == initFormat &&
+                std::equal(text, text + size, entry.text.begin())) {
+            m_entries.splice(m_entries.begin(), m_entries, it);
+            ++m_hits;
+            return m_entries.front();
+        }
+    }
+    ++m_misses;
+    return shared_ptr<const Entry>();
+}
+
+void PreambleCache::insert(const shared_ptr<Entry>& entry)
+{
+    if(m_maxSize == 0)
+        return;
+
+    // the tokens of the parse which saved the entry would keep all the
+    // blocks of its TokenArena and its files, so the entry gets copies
+    TokenDetach detach;
+    shared_ptr<Format> format(new Format(*entry->format));
+    format->m_symbols.reset(new Parser::NamedSymbolTable(*format->m_symbols));
+    BOOST_FOREACH(SymbolTable::value_type& item, *format->m_symbols)
+        item.second.entry.second = detach.value(item.second.entry.second);
+    format->m_registers.reset(new Parser::SymbolTable(*format->m_registers));
+    BOOST_FOREACH(Parser::SymbolTable::value_type& item, *format->m_registers)
+        item.second = detach.value(item.second);
+    entry->format = format;
+
+    entry->skipped = detach.tokens(entry->skipped);
+    BOOST_FOREACH(Node::ChildrenList::value_type& child, entry->nodes)
+        child.second = detach.node(child.second);
+    m_entries.push_front(entry);
+    if(m_entries.size() > m_maxSize)
+        m_entries.pop_back();
+}
+
+} // namespace texpp
+
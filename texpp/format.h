@@ -0,0 +1,155 @@
+/*  This file is part of texpp library.
+    Copyright (C) 2009 Vladimir Kuznetsov <ks.vladimir@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef __TEXPP_FORMAT_H
+#define __TEXPP_FORMAT_H
+
+#include <texpp/common.h>
+#include <texpp/parser.h>
+#include <texpp/lexer.h>
+
+#include <iosfwd>
+#include <list>
+
+namespace texpp {
+
+/**
+ * @brief snapshot of the parser state: the symbol and register tables,
+ *      the category codes and the endlinechar. It is created by
+ *      Parser::dumpFormat() and used to create parsers without running
+ *      base::initSymbols() and the preambles again.
+ *
+ *      The tables are shared by the format and the parsers created from
+ *      it until a parser changes them. The tokens in the tables are
+ *      reference counted without locking, so a format should be used by
+ *      one thread only: build or load one format per thread.
+ */
+class Format
+{
+public:
+    typedef shared_ptr<const Format> ptr;
+
+    int endlinechar() const { return m_endlinechar; }
+    int catCode(int ch) const { return m_catCodes[(unsigned char) ch]; }
+
+    /**
+     * @brief writes the entries which differ from the base format.
+     *      The base should be the format of a parser created without a
+     *      format: the primitives are written as references to it.
+     *      Token positions are not saved.
+     * @return false if the format contains a value which can not be saved
+     *      (for example an object set from python)
+     */
+    bool save(std::ostream& os, const Format& base) const;
+    bool save(const string& fileName, const Format& base) const;
+
+    /**
+     * @brief reads the format written by save() with the same base
+     * @return empty pointer if the format is corrupted
+     */
+    static ptr load(std::istream& is, const Format& base);
+    static ptr load(const string& fileName, const Format& base);
+
+protected:
+    Format() {}
+
+    shared_ptr<Parser::NamedSymbolTable> m_symbols;
+    shared_ptr<Parser::SymbolTable> m_registers;
+    int m_endlinechar;
+    unsigned char m_catCodes[256];
+
+    friend class Parser;
+    friend class PreambleCache;
+};
+
+/**
+ * @brief cache of the parser states at the \\begin{document} line, for
+ *      the documents which share the preamble (for example the ones made
+ *      from the same journal template). A parser with the cache looks up
+ *      the text of its main file above the first line starting with
+ *      \\begin{document}. When the same text was parsed before by a parser
+ *      created from the same format, the saved state and the preamble
+ *      nodes are restored instead of parsing the preamble again.
+ *
+ *      Preambles which read other files are not saved. Messages and
+ *      side effects (such as \\write) of the preamble are not repeated
+ *      on a hit. The entries keep copies of the preamble tokens, which
+ *      are reference counted without locking, so a cache should be used
+ *      by one thread only.
+ */
+class PreambleCache
+{
+public:
+    typedef shared_ptr<PreambleCache> ptr;
+
+    explicit PreambleCache(size_t maxSize = 16)
+        : m_maxSize(maxSize), m_hits(0), m_misses(0) {}
+
+    size_t size() const { return m_entries.size(); }
+    size_t maxSize() const { return m_maxSize; }
+    size_t hits() const { return m_hits; }
+    size_t misses() const { return m_misses; }
+    void clear() { m_entries.clear(); }
+
+    /**
+     * @brief returns the position of the first line starting with
+     *      \\begin{document}, or string::npos
+     */
+    static size_t preambleSize(const char* text, size_t size);
+
+protected:
+    struct Entry
+    {
+        size_t hash;
+        string text;                // the preamble
+        shared_ptr<string> fileName; // name of the document
+        Format::ptr initFormat;     // format of the parser or empty
+        Format::ptr format;         // state at the \begin{document} line
+        Lexer::Checkpoint checkpoint;
+        Token::list skipped;        // skipped tokens before \begin
+        Node::ChildrenList nodes;   // the preamble nodes of the document
+        vector<Parser::ConditionalInfo> conditionals;
+        Parser::Mode mode;
+        Parser::Mode prevMode;
+        Parser::Interaction interaction;
+        bool hasOutput;
+        size_t lineNo;
+    };
+
+    shared_ptr<const Entry> find(const char* text, size_t size,
+                                 const Format::ptr& initFormat);
+    /**
+     * @brief inserts the entry, replacing its tokens read by the parser
+     *      which saved it with copies which do not keep its files
+     */
+    void insert(const shared_ptr<Entry>& entry);
+
+    static size_t hash(const char* text, size_t size);
+
+    size_t m_maxSize;
+    size_t m_hits;
+    size_t m_misses;
+    std::list<shared_ptr<const Entry> > m_entries; // most recently used first
+
+    friend class Parser;
+};
+
+} // namespace texpp
+
+#endif
+
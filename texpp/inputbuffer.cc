@@ -0,0 +1,197 @@
+/*  This file is part of texpp library.
+    Copyright (C) 2009 Vladimir Kuznetsov <ks.vladimir@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <texpp/inputbuffer.h>
+
+#include <boost/foreach.hpp>
+
+#ifndef WINDOWS
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <map>
+#include <set>
+#include <vector>
+#include <mutex>
+#include <cstring>
+#else
+#include <fstream>
+#include <sstream>
+#endif
+
+namespace texpp {
+
+namespace {
+
+#ifndef WINDOWS
+typedef std::pair<dev_t, ino_t> FileKey;
+class MappedInputBuffer;
+
+// live mappings of each file
+std::map<FileKey, std::set<MappedInputBuffer*> > mappedFiles;
+std::mutex mappedFilesMutex;
+
+class MappedInputBuffer: public InputBuffer
+{
+public:
+    MappedInputBuffer(const char* data, size_t size, const FileKey& key)
+        : m_key(key), m_private(false) {
+        m_data = data;
+        m_size = size;
+        std::lock_guard<std::mutex> lock(mappedFilesMutex);
+        mappedFiles[m_key].insert(this);
+    }
+
+    ~MappedInputBuffer() {
+        // detachFile() must not find the buffer once its memory is gone
+        {
+            std::lock_guard<std::mutex> lock(mappedFilesMutex);
+            std::set<MappedInputBuffer*>& buffers = mappedFiles[m_key];
+            buffers.erase(this);
+            if(buffers.empty())
+                mappedFiles.erase(m_key);
+        }
+        ::munmap(const_cast<char*>(m_data), m_size);
+    }
+
+    // replaces the mapping of the file by an anonymous mapping at the same
+    // address holding a copy of the text: a truncation of the file drops
+    // even the private copies of its pages, but not anonymous memory.
+    // Called with mappedFilesMutex locked.
+    void makePrivate() {
+        if(m_private)
+            return;
+#ifdef __linux__
+        // the copy is moved over the file mapping at once, so the readers
+        // on other threads see either the file or the copy
+        void* data = ::mmap(NULL, m_size, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(data == MAP_FAILED)
+            return;
+        std::memcpy(data, m_data, m_size);
+        ::mprotect(data, m_size, PROT_READ);
+        if(::mremap(data, m_size, m_size, MREMAP_MAYMOVE | MREMAP_FIXED,
+                    const_cast<char*>(m_data)) == MAP_FAILED) {
+            ::munmap(data, m_size);
+            return;
+        }
+#else
+        // the buffer reads as zeros between the mmap and the memcpy,
+        // so no other thread may read it while the file is detached
+        std::vector<char> text(m_data, m_data + m_size);
+        void* data = ::mmap(const_cast<char*>(m_data), m_size,
+                    PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED, -1, 0);
+        if(data == MAP_FAILED)
+            return;
+        std::memcpy(data, &text[0], m_size);
+        ::mprotect(data, m_size, PROT_READ);
+#endif
+        m_private = true;
+    }
+
+protected:
+    FileKey m_key;
+    bool    m_private;
+};
+#endif
+
+} // namespace
+
+InputBuffer::ptr InputBuffer::mapFile(const string& fileName)
+{
+#ifndef WINDOWS
+    int fd = ::open(fileName.c_str(), O_RDONLY);
+    if(fd < 0)
+        return ptr();
+
+    struct stat st;
+    if(::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        ::close(fd);
+        return ptr();
+    }
+
+    // mmap refuses zero-length mappings
+    if(st.st_size == 0) {
+        ::close(fd);
+        return fromString(string());
+    }
+
+    void* addr = ::mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd); // the mapping keeps its own reference to the file
+
+    if(addr == MAP_FAILED)
+        return ptr();
+
+    // the lexer reads the file exactly once from the beginning to the end
+    ::madvise(addr, st.st_size, MADV_SEQUENTIAL);
+
+    return ptr(new MappedInputBuffer(static_cast<const char*>(addr),
+                    st.st_size, FileKey(st.st_dev, st.st_ino)));
+#else
+    std::ifstream file(fileName.c_str(), std::ios::in | std::ios::binary);
+    if(!file)
+        return ptr();
+
+    std::ostringstream data;
+    data << file.rdbuf();
+    return fromString(data.str());
+#endif
+}
+
+bool InputBuffer::isMapped(const string& fileName)
+{
+#ifndef WINDOWS
+    struct stat st;
+    if(::stat(fileName.c_str(), &st) != 0)
+        return false;
+
+    std::lock_guard<std::mutex> lock(mappedFilesMutex);
+    return mappedFiles.count(FileKey(st.st_dev, st.st_ino)) != 0;
+#else
+    return false;
+#endif
+}
+
+void InputBuffer::detachFile(const string& fileName)
+{
+#ifndef WINDOWS
+    struct stat st;
+    if(::stat(fileName.c_str(), &st) != 0)
+        return;
+
+    std::lock_guard<std::mutex> lock(mappedFilesMutex);
+    std::map<FileKey, std::set<MappedInputBuffer*> >::iterator it =
+                    mappedFiles.find(FileKey(st.st_dev, st.st_ino));
+    if(it != mappedFiles.end()) {
+        BOOST_FOREACH(MappedInputBuffer* buffer, it->second)
+            buffer->makePrivate();
+    }
+#endif
+}
+
+InputBuffer::ptr InputBuffer::fromString(const string& data)
+{
+    return ptr(new StringInputBuffer(data));
+}
+
+} // namespace texpp
+
@@ -0,0 +1,138 @@
+/*  This file is part of texpp library.
+    Copyright (C) 2009 Vladimir Kuznetsov <ks.vladimir@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef __TEXPP_INPUTBUFFER_H
+#define __TEXPP_INPUTBUFFER_H
+
+#include <texpp/common.h>
+
+#include <unordered_set>
+
+namespace texpp {
+
+/**
+ * @brief read-only block of memory holding the whole content of an
+ *      input file. Lexer splits it into lines in place, without copying
+ *      the text and without going through std::istream.
+ */
+class InputBuffer
+{
+public:
+    typedef shared_ptr<InputBuffer> ptr;
+
+    InputBuffer(): m_data(NULL), m_size(0) {}
+    virtual ~InputBuffer() {}
+
+    const char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+    /**
+     * @brief maps the file into memory (read-only)
+     * @return empty pointer if the file can not be opened
+     */
+    static ptr mapFile(const string& fileName);
+
+    /**
+     * @brief true if a buffer returned by mapFile() maps the file. Such
+     *      a file must not be truncated before detachFile(): reading the
+     *      mapping past the new end of the file kills the process with
+     *      SIGBUS.
+     */
+    static bool isMapped(const string& fileName);
+
+    /**
+     * @brief copies the text of the buffers returned by mapFile() for the
+     *      file into private memory, so the file can be truncated and
+     *      rewritten while they are still in use. Only the mappings made
+     *      by this process are affected. Outside of Linux the buffers must
+     *      not be read by other threads while the file is detached.
+     */
+    static void detachFile(const string& fileName);
+
+    /**
+     * @brief creates a buffer holding a copy of the string
+     */
+    static ptr fromString(const string& data);
+
+protected:
+    const char* m_data;
+    size_t      m_size;
+
+private:
+    InputBuffer(const InputBuffer&);
+    InputBuffer& operator=(const InputBuffer&);
+};
+
+/**
+ * @brief input buffer which owns its text. Text can be appended to the
+ *      end of it; the text which is already there never changes, but
+ *      data() may move while appending.
+ */
+class StringInputBuffer: public InputBuffer
+{
+public:
+    typedef shared_ptr<StringInputBuffer> ptr;
+
+    StringInputBuffer() { sync(); }
+    explicit StringInputBuffer(const string& data): m_string(data) { sync(); }
+
+    void append(const string& str) { m_string += str; sync(); }
+
+protected:
+    void sync() { m_data = m_string.data(); m_size = m_string.size(); }
+
+    string m_string;
+};
+
+/**
+ * @brief data shared by all tokens read from one input file: the file
+ *      name, the text of the file, and the values of the tokens.
+ *      Tokens refer to the text by position instead of holding copies
+ *      of it.
+ */
+class SourceFile
+{
+public:
+    typedef shared_ptr<SourceFile> ptr;
+
+    SourceFile(shared_ptr<string> name, shared_ptr<InputBuffer> buffer)
+        : m_name(name), m_buffer(buffer) {}
+
+    const string& name() const { return *m_name; }
+    const shared_ptr<string>& namePtr() const { return m_name; }
+
+    shared_ptr<InputBuffer> buffer() const { return m_buffer; }
+
+    /**
+     * @brief returns a string equal to str owned by this file; it stays
+     *      valid as long as the file exists
+     */
+    const string& intern(const string& str) {
+        return *m_values.insert(str).first;
+    }
+
+protected:
+    shared_ptr<string>          m_name;
+    shared_ptr<InputBuffer>     m_buffer;
+    std::unordered_set<string>  m_values;
+};
+
+} // namespace texpp
+
+#endif
+
@@ -19,30 +19,57 @@
 #include <texpp/lexer.h>
 
 #include <iostream>
+#include <cstring>
+
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#endif
 
 namespace texpp {
 
 Lexer::Lexer(const string& fileName, std::istream* file,
                 bool interactive, bool saveLines)
     : m_fileShared(), m_file(file),
-      m_fileName(new string(fileName)),
-      m_linePos(0), m_lineNo(0), m_charPos(0), m_charEnd(0),
+      m_fileName(new string(fileName)), m_bufferPos(0),
+      m_line(""), m_lineSize(0), m_lineTexBody(0), m_lineTexSize(0),
+      m_lineEndChar(-1),
+      m_linePos(0), m_lineNo(0), m_charPos(0), m_charEnd(0), m_charLen(1),
       m_state(ST_NEW_LINE), m_char(-1), m_catCode(Token::CC_NONE),
       m_interactive(interactive), m_saveLines(saveLines)
 {
     if(!m_file) { m_file = &std::cin; }
+    m_streamBuffer.reset(new StringInputBuffer);
+    m_buffer = m_streamBuffer;
     init();
 }
 
 Lexer::Lexer(const string& fileName, shared_ptr<std::istream> file,
                     bool interactive, bool saveLines)
     : m_fileShared(file), m_file(file.get()),
-      m_fileName(new string(fileName)),
-      m_linePos(0), m_lineNo(0), m_charPos(0), m_charEnd(0),
+      m_fileName(new string(fileName)), m_bufferPos(0),
+      m_line(""), m_lineSize(0), m_lineTexBody(0), m_lineTexSize(0),
+      m_lineEndChar(-1),
+      m_linePos(0), m_lineNo(0), m_charPos(0), m_charEnd(0), m_charLen(1),
       m_state(ST_NEW_LINE), m_char(-1), m_catCode(Token::CC_NONE),
       m_interactive(interactive), m_saveLines(saveLines)
 {
     if(!m_file) { m_file = &std::cin; }
+    m_streamBuffer.reset(new StringInputBuffer);
+    m_buffer = m_streamBuffer;
+    init();
+}
+
+Lexer::Lexer(const string& fileName, shared_ptr<InputBuffer> buffer,
+                    bool interactive, bool saveLines)
+    : m_fileShared(), m_file(NULL),
+      m_fileName(new string(fileName)), m_buffer(buffer), m_bufferPos(0),
+      m_line(""), m_lineSize(0), m_lineTexBody(0), m_lineTexSize(0),
+      m_lineEndChar(-1),
+      m_linePos(0), m_lineNo(0), m_charPos(0), m_charEnd(0), m_charLen(1),
+      m_state(ST_NEW_LINE), m_char(-1), m_catCode(Token::CC_NONE),
+      m_interactive(interactive), m_saveLines(saveLines)
+{
+    if(!m_buffer) { m_buffer = InputBuffer::fromString(string()); }
     init();
 }
 
@@ -52,6 +79,12 @@ Lexer::~Lexer()
 
 void Lexer::init()
 {
+    m_sourceFile.reset(new SourceFile(m_fileName, m_buffer));
+    m_tokenArena = new TokenArena;
+    m_fileId = m_tokenArena->addFile(m_sourceFile);
+    m_charClassesValid = false;
+    m_keepLine = false;
+
     m_endlinechar = '\r';
     for(int i=0; i<256; ++i)
         assignCatCode(i,Token::CC_OTHER);
@@ -69,6 +102,17 @@ void Lexer::init()
     assignCatCode('%',Token::CC_COMMENT);
 }
 
+void Lexer::setTokenArena(TokenArena::ptr arena)
+{
+    // when the file table of the arena is full, keep using own arena
+    unsigned int fileId = arena->addFile(m_sourceFile);
+    if(fileId) {
+        m_tokenArena = arena;
+        m_fileId = fileId;
+        m_names.clear(); // the names are held by the old arena
+    }
+}
+
 string Lexer::jobName() const
 {
     string jobname(*m_fileName);
@@ -82,11 +126,130 @@ string Lexer::jobName() const
     return jobname;
 }
 
-const string& Lexer::line(size_t n) const
+string_ref Lexer::line(size_t n) const
+{
+    if(!m_saveLines || n == 0 || n > m_lineNo)
+        return string_ref();
+
+    // index the lines which are already read up to the line n
+    const char* data = m_buffer->data();
+    if(m_lineStarts.empty())
+        m_lineStarts.push_back(0);
+    while(m_lineStarts.size() <= n) {
+        size_t pos = m_lineStarts.back();
+        m_lineStarts.push_back(pos + lineLength(data + pos,
+                                                data + m_bufferPos));
+    }
+
+    return string_ref(data + m_lineStarts[n-1],
+                      m_lineStarts[n] - m_lineStarts[n-1]);
+}
+
+Lexer::Checkpoint Lexer::checkpoint() const
+{
+    Checkpoint checkpoint;
+    checkpoint.lineNo = m_lineNo;
+    checkpoint.linePos = m_linePos + m_lineSize;
+    checkpoint.endlinechar = m_endlinechar;
+    for(int n = 0; n < 256; ++n)
+        checkpoint.catCodes[n] = m_catCodeTable[n];
+    return checkpoint;
+}
+
+bool Lexer::restore(const Checkpoint& checkpoint)
+{
+    if(m_streamBuffer || checkpoint.linePos > m_buffer->size())
+        return false;
+
+    m_endlinechar = checkpoint.endlinechar;
+    for(int n = 0; n < 256; ++n)
+        m_catCodeTable[n] = checkpoint.catCodes[n];
+    m_charClassesValid = false;
+
+    // pretend the line above the checkpoint is just finished
+    m_bufferPos = m_linePos = checkpoint.linePos;
+    m_lineNo = checkpoint.lineNo;
+    m_line = m_buffer->data() + m_bufferPos;
+    m_lineSize = m_lineTexBody = m_lineTexSize = 0;
+    m_lineEndChar = -1;
+    m_charPos = m_charEnd = 0;
+    m_charLen = 1;
+    m_char = -1;
+    m_catCode = Token::CC_NONE;
+    m_state = ST_EOL;
+
+    // the lines below the checkpoint may differ
+    if(m_lineStarts.size() > m_lineNo + 1)
+        m_lineStarts.resize(m_lineNo + 1);
+
+    return true;
+}
+
+Token::ptr Lexer::rebase(const Token::ptr& token, const string* fileName)
+{
+    if(!token)
+        return token;
+
+    const Token::Text* text = (token->m_flags & Token::HAS_TEXT) ?
+                token->m_data.text : NULL;
+
+    if(!token->m_fileId) {
+        // copies of the tokens of the file fileName keep its name
+        if(!fileName || !text || text->fileName.get() != fileName)
+            return token;
+        Token::ptr copy(new Token(*token));
+        copy->m_data.text->fileName = m_sourceFile->namePtr();
+        return copy;
+    }
+
+    // values which are not interned are owned by the file of the token
+    const InternedString* interned = (token->m_flags & Token::INTERNED) ?
+                token->interned() : text ? text->interned.get() : NULL;
+    const string* value = interned ? interned :
+                &m_sourceFile->intern(token->value());
+    if(interned)
+        m_tokenArena->holdName(interned);
+    Token::ptr copy = m_tokenArena->create(token->type(), token->catCode(),
+                value, token->m_linePos, token->m_lineNo,
+                token->m_charPos, token->m_charEnd,
+                token->isLastInLine(), m_fileId);
+    if(interned)
+        copy->m_flags |= Token::INTERNED;
+
+    if(text && text->hasSource) {
+        Token::Text* t = copy->text();
+        t->source = text->source;
+        t->hasSource = true;
+    }
+    return copy;
+}
+
+const InternedString* Lexer::internName(const string& name)
 {
-    static string EMPTY_LINE;
-    if(n-1 < m_lines.size()) return m_lines[n-1];
-    else return EMPTY_LINE;
+    std::unordered_map<string, const InternedString*>::iterator it =
+                                                    m_names.find(name);
+    if(it == m_names.end()) {
+        InternedString::ptr interned = InternedString::intern(name);
+        m_tokenArena->holdName(interned.get());
+        it = m_names.insert(std::make_pair(name, interned.get())).first;
+    }
+    return it->second;
+}
+
+size_t Lexer::lineLength(const char* begin, const char* end)
+{
+    // find '\n' or '\r' or '\r\n'
+    const char* eol = static_cast<const char*>(
+                        std::memchr(begin, '\n', end - begin));
+    const char* cr = static_cast<const char*>(
+                        std::memchr(begin, '\r', (eol ? eol : end) - begin));
+
+    if(cr) {
+        eol = (cr+1 != end && cr[1] == '\n') ? cr+2 : cr+1;
+    } else {
+        eol = eol ? eol+1 : end;
+    }
+    return eol - begin;
 }
 
 bool Lexer::nextLine()
@@ -99,57 +262,73 @@ bool Lexer::nextLine()
     m_char = -1;
     m_catCode = Token::CC_NONE;
 
-    m_linePos += m_lineOrig.size(); // increase m_linePos in current line length
-    m_lineOrig.clear();             // reset buffer for line string
-
-    // scan text from console if we use interactive mode
-    if(m_interactive && m_file == &std::cin) {
-        std::cout << "*";
-    }
+    m_linePos += m_lineSize;    // increase m_linePos in current line length
 
-    // Scan text line from tex-source file till '\n' or '\r' or '\r\n' symbol
-    while(true) {
-        // extract one character from the source file <m_file>
-        char c = m_file->get();
+    if(!m_streamBuffer) {
+        // Split the line in place
+        m_line = m_buffer->data() + m_bufferPos;
+        m_lineSize = lineLength(m_line,
+                        m_buffer->data() + m_buffer->size());
+        m_bufferPos += m_lineSize;
 
-        // check do some troublel with file?
-        if(!m_file->good()) // TODO: handle errors
-            break;
+    } else {
+        m_lineBuf.clear();          // reset buffer for line string
 
-        // push extracted symbol to variable m_lineOrig
-        m_lineOrig.push_back(c);
+        // scan text from console if we use interactive mode
+        if(m_interactive && m_file == &std::cin) {
+            std::cout << "*";
+        }
 
-        // push '\n' to m_lineOrig if c=='\r' and next after c char is '\n'
-        if(c == '\n') {
-            break;
-        } else if(c == '\r') {
-            if(m_file->peek() == '\n')  // if '\n' is next after '\r' ("\r\n")
-                m_lineOrig.push_back(char(m_file->get()));
-            break;
+        // Scan text line from tex-source file till '\n' or '\r' or '\r\n'
+        while(true) {
+            // extract one character from the source file <m_file>
+            char c = m_file->get();
+
+            // check do some troublel with file?
+            if(!m_file->good()) // TODO: handle errors
+                break;
+
+            // push extracted symbol to variable m_lineBuf
+            m_lineBuf.push_back(c);
+
+            // push '\n' to m_lineBuf if c=='\r' and next after c char is '\n'
+            if(c == '\n') {
+                break;
+            } else if(c == '\r') {
+                if(m_file->peek() == '\n')  // if '\n' is next after '\r'
+                    m_lineBuf.push_back(char(m_file->get()));
+                break;
+            }
         }
+
+        // keep the text for the tokens
+        m_streamBuffer->append(m_lineBuf);
+
+        m_line = m_buffer->data() + m_bufferPos;
+        m_lineSize = m_lineBuf.size();
+        m_bufferPos += m_lineSize;
     }
 
     // Check EOF. No input data mean texpp automat assesed end of file
-    if(m_lineOrig.empty()) {
-        m_lineTex.clear();
+    if(m_lineSize == 0) {
+        m_lineTexBody = m_lineTexSize = 0;
         return false;
     }
 
-    // save line; collect it in m_lines vector
-    if(m_saveLines)
-        m_lines.push_back(m_lineOrig);
-
     // find position before endlinechar ('\r' or '\n' )
-    size_t end = m_lineOrig.find_last_not_of(" \r\n");
-    // NOTE Bereziuk: meniningless expression?
-    if(end == string::npos) end = -1;
-
-    m_lineTex.reserve(end+2);
-    m_lineTex.assign(m_lineOrig, 0, end+1);
-
-    // append endlinechar to the end of m_lineTex
-    if(m_endlinechar >= 0 && m_endlinechar <= 255)
-        m_lineTex += char(m_endlinechar);
+    m_lineTexBody = m_lineSize;
+    while(m_lineTexBody > 0 && (m_line[m_lineTexBody-1] == ' ' ||
+                                m_line[m_lineTexBody-1] == '\r' ||
+                                m_line[m_lineTexBody-1] == '\n'))
+        --m_lineTexBody;
+
+    // append endlinechar to the end of the line
+    m_lineTexSize = m_lineTexBody;
+    m_lineEndChar = -1;
+    if(m_endlinechar >= 0 && m_endlinechar <= 255) {
+        m_lineEndChar = m_endlinechar;
+        ++m_lineTexSize;
+    }
 
     // Finalize
     ++m_lineNo;
@@ -160,7 +339,7 @@ bool Lexer::nextChar()
 {
     m_charPos = m_charEnd;      // move position to the end of previous char
 
-    if(m_charPos >= m_lineTex.size()) { // no more characters in line
+    if(m_charPos >= m_lineTexSize) { // no more characters in line
         // move to "End Of Line" state
         m_char = -1;
         m_catCode = Token::CC_EOL;
@@ -168,25 +347,25 @@ bool Lexer::nextChar()
     }
 
     // m_char - next character
-    m_char = (unsigned char) m_lineTex[m_charPos];
+    m_char = (unsigned char) texChar(m_charPos);
     // analysing what kind of symbol
     m_catCode = Token::CatCode(getCatCode(m_char));
 
     // NOTE Bereziuk: some magic here
-    if(m_catCode == Token::CC_SUPER && m_charPos+2 < m_lineTex.size() &&
-                                    m_lineTex[m_charPos+1] == m_char) {
-        if(m_charPos+3 < m_lineTex.size() &&
-                std::isxdigit(m_lineTex[m_charPos+2]) &&
-                std::isxdigit(m_lineTex[m_charPos+3]) &&
-                !std::isupper(m_lineTex[m_charPos+2]) &&
-                !std::isupper(m_lineTex[m_charPos+3])) {
-            char c1 = m_lineTex[m_charPos+2];
-            char c2 = m_lineTex[m_charPos+3];
+    if(m_catCode == Token::CC_SUPER && m_charPos+2 < m_lineTexSize &&
+                                    texChar(m_charPos+1) == char(m_char)) {
+        if(m_charPos+3 < m_lineTexSize &&
+                std::isxdigit(texChar(m_charPos+2)) &&
+                std::isxdigit(texChar(m_charPos+3)) &&
+                !std::isupper(texChar(m_charPos+2)) &&
+                !std::isupper(texChar(m_charPos+3))) {
+            char c1 = texChar(m_charPos+2);
+            char c2 = texChar(m_charPos+3);
             m_char = (isdigit(c1) ? c1-'0' : c1-'a'+10) * 16 +
                      (isdigit(c2) ? c2-'0' : c2-'a'+10);
             m_charEnd = m_charPos+4;
         } else {
-            m_char = (m_lineTex[m_charPos+2] + 64) & 0x7f;
+            m_char = (texChar(m_charPos+2) + 64) & 0x7f;
             m_charEnd = m_charPos+3;
         }
         m_catCode = Token::CatCode(getCatCode(m_char));
@@ -212,30 +391,111 @@ bool Lexer::nextChar()
     }
 
     // if actual character is last, include the rest of
-    if(m_charEnd >= m_lineTex.size())
-        m_charEnd = std::max(m_charEnd, m_lineOrig.size());
+    if(m_charEnd >= m_lineTexSize)
+        m_charEnd = std::max(m_charEnd, m_lineSize);
 
     return true;
 }
 
-inline Token::ptr Lexer::newToken(Token::Type type,
-                                const string& value)
+void Lexer::buildCharClass(CharClass& charClass, int catCode) const
+{
+    charClass.ranges = 0;
+    for(int ch = 0; ch < 256; ++ch) {
+        if(m_catCodeTable[ch] != catCode)
+            continue;
+
+        int& n = charClass.ranges;
+        if(ch >= 0x80) {
+            n = -1;
+            return;
+        } else if(n > 0 && charClass.hi[n-1] == ch-1) {
+            charClass.hi[n-1] = ch;
+        } else if(n < CharClass::MAX_RANGES) {
+            charClass.lo[n] = charClass.hi[n] = ch;
+            ++n;
+        } else {
+            n = -1;
+            return;
+        }
+    }
+}
+
+size_t Lexer::scanRun(size_t pos, Token::CatCode catCode)
 {
-    const size_t pos = std::min(m_charPos, m_lineOrig.size());
-    string tokValue(value);
-    if (tokValue.empty() && m_char >= 0) {
-        tokValue = m_lineOrig.substr(pos, m_charLen);
+    if(m_lineTexSize == 0)
+        return pos;
+
+    // the last character of the line is always read by nextChar()
+    const size_t end = std::min(m_lineTexBody, m_lineTexSize - 1);
+
+#if defined(__SSE2__) && defined(__GNUC__)
+    if(!m_charClassesValid) {
+        buildCharClass(m_letters, Token::CC_LETTER);
+        buildCharClass(m_spaces, Token::CC_SPACE);
+        m_charClassesValid = true;
     }
-    const Token::ptr &tok = Token::create(
-            type, m_catCode, tokValue,
-            m_lineOrig.substr(pos, m_charEnd - m_charPos),
+
+    const CharClass& charClass =
+            catCode == Token::CC_LETTER ? m_letters : m_spaces;
+
+    // check 16 characters at once against each range
+    if(charClass.ranges >= 0) {
+        while(pos + 16 <= end) {
+            __m128i chars = _mm_loadu_si128(
+                    reinterpret_cast<const __m128i*>(m_line + pos));
+            __m128i match = _mm_setzero_si128();
+            for(int n = 0; n < charClass.ranges; ++n) {
+                __m128i lo = _mm_set1_epi8(char(charClass.lo[n]));
+                __m128i hi = _mm_set1_epi8(char(charClass.hi[n]));
+                match = _mm_or_si128(match, _mm_and_si128(
+                    _mm_cmpeq_epi8(_mm_max_epu8(chars, lo), chars),
+                    _mm_cmpeq_epi8(_mm_min_epu8(chars, hi), chars)));
+            }
+            unsigned int mismatch = ~_mm_movemask_epi8(match) & 0xffff;
+            if(mismatch)
+                return pos + __builtin_ctz(mismatch);
+            pos += 16;
+        }
+    }
+#endif
+
+    // bytes starting multibyte characters have their own handling
+    // in nextChar(), as well as the ^^ sequences (not CC_LETTER or CC_SPACE)
+    while(pos < end) {
+        unsigned char ch = m_line[pos];
+        if(ch >= 0xc0 || m_catCodeTable[ch] != catCode)
+            break;
+        ++pos;
+    }
+    return pos;
+}
+
+const string* Lexer::lineValue(size_t pos, size_t n)
+{
+    m_valueBuf.assign(m_line + pos, n);
+    return &m_sourceFile->intern(m_valueBuf);
+}
+
+inline Token::ptr Lexer::newToken(Token::Type type,
+                                  const InternedString* value)
+{
+    const size_t pos = std::min(m_charPos, m_lineSize);
+    const size_t n = m_char >= 0 ? std::min(m_charLen, m_lineSize - pos) : 0;
+    if(!value && n <= 1)
+        value = n ? Token::staticValue(m_line[pos])
+                  : Token::staticValue(string());
+
+    Token::ptr token = m_tokenArena->create(type, m_catCode,
+                    value ? value : lineValue(pos, n),
                     m_linePos,
                     m_lineNo,
                     pos,
-                    std::min(m_charEnd, m_lineOrig.size()),
-                    m_charEnd >= m_lineTex.size(),
-                    m_fileName);
-    return tok;
+                    std::min(m_charEnd, m_lineSize),
+                    m_charEnd >= m_lineTexSize,
+                    m_fileId);
+    if(value)
+        token->m_flags |= Token::INTERNED;
+    return token;
 }
 
 Token::ptr Lexer::nextToken()
@@ -244,16 +504,19 @@ Token::ptr Lexer::nextToken()
         return Token::ptr();
 
     while(true) {
-        if(!nextChar())             // try read next symbol from m_lineTex
+        if(!nextChar())             // try read next symbol from the line
             m_state = ST_EOL;       // no more symbols in current line
 
         /////////// Handle ST_EOL
         if(m_state == ST_EOL) {
-            if(m_charPos < m_lineOrig.size()) {
-                m_charEnd = m_lineOrig.size();
+            if(m_charPos < m_lineSize) {
+                m_charEnd = m_lineSize;
                 return newToken(Token::TOK_SKIPPED);
             }
 
+            if(m_keepLine)
+                return Token::ptr();
+
             if(!nextLine()) {       // read next line
                 m_state = ST_EOF;   // move to End Of File state if no text more
                 return Token::ptr();
@@ -282,7 +545,8 @@ Token::ptr Lexer::nextToken()
                     m_charEnd = m_charPos;
                 } else {
                     m_state = ST_EOL;
-                    return newToken(Token::TOK_CONTROL, "\\par");
+                    return newToken(Token::TOK_CONTROL,
+                                    Token::staticValue("\\par"));
                 }
             }
             //// CC_IGNORED
@@ -303,12 +567,10 @@ Token::ptr Lexer::nextToken()
             else {
                 Token::ptr token = newToken(Token::TOK_SKIPPED);
                 // skip all spaces
+                m_charEnd = scanRun(m_charEnd, Token::CC_SPACE);
                 while(nextChar() && m_catCode == Token::CC_SPACE) {}
                 m_charEnd = m_charPos;
-                token->setCharEnd(std::min(m_charEnd, m_lineOrig.size()));
-                token->setSource(m_lineOrig.substr(
-                    std::min(token->charPos(), m_lineOrig.size()),
-                    token->charEnd() - token->charPos()));
+                token->setCharEnd(std::min(m_charEnd, m_lineSize));
                 return token;
             }
         }
@@ -322,14 +584,21 @@ Token::ptr Lexer::nextToken()
 
             //// CC_ESCAPE
             if(m_catCode == Token::CC_ESCAPE) {
-                Token::ptr token = newToken(Token::TOK_CONTROL, "\\");
-                string value("\\");
+                Token::ptr token = newToken(Token::TOK_CONTROL,
+                                    Token::staticValue('\\'));
+                string& value = m_valueBuf;
+                value.assign(1, '\\');
                 // combines the escape and all following letters
                 // into a control world
                 if(nextChar()) {
                     value += char(m_char);
 
                     if(m_catCode == Token::CC_LETTER) {
+                        // copy plain letters at once
+                        size_t end = scanRun(m_charEnd, Token::CC_LETTER);
+                        value.append(m_line + m_charEnd, end - m_charEnd);
+                        m_charEnd = end;
+
                         while(nextChar() && m_catCode == Token::CC_LETTER)
                             value += char(m_char);
 
@@ -341,11 +610,8 @@ Token::ptr Lexer::nextToken()
                         m_state = ST_SKIP_SPACES;
                     }
                     // init token by this control world
-                    token->setValue(value);
-                    token->setCharEnd(std::min(m_charEnd, m_lineOrig.size()));
-                    token->setSource(m_lineOrig.substr(
-                        std::min(token->charPos(), m_lineOrig.size()),
-                        token->charEnd() - token->charPos()));
+                    token->m_data.value = internName(value);
+                    token->setCharEnd(std::min(m_charEnd, m_lineSize));
                 }
 
                 return token;
@@ -353,18 +619,20 @@ Token::ptr Lexer::nextToken()
             //// CC_ACTIVE
             else if(m_catCode == Token::CC_ACTIVE) {
                 return newToken(Token::TOK_CONTROL,
-                                    string("`") + char(m_char));
+                        Token::staticValue(string("`") + char(m_char)));
             }
             //// CC_SPACE
             else if(m_catCode == Token::CC_SPACE) {
                 m_state = ST_SKIP_SPACES;
-                return newToken(Token::TOK_CHARACTER, string(1, ' '));
+                return newToken(Token::TOK_CHARACTER,
+                                    Token::staticValue(' '));
             }
             //// CC_EOL
             else if(m_catCode == Token::CC_EOL) {
                 m_state = ST_EOL;
                 m_catCode = Token::CC_SPACE;
-                return newToken(Token::TOK_CHARACTER, string(1, ' '));
+                return newToken(Token::TOK_CHARACTER,
+                                    Token::staticValue(' '));
             }
             //// CC_COMMENT
             else if(m_catCode == Token::CC_COMMENT) {
@@ -391,5 +659,137 @@ Token::ptr Lexer::nextToken()
     }
 }
 
-} // namespace texpp
+const InternedString* Lexer::skipToControl(LinePosition& before)
+{
+    while(m_state != ST_EOF) {
+        if(m_state == ST_EOL || !nextChar()) {
+            if(!nextLine()) {
+                m_state = ST_EOF;
+                break;
+            }
+            m_state = ST_NEW_LINE;
+            continue;
+        }
+
+        switch(m_catCode) {
+        case Token::CC_ESCAPE: {
+            before.state = ST_MIDDLE;
+            before.charEnd = m_charPos;
+            before.charLen = m_charLen;
+
+            // the same control sequence as nextToken() reads
+            string& value = m_valueBuf;
+            value.assign(1, '\\');
+            m_state = ST_MIDDLE;
+            if(nextChar()) {
+                value += char(m_char);
+                if(m_catCode == Token::CC_LETTER) {
+                    size_t end = scanRun(m_charEnd, Token::CC_LETTER);
+                    value.append(m_line + m_charEnd, end - m_charEnd);
+                    m_charEnd = end;
+
+                    while(nextChar() && m_catCode == Token::CC_LETTER)
+                        value += char(m_char);
+
+                    m_state = ST_SKIP_SPACES;
+                    m_charEnd = m_charPos;
+                } else if(m_catCode == Token::CC_SPACE) {
+                    m_state = ST_SKIP_SPACES;
+                }
+            }
+            return internName(value);
+        }
+
+        case Token::CC_ACTIVE:
+            before.state = ST_MIDDLE;
+            before.charEnd = m_charPos;
+            before.charLen = m_charLen;
+            m_state = ST_MIDDLE;
+            return Token::staticValue(string("`") + char(m_char));
+
+        case Token::CC_EOL:
+            if(m_state == ST_NEW_LINE) {
+                before.state = ST_NEW_LINE;
+                before.charEnd = m_charPos;
+                before.charLen = m_charLen;
+                m_state = ST_EOL;
+                return Token::staticValue("\\par");
+            }
+            m_state = ST_EOL;
+            break;
+
+        case Token::CC_COMMENT:
+            m_state = ST_EOL;
+            break;
+
+        case Token::CC_INVALID:
+            before.state = m_state;
+            before.charEnd = m_charPos;
+            before.charLen = m_charLen;
+            rewind(before);
+            return NULL;
+
+        case Token::CC_SPACE:
+            if(m_state == ST_MIDDLE)
+                m_state = ST_SKIP_SPACES;
+            break;
+
+        case Token::CC_IGNORED:
+            break;
+
+        case Token::CC_LETTER:
+            m_charEnd = scanRun(m_charEnd, Token::CC_LETTER);
+            m_state = ST_MIDDLE;
+            break;
+
+        default:
+            m_state = ST_MIDDLE;
+            break;
+        }
+    }
+    return NULL;
+}
 
+Token::ptr Lexer::skippedToken(const TextPosition& begin)
+{
+    size_t end = m_linePos + std::min(m_charEnd, m_lineSize);
+    if(end <= begin.linePos + begin.charPos)
+        return Token::ptr();
+
+    Token::ptr token = m_tokenArena->create(Token::TOK_SKIPPED,
+                    Token::CC_NONE, Token::staticValue(string()),
+                    begin.linePos, begin.lineNo, begin.charPos,
+                    end - begin.linePos, false, m_fileId);
+    token->m_flags |= Token::INTERNED;
+    return token;
+}
+
+size_t Lexer::nextTokens(Token::list& tokens, size_t n,
+                            vector<LinePosition>* positions)
+{
+    size_t count = 0;
+    for(; count < n; ++count) {
+        // only the first token can be read from a new line
+        m_keepLine = count > 0;
+        Token::ptr token = nextToken();
+        if(!token)
+            break;
+
+        tokens.push_back(token);
+        if(positions) {
+            LinePosition position = { m_state, m_charEnd, m_charLen };
+            positions->push_back(position);
+        }
+    }
+    m_keepLine = false;
+    return count;
+}
+
+void Lexer::rewind(const LinePosition& position)
+{
+    m_state = State(position.state);
+    m_charEnd = position.charEnd;
+    m_charLen = position.charLen;
+}
+
+} // namespace texpp
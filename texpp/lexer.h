@@ -21,8 +21,10 @@
 
 #include <texpp/common.h>
 #include <texpp/token.h>
+#include <texpp/inputbuffer.h>
 
 #include <istream>
+#include <unordered_map>
 
 namespace texpp {
 
@@ -36,6 +38,14 @@ public:
                 bool interactive = false, bool saveLines = false);
     Lexer(const string& fileName, shared_ptr<std::istream> file,
                 bool interactive = false, bool saveLines = false);
+
+    /**
+     * @brief creates a lexer reading directly from the memory buffer
+     *      (for example a memory-mapped file). Lines are split in place:
+     *      there are no per-character stream calls and no line copies.
+     */
+    Lexer(const string& fileName, shared_ptr<InputBuffer> buffer,
+                bool interactive = false, bool saveLines = false);
     ~Lexer();
 
     /**
@@ -97,6 +107,131 @@ public:
      */
     Token::ptr nextToken();
 
+    /**
+     * @brief position of the lexer between two tokens of the same line
+     */
+    struct LinePosition {
+        int     state;
+        size_t  charEnd;
+        size_t  charLen;
+    };
+
+    /**
+     * @brief reads up to n tokens at once and appends them to tokens.
+     *      Only the first token can start a new line, so the batch never
+     *      goes past the end of the line. The tokens are lexed with the
+     *      category codes and endlinechar set at the moment of the call;
+     *      when they change, the tokens which are not used yet should be
+     *      dropped and the lexer rewound to the position after the last
+     *      used one.
+     * @param positions if not NULL, receives the position after each token
+     * @return number of tokens read; 0 at the end of file
+     */
+    size_t nextTokens(Token::list& tokens, size_t n,
+                        vector<LinePosition>* positions = NULL);
+
+    /**
+     * @brief reads the rest of the current line (or the next line when
+     *      the current one is finished), see nextTokens()
+     */
+    size_t tokenizeLine(Token::list& tokens,
+                        vector<LinePosition>* positions = NULL) {
+        return nextTokens(tokens, size_t(-1), positions);
+    }
+
+    /**
+     * @brief moves the lexer back to the position returned by nextTokens()
+     *      for one of the tokens of the current line
+     */
+    void rewind(const LinePosition& position);
+
+    /**
+     * @brief position of the lexer in the file, see skippedToken()
+     */
+    struct TextPosition {
+        size_t  linePos;
+        size_t  lineNo;
+        size_t  charPos;
+    };
+    TextPosition textPosition() const {
+        TextPosition position = { m_linePos, m_lineNo, m_charEnd };
+        return position;
+    }
+
+    /**
+     * @brief skips the text up to the next control sequence (including
+     *      active characters and the \\par of an empty line) without
+     *      creating tokens for it. Used to skip the false branches of
+     *      conditionals, where only the control sequences matter.
+     * @param before receives the position before the control sequence,
+     *      to rewind() to it if it has to be lexed by nextToken()
+     * @return name of the control sequence, or NULL at the end of file
+     *      and before invalid characters (which nextToken() reports)
+     */
+    const InternedString* skipToControl(LinePosition& before);
+
+    /**
+     * @brief creates a skipped token for the text from begin up to the
+     *      current position; the text may span several lines
+     * @return empty pointer if there is no text
+     */
+    Token::ptr skippedToken(const TextPosition& begin);
+
+    /**
+     * @brief lexer state at the beginning of a line: everything needed to
+     *      continue tokenization from this line without reading the lines
+     *      above it
+     */
+    struct Checkpoint {
+        size_t  lineNo;     // number of the lines above
+        size_t  linePos;    // position of the line in the file
+        int     endlinechar;
+        unsigned char catCodes[256];
+    };
+
+    /**
+     * @brief returns the checkpoint for the beginning of the next line.
+     *      Tokens of the current line which are not read yet are not
+     *      part of the checkpoint, so it should be taken after the last
+     *      token of the line (see Token::isLastInLine())
+     */
+    Checkpoint checkpoint() const;
+
+    /**
+     * @brief continues tokenization from the checkpoint. The checkpoint
+     *      may be taken from another lexer, for example one reading an
+     *      older version of the same file: only the text above the
+     *      checkpoint must be the same.
+     * @return false if the lexer reads from a stream (streams can not
+     *      be repositioned) or the checkpoint is past the end of input
+     */
+    bool restore(const Checkpoint& checkpoint);
+
+    /**
+     * @brief returns a copy of the token read by another lexer from a file
+     *      with the same text, as if the token was read by this lexer.
+     *      Copies of the tokens read from the file named fileName move
+     *      to the file of this lexer, other tokens which are not read
+     *      from a file are returned as they are.
+     */
+    Token::ptr rebase(const Token::ptr& token, const string* fileName = NULL);
+
+    /**
+     * @brief true if the token was read by this lexer
+     */
+    bool isOwnToken(const Token::ptr& token) const {
+        return token && token->sourceFile() == m_sourceFile.get();
+    }
+
+    /**
+     * @brief true if rebase() can move the token to this lexer: the token
+     *      is read by this lexer or it is not read from a file at all
+     */
+    bool isRebasable(const Token::ptr& token) const {
+        return token && (!token->sourceFile() ||
+                         token->sourceFile() == m_sourceFile.get());
+    }
+
     bool interactive() const { return m_interactive; }
 
     string jobName() const;
@@ -107,16 +242,37 @@ public:
     // fileName pointer getter
     shared_ptr<string> fileNamePtr() const { return m_fileName; }
 
+    // source file shared by all tokens of this lexer
+    shared_ptr<SourceFile> sourceFile() const { return m_sourceFile; }
+
+    // whole text of the file; empty for lexers reading from a stream
+    shared_ptr<InputBuffer> buffer() const {
+        return m_streamBuffer ? shared_ptr<InputBuffer>() : m_buffer;
+    }
+
+    // arena where the tokens are allocated (shared by all lexers of a parse)
+    TokenArena::ptr tokenArena() const { return m_tokenArena; }
+    void setTokenArena(TokenArena::ptr arena);
+
     size_t linePos() const { return m_linePos; }
     size_t lineNo() const { return m_lineNo; }
-    const string& line() const { return m_lineOrig; }
-    const string& line(size_t n) const;
+    string line() const { return string(m_line, m_lineSize); }
+
+    /**
+     * @brief returns the text of the line n (counting from 1) as it is in
+     *      the source, if the line is already read and the lexer was
+     *      created with saveLines. The view is valid as long as the lexer.
+     */
+    string_ref line(size_t n) const;
 
     int endlinechar() const { return m_endlinechar; }
     void setEndlinechar(int endlinechar) { m_endlinechar = endlinechar; }
 
     int getCatCode(int ch) const { return m_catCodeTable[(unsigned char) ch]; }
-    void assignCatCode(int ch, int code) { m_catCodeTable[ch] = code; }
+    void assignCatCode(int ch, int code) {
+        m_catCodeTable[ch] = code;
+        m_charClassesValid = false;
+    }
 
 protected:
     /**
@@ -124,28 +280,81 @@ protected:
      */
     void init();
 
-    Token::ptr newToken(Token::Type type,
-                    const string& value = string());
+    /**
+     * @brief returns character n of the current line as TeX sees it:
+     *      trailing spaces and end of line are replaced by the endlinechar
+     */
+    char texChar(size_t n) const {
+        return n < m_lineTexBody ? m_line[n] : char(m_lineEndChar);
+    }
+
+    /**
+     * @brief value of the token made of n bytes of the current line
+     *      starting from pos, owned by the file
+     */
+    const string* lineValue(size_t pos, size_t n);
+
+    /**
+     * @brief creates the token at the current position; without the
+     *      value the token takes the current character as its value
+     */
+    Token::ptr newToken(Token::Type type, const InternedString* value = NULL);
 
     /**
      * @brief read new line from source file <m_file>;
      *      reset position counters m_charPos, m_charEnd;
      *      increase counter m_linePos by length of current line;
-     *      fill m_lineOrig string by string from line or console;
-     *      fill m_lineTex string by string from line or console with modified
-     *          endlinechar;
+     *      point m_line to the line from buffer, file or console;
+     *      compute the length of the line as TeX sees it (m_lineTexSize);
      *      increment line number counter m_lineNo
      * @return false if end of file; true otherwise
      */
     bool nextLine();
 
     /**
-     * @brief read next symbol from m_lineTex following to the m_charEnd.
+     * @brief length of the line starting at begin including the end of
+     *      line characters ('\n', '\r' or "\r\n")
+     */
+    static size_t lineLength(const char* begin, const char* end);
+
+    /**
+     * @brief read next symbol from the current line following to the
+     *      m_charEnd.
      *      Determines category code for this symbol
      * @return false if end of line; true - otherwise
      */
     bool nextChar();
 
+    /**
+     * @brief finds the end of the run of one-byte characters with category
+     *      code catCode (CC_LETTER or CC_SPACE) starting at pos in the
+     *      current line. Stops before the last character of the line, so
+     *      nextChar() can continue from the returned position.
+     * @return position of the first character not in the run
+     */
+    size_t scanRun(size_t pos, Token::CatCode catCode);
+
+    /**
+     * @brief set of characters with the same category code as a list of
+     *      ranges of ASCII codes, for the vectorized scanRun()
+     */
+    struct CharClass {
+        enum { MAX_RANGES = 4 };
+        int ranges;     // number of ranges, -1 if the set is too complex
+        unsigned char lo[MAX_RANGES];
+        unsigned char hi[MAX_RANGES];
+    };
+
+    void buildCharClass(CharClass& charClass, int catCode) const;
+
+    /**
+     * @brief InternedString::intern() of the name of a control sequence.
+     *      The names seen by the lexer are remembered and held by the
+     *      token arena, so the global table is locked once per name
+     *      instead of once per token.
+     */
+    const InternedString* internName(const string& name);
+
 protected:
     enum State {
         ST_EOF = 0,         // end of file
@@ -160,9 +369,26 @@ protected:
     std::istream*   m_file;         // TeX source file
     shared_ptr<string> m_fileName;  // source file name
 
-    string  m_lineOrig; // current line as in source
-    string  m_lineTex;  // current line with modified the last char. Here '/n'
-                        // '/r' globbing by m_endlinechar,
+    shared_ptr<InputBuffer> m_buffer;   // TeX source in memory
+    size_t  m_bufferPos;    // position of the next line in m_buffer
+    shared_ptr<StringInputBuffer> m_streamBuffer; // m_buffer filled from
+                                                  // m_file line by line
+    shared_ptr<SourceFile> m_sourceFile; // data shared by tokens
+    TokenArena::ptr m_tokenArena;   // storage for the tokens
+    unsigned int    m_fileId;       // index of m_sourceFile in m_tokenArena
+
+    string  m_lineBuf;  // storage for the line read from m_file
+    string  m_valueBuf; // storage for the name of control sequence
+    std::unordered_map<string, const InternedString*> m_names;
+                        // the control sequences seen, see internName()
+
+    const char* m_line; // current line as in source
+    size_t  m_lineSize;     // length of current line
+    size_t  m_lineTexBody;  // length of current line without trailing
+                            // spaces and end of line characters
+    size_t  m_lineTexSize;  // length of current line as TeX sees it,
+                            // with the endlinechar
+    int     m_lineEndChar;  // endlinechar appended to the current line
 
     size_t  m_linePos;  // the total number of characters above current line
     size_t  m_lineNo;   // current line number
@@ -178,11 +404,18 @@ protected:
                             // text
     int     m_catCodeTable[256];    // lookup table for finding char->CatCode
 
+    CharClass m_letters;    // characters with CC_LETTER
+    CharClass m_spaces;     // characters with CC_SPACE
+    bool    m_charClassesValid; // m_letters and m_spaces match m_catCodeTable
+
     bool    m_interactive;  // true in interactive mode( run program without
                             // arguments)
-    bool    m_saveLines;    // trigger save/don`t processed lines into m_lines
+    bool    m_saveLines;    // trigger keep processed lines for line(n)
+    bool    m_keepLine;     // nextToken() returns no token instead of
+                            // reading a new line (used by nextTokens())
 
-    vector<string> m_lines; // massive of already cinsidered text lines
+    // start positions of the lines in m_buffer, built on demand by line(n)
+    mutable vector<uint32_t> m_lineStarts;
 };
 
 } // namespace
@@ -58,7 +58,7 @@ string Logger::tokenLines(Parser& parser, Token::ptr token) const
 
     // if the parsing file is the same as for token
     if(token->fileName() == parser.lexer()->fileName()) {
-        const string& line = parser.lexer()->line(token->lineNo());
+        const string line = parser.lexer()->line(token->lineNo()).to_string();
         if(!line.empty()) {
             string line1 = line.substr(0, token->charEnd());
             if(!line1.empty() && line1[line1.size()-1] == '\n')
@@ -89,7 +89,7 @@ bool ConsoleLogger::log(Level level, const string& message,
                             Parser& parser, Token::ptr token)
 {
     /*
-    if(level <= TRACING && parser.symbol("tracingonline", int(0)) <= 0)
+    if(level <= TRACING && parser.tracingonline() <= 0)
         return true;
     */
 
@@ -119,7 +119,7 @@ bool ConsoleLogger::log(Level level, const string& message,
     }
 
     std::ostringstream r1;
-    int newlinechar = parser.symbol("newlinechar", int(0));
+    int newlinechar = parser.newlinechar();
     BOOST_FOREACH(unsigned char ch, r.str()) {
         if(ch == '\n' || ch == newlinechar) {
             r1 << '\n';
@@ -20,10 +20,10 @@
 #define __TEXPP_LOGGER_H
 
 #include <texpp/common.h>
+#include <texpp/token.h>
 
 namespace texpp {
 
-class Token;
 class Parser;
 
 class Logger
@@ -52,7 +52,7 @@ public:
      *         if source file for parcer and token is the same
      *  return empty string if token is invalid
      */
-    string tokenLines(Parser& parser, shared_ptr<Token> token) const;
+    string tokenLines(Parser& parser, Token::ptr token) const;
 
     /**
      * log() interface;
@@ -60,13 +60,13 @@ public:
      * text format depend on <level> variable
      */
     virtual bool log(Level level, const string& message,
-                    Parser& parser, shared_ptr<Token> token) = 0;
+                    Parser& parser, Token::ptr token) = 0;
 };
 
 class NullLogger: public Logger
 {
 public:
-    bool log(Level, const string&, Parser&, shared_ptr<Token>) { return true; }
+    bool log(Level, const string&, Parser&, Token::ptr) { return true; }
 };
 
 class ConsoleLogger: public Logger
@@ -75,7 +75,7 @@ public:
     ConsoleLogger(): m_linePos(0) {}
     ~ConsoleLogger();
     bool log(Level level, const string& message,
-                Parser& parser, shared_ptr<Token> token);
+                Parser& parser, Token::ptr token);
 protected:
     unsigned int m_linePos;
 };
@@ -19,6 +19,8 @@
 #include <texpp/parser.h>
 #include <texpp/logger.h>
 #include <texpp/kpsewhich.h>
+#include <texpp/prefetcher.h>
+#include <texpp/format.h>
 
 #include <texpp/base/base.h>
 #include <texpp/base/show.h>
@@ -39,6 +41,7 @@
 #include <sstream>
 #include <iomanip>
 #include <climits>
+#include <cctype>
 #include <cassert>
 #include <iterator>
 #include <unistd.h>
@@ -59,6 +62,9 @@ const texpp::string modeNames[] = {
     "display math",
     "unknown"
 };
+
+// maximal number of tokens read from the lexer at once
+const size_t LEXER_BATCH_SIZE = 64;
 } // namespace
 
 namespace texpp {
@@ -74,8 +80,8 @@ using base::Dimen;
 const string& Node::valueString() const
 {
     static const string empty;
-    if(m_value.type() != typeid(string)) return empty;
-    else return *unsafe_any_cast<string>(&m_value);
+    const string* value = m_value.get<string>();
+    return value ? *value : empty;
 }
 
 /** return child node named 'name' from m_children node list
@@ -111,7 +117,7 @@ Token::ptr Node::lastToken()
 string Node::repr() const
 {
     return "Node(" + reprString(m_type)
-        + (m_value.empty() ? "" : ", " + reprAny(m_value))
+        + (m_value.empty() ? "" : ", " + m_value.repr())
         + ")";
 }
 
@@ -136,8 +142,10 @@ string Node::source(const string& fileName) const
 {
     string str;
     BOOST_FOREACH(Token::ptr token, m_tokens) {
-        if(fileName.empty() || token->fileName() == fileName)
-            str += token->source();
+        if(fileName.empty())
+            token->appendSource(str);
+        else
+            token->appendSource(str, fileName);
     }
     typedef pair<string, Node::ptr> C;
     BOOST_FOREACH(C c, m_children) {
@@ -146,6 +154,36 @@ string Node::source(const string& fileName) const
     return str;
 }
 
+namespace {
+
+// the sources of the expansions are split by the files of their tokens
+void appendSources(const Token::ptr& token,
+                   unordered_map<shared_ptr<string>,string>& src,
+                   shared_ptr<string>& cur_file, string*& cur_str)
+{
+    if(const Token::list* tokens = token->sourceTokens()) {
+        BOOST_FOREACH(const Token::ptr& t, *tokens)
+            appendSources(t, src, cur_file, cur_str);
+        return;
+    }
+    if(!cur_str || token->fileNamePtr() != cur_file) {
+        cur_file = token->fileNamePtr();
+        cur_str = &(src[cur_file]);
+    }
+    token->appendSource(*cur_str);
+}
+
+// the tokens of the node and its children in the order of Node::source()
+void appendNodeTokens(const Node& node, Token::list& tokens)
+{
+    tokens.insert(tokens.end(), node.tokens().begin(), node.tokens().end());
+    BOOST_FOREACH(const Node::ChildrenList::value_type& child,
+                                                node.children())
+        appendNodeTokens(*child.second, tokens);
+}
+
+} // namespace
+
 unordered_map<shared_ptr<string>,string> Node::sources() const
 {
     unordered_map<shared_ptr<string>,string> src;
@@ -153,13 +191,8 @@ unordered_map<shared_ptr<string>,string> Node::sources() const
     string* cur_str = 0;
     shared_ptr<string> cur_file;
 
-    BOOST_FOREACH(Token::ptr token, m_tokens) {
-        if(!cur_str || token->fileNamePtr() != cur_file) {
-            cur_file = token->fileNamePtr();
-            cur_str = &(src[cur_file]);
-        }
-        *cur_str += token->source();
-    }
+    BOOST_FOREACH(Token::ptr token, m_tokens)
+        appendSources(token, src, cur_file, cur_str);
     typedef pair<string, Node::ptr> C;
     BOOST_FOREACH(C c, m_children) {
         unordered_map<shared_ptr<string>,string> sub_src(c.second->sources());
@@ -195,13 +228,14 @@ shared_ptr<string> Node::oneFile() const
 
 bool Node::isOneFile() const
 {
-    shared_ptr<string> cur_file;
-    BOOST_FOREACH(Token::ptr token, m_tokens) {
+    const string* cur_file = NULL;
+    BOOST_FOREACH(const Token::ptr& token, m_tokens) {
+        const string* file = token->fileNamePtr().get();
         if(!cur_file) {
-            if(!token->fileNamePtr())
+            if(!file)
                 return false;
-            cur_file = token->fileNamePtr();
-        } else if(cur_file != token->fileNamePtr()) {
+            cur_file = file;
+        } else if(cur_file != file) {
             return false;
         }
     }
@@ -217,7 +251,7 @@ std::pair<size_t, size_t> Node::sourcePos() const
 {
     std::pair<size_t, size_t> pos(Token::npos, Token::npos);
     // find node start and end positin in the inner tokens
-    BOOST_FOREACH(Token::ptr token, m_tokens) {
+    BOOST_FOREACH(const Token::ptr& token, m_tokens) {
         if(token->lineNo() != 0) {
             if(pos.first == Token::npos)
                 pos.first = token->linePos() + token->charPos();
@@ -238,7 +272,16 @@ std::pair<size_t, size_t> Node::sourcePos() const
 }
 
 Parser::Parser(shared_ptr<Bundle> bundle, shared_ptr<Logger> logger)
+        : Parser(bundle, shared_ptr<const Format>(), logger)
+{
+}
+
+Parser::Parser(shared_ptr<Bundle> bundle, shared_ptr<const Format> format,
+               shared_ptr<Logger> logger)
         : m_logger(logger), m_bundle(bundle), m_groupLevel(0),
+          m_escapechar(0), m_endlinechar(0), m_newlinechar(0),
+          m_globaldefs(0), m_tracingonline(0), m_tracingmacros(0),
+          m_tracingcommands(0), m_tracingrestores(0), m_spacefactor(0),
           m_end(false), m_endinput(false), m_endinputNow(false),
           m_lineNo(1), m_mode(NULLMODE), m_prevMode(NULLMODE),
           m_hasOutput(false), m_currentGroupType(GROUP_DOCUMENT),
@@ -246,20 +289,46 @@ Parser::Parser(shared_ptr<Bundle> bundle, shared_ptr<Logger> logger)
           m_interaction(ERRORSTOPMODE)
 {
     string fileName = bundle->get_mainfile_name();
-    shared_ptr<std::istream> file = bundle->get_file(fileName);
-    m_lexer = shared_ptr<Lexer>(new Lexer(fileName, file, false, true));
-    init();
+    shared_ptr<InputBuffer> buffer = bundle->get_file_buffer(fileName);
+    if(buffer) {
+        m_lexer = shared_ptr<Lexer>(new Lexer(fileName, buffer, false, true));
+    } else {
+        shared_ptr<std::istream> file = bundle->get_file(fileName);
+        m_lexer = shared_ptr<Lexer>(new Lexer(fileName, file, false, true));
+    }
+    m_tokenArena = new TokenArena;
+    m_lexer->setTokenArena(m_tokenArena);
+    m_lexerBatchPos = 0;
+    std::fill(m_sfcodes, m_sfcodes + SymbolKey::BANK_SIZE, 0);
+    m_preambleEnd = string::npos;
+    m_preambleFiles = 0;
+    init(format);
 }
 
-void Parser::init()
+void Parser::init(const shared_ptr<const Format>& format)
 {
     if(!m_logger)
         m_logger = lexer()->interactive() ?
                         shared_ptr<Logger>(new ConsoleLogger) :
                         shared_ptr<Logger>(new NullLogger);
 
-    base::initSymbols(*this);
-    
+    m_initFormat = format;
+    if(format) {
+        m_symbols = format->m_symbols;
+        m_registers = format->m_registers;
+        for(int ch = 0; ch < 256; ++ch)
+            m_lexer->assignCatCode(ch, format->m_catCodes[ch]);
+        m_lexer->setEndlinechar(format->m_endlinechar);
+        updateParameters();
+        base::initTime(*this);
+    } else {
+        m_symbols.reset(new NamedSymbolTable);
+        m_registers.reset(new SymbolTable(
+                SymbolKey::BANK_COUNT * SymbolKey::BANK_SIZE,
+                std::make_pair(0, Value())));
+        base::initSymbols(*this);
+    }
+
     string banner = BANNER;
     // add time to the banner
     if(!lexer()->interactive()) {   // if we not in the interactive console mode
@@ -274,6 +343,31 @@ void Parser::init()
     m_logger->log(Logger::WRITE, banner, *this, Token::ptr());
 }
 
+shared_ptr<const Format> Parser::dumpFormat() const
+{
+    if(m_groupLevel > 0)
+        return shared_ptr<const Format>();
+
+    shared_ptr<Format> format(new Format);
+    format->m_symbols = m_symbols;
+    format->m_registers = m_registers;
+
+    // the format gets a copy of the table with the local symbols
+    const vector<InternedString::ptr>& localNames = localSymbolNames();
+    for(int n = 0; n < LOCAL_SYMBOL_COUNT; ++n) {
+        if(!m_localSymbols[n].set)
+            continue;
+        if(format->m_symbols == m_symbols)
+            format->m_symbols.reset(new NamedSymbolTable(*m_symbols));
+        namedSymbol(*format->m_symbols, localNames[n].get()).entry =
+                                                m_localSymbols[n].entry;
+    }
+    for(int ch = 0; ch < 256; ++ch)
+        format->m_catCodes[ch] = m_lexer->getCatCode(ch);
+    format->m_endlinechar = m_lexer->endlinechar();
+    return format;
+}
+
 const string& Parser::modeName() const
 {
     if(m_mode > DMATH)
@@ -281,56 +375,287 @@ const string& Parser::modeName() const
     return modeNames[m_mode];
 }
 
-any Parser::EMPTY_ANY;
+Value Parser::EMPTY_VALUE;
+
+namespace {
+
+const string bankNames[SymbolKey::BANK_COUNT] = {
+    "count", "dimen", "skip", "muskip", "toks", "box",
+    "catcode", "lccode", "uccode", "sfcode", "mathcode", "delcode"
+};
+
+} // namespace
+
+const string SymbolKey::EMPTY_NAME;
+
+SymbolKey::SymbolKey(Bank bank, int index)
+    : m_bank(bank), m_index(index)
+{
+    if(index < 0 || index >= BANK_SIZE) {
+        m_name = InternedString::intern(str());
+        m_bank = NONE;
+        m_index = 0;
+    }
+}
+
+SymbolKey::SymbolKey(const string& name)
+    : m_bank(NONE), m_index(0)
+{
+    // the name should be a bank name followed by a register number
+    // written as boost::lexical_cast would write it
+    size_t digits = name.size();
+    while(digits > 0 && std::isdigit((unsigned char)(name[digits-1])))
+        --digits;
+
+    size_t len = name.size() - digits;
+    if(digits == 0 || len == 0 || len > 3 || (name[digits] == '0' && len > 1)) {
+        m_name = InternedString::intern(name);
+        return;
+    }
+
+    int index = 0;
+    for(size_t n = digits; n < name.size(); ++n)
+        index = index * 10 + (name[n] - '0');
+
+    Bank bank = index < BANK_SIZE ? bankByName(name.substr(0, digits)) : NONE;
+    if(bank == NONE) {
+        m_name = InternedString::intern(name);
+    } else {
+        m_bank = bank;
+        m_index = index;
+    }
+}
 
-const any& Parser::symbolAny(const string& name) const
+string SymbolKey::str() const
 {
-    SymbolTable::const_iterator it = m_symbols.find(name);
-    if(it != m_symbols.end())
-        return it->second.second;
-//    std::cout<< "command \"" << name << "\" not found in m_symbols"<<std::endl;
-    return EMPTY_ANY;
+    if(m_bank == NONE)
+        return name();
+    return bankName(m_bank) + boost::lexical_cast<string>(m_index);
 }
 
-void Parser::setSymbol(const string& name, const any& value, bool global)
+const string& SymbolKey::bankName(Bank bank)
 {
-    SymbolTable::iterator it = m_symbols.insert(
-        std::make_pair(name, std::make_pair(0, any()))).first;
+    static const string none;
+    return bank > NONE && bank < BANK_COUNT ? bankNames[bank] : none;
+}
 
-    if(!global && it->second.first != m_groupLevel) {
-        m_symbolsStack.push_back(std::make_pair(name, it->second));
-        it->second.first = m_groupLevel;
-    } else if(global && it->second.first >= 0) {
-        it->second.first = -1;
+SymbolKey::Bank SymbolKey::bankByName(const string& name)
+{
+    for(int n = 0; n < BANK_COUNT; ++n) {
+        if(bankNames[n] == name)
+            return Bank(n);
     }
-    it->second.second = value;
-    setSpecialSymbol(name, value);
+    return NONE;
 }
 
-void Parser::setSymbolDefault(const string& name, const any& defaultValue)
+Parser::NamedSymbol& Parser::namedSymbol(NamedSymbolTable& table,
+                                         const InternedString* name)
 {
-    pair<SymbolTable::iterator, bool> p = m_symbols.insert(
-        std::make_pair(name, std::make_pair(0, any())));
+    NamedSymbolTable::iterator it = table.find(name);
+    if(it == table.end()) {
+        it = table.insert(std::make_pair(name, NamedSymbol())).first;
+        it->second.field = parameterField(name);
+        it->second.local = localSymbol(name);
+        it->second.name = name;
+    }
+    return it->second;
+}
 
-    if(p.second) // new item
-        p.first->second = std::make_pair(0, defaultValue);
+Parser::NamedSymbol& Parser::namedSymbolEntry(const InternedString* name)
+{
+    if(!m_symbols.unique())
+        m_symbols.reset(new NamedSymbolTable(*m_symbols));
+    return namedSymbol(*m_symbols, name);
 }
 
-void Parser::setSpecialSymbol(const string& name, const any& value)
+pair<int, Value>& Parser::registerEntry(const SymbolKey& key)
 {
-    if(value.type() == typeid(int)) {
-        if(name == "endlinechar") {
-            m_lexer->setEndlinechar(*unsafe_any_cast<int>(&value));
-        } else if(name.substr(0, 7) == "catcode") {
-            std::istringstream s(name.substr(7));
-            int n = 0; s >> n;
-            if(!s.fail() && n >= 0 && n <= 255) {
-                m_lexer->assignCatCode(n, *unsafe_any_cast<int>(&value));
-            }
+    if(!m_registers.unique())
+        m_registers.reset(new SymbolTable(*m_registers));
+    return (*m_registers)[key.slot()];
+}
+
+void Parser::setSymbol(const SymbolKey& key, const Value& value, bool global)
+{
+    if(key.isRegister())
+        setRegister(key, value, global);
+    else
+        setNamedSymbol(key.internedName(), value, global);
+}
+
+void Parser::setNamedSymbol(const InternedString* name,
+                            const Value& value, bool global)
+{
+    // a local symbol starts as the entry of the table; namedSymbolAny()
+    // finds it through the table, so the first value goes to the table
+    // if the table has no entry yet
+    int local = localSymbol(name);
+    if(local >= 0 && !m_localSymbols[local].set) {
+        NamedSymbolTable::const_iterator it = m_symbols->find(name);
+        if(it != m_symbols->end()) {
+            m_localSymbols[local].entry = it->second.entry;
+            m_localSymbols[local].set = true;
+        } else {
+            local = -1;
+        }
+    }
+
+    NamedSymbol* symbol = local < 0 ? &namedSymbolEntry(name) : NULL;
+    pair<int, Value>& entry = symbol ? symbol->entry :
+                                       m_localSymbols[local].entry;
+    int Parser::* field = symbol ? symbol->field : parameterField(name);
+    RestoreAction action = local >= 0 ? RESTORE_LOCAL :
+                           field ? RESTORE_PARAMETER : RESTORE_VALUE;
+
+    if(!global && entry.first != m_groupLevel) {
+        SavedSymbol saved = { SymbolKey::named(name), entry, action, field };
+        m_symbolsStack.push_back(saved);
+        entry.first = m_groupLevel;
+    } else if(global && entry.first >= 0) {
+        entry.first = -1;
+    }
+    entry.second = value;
+    if(field)
+        updateSpecialSymbol(RESTORE_PARAMETER, field, 0, value);
+}
+
+void Parser::setRegister(const SymbolKey& key, const Value& value, bool global)
+{
+    pair<int, Value>& reg = registerEntry(key);
+    RestoreAction action = key.bank() == SymbolKey::CATCODE ? RESTORE_CATCODE :
+                           key.bank() == SymbolKey::SFCODE ? RESTORE_SFCODE :
+                           RESTORE_VALUE;
+
+    if(!global && reg.first != m_groupLevel) {
+        SavedSymbol saved = { key, reg, action, NULL };
+        m_symbolsStack.push_back(saved);
+        reg.first = m_groupLevel;
+    } else if(global && reg.first >= 0) {
+        reg.first = -1;
+    }
+    reg.second = value;
+    if(action != RESTORE_VALUE)
+        updateSpecialSymbol(action, NULL, key.index(), value);
+}
+
+void Parser::setSymbolDefault(const SymbolKey& key, const Value& defaultValue)
+{
+    if(key.isRegister()) {
+        pair<int, Value>& reg = registerEntry(key);
+        if(reg.second.empty()) {
+            reg.second = defaultValue;
+            setSpecialRegister(key, defaultValue);
+        }
+        return;
+    }
+
+    NamedSymbol& symbol = namedSymbolEntry(key.internedName());
+    pair<int, Value>& entry = symbol.entry;
+    if(entry.first == 0 && entry.second.empty()) { // new item
+        entry.second = defaultValue;
+        if(symbol.field)
+            updateSpecialSymbol(RESTORE_PARAMETER, symbol.field, 0,
+                                defaultValue);
+    }
+}
+
+void Parser::setSpecialRegister(const SymbolKey& key, const Value& value)
+{
+    if(key.bank() == SymbolKey::CATCODE)
+        updateSpecialSymbol(RESTORE_CATCODE, NULL, key.index(), value);
+    else if(key.bank() == SymbolKey::SFCODE)
+        updateSpecialSymbol(RESTORE_SFCODE, NULL, key.index(), value);
+}
+
+void Parser::updateSpecialSymbol(RestoreAction action, int Parser::* field,
+                                 int index, const Value& value)
+{
+    const int* v = value.get<int>();
+    switch(action) {
+    case RESTORE_CATCODE:
+        if(v) {
+            dropLexerBatch();
+            m_lexer->assignCatCode(index, *v);
+        }
+        break;
+    case RESTORE_SFCODE:
+        m_sfcodes[index] = v ? *v : 0;
+        break;
+    case RESTORE_LOCAL:
+    case RESTORE_PARAMETER:
+        if(!field)
+            break;
+        this->*field = v ? *v : 0;
+        if(v && field == &Parser::m_endlinechar) {
+            dropLexerBatch();
+            m_lexer->setEndlinechar(*v);
         }
+        break;
+    default:
+        break;
     }
 }
 
+const vector<InternedString::ptr>& Parser::localSymbolNames()
+{
+    static const InternedString::ptr names[LOCAL_SYMBOL_COUNT] = {
+        InternedString::intern("inputlineno"),
+        InternedString::intern("spacefactor"),
+        InternedString::intern("year"),
+        InternedString::intern("month"),
+        InternedString::intern("day"),
+        InternedString::intern("time"),
+    };
+    static const vector<InternedString::ptr> result(names,
+                        names + LOCAL_SYMBOL_COUNT);
+    return result;
+}
+
+int Parser::localSymbol(const InternedString* name)
+{
+    const vector<InternedString::ptr>& names = localSymbolNames();
+    for(int n = 0; n < LOCAL_SYMBOL_COUNT; ++n)
+        if(names[n] == name)
+            return n;
+    return -1;
+}
+
+int Parser::* Parser::parameterField(const InternedString* name)
+{
+    BOOST_FOREACH(const ParameterField& f, parameterFields())
+        if(f.name == name)
+            return f.field;
+    return NULL;
+}
+
+const vector<Parser::ParameterField>& Parser::parameterFields()
+{
+    static const ParameterField fields[] = {
+        { InternedString::intern("escapechar"), &Parser::m_escapechar },
+        { InternedString::intern("endlinechar"), &Parser::m_endlinechar },
+        { InternedString::intern("newlinechar"), &Parser::m_newlinechar },
+        { InternedString::intern("globaldefs"), &Parser::m_globaldefs },
+        { InternedString::intern("tracingonline"), &Parser::m_tracingonline },
+        { InternedString::intern("tracingmacros"), &Parser::m_tracingmacros },
+        { InternedString::intern("tracingcommands"),
+                                        &Parser::m_tracingcommands },
+        { InternedString::intern("tracingrestores"),
+                                        &Parser::m_tracingrestores },
+        { InternedString::intern("spacefactor"), &Parser::m_spacefactor },
+    };
+    static const vector<ParameterField> result(fields,
+                        fields + sizeof(fields) / sizeof(fields[0]));
+    return result;
+}
+
+void Parser::updateParameters()
+{
+    BOOST_FOREACH(const ParameterField& f, parameterFields())
+        this->*f.field = namedSymbolAny(f.name.get()).value(int(0));
+    for(int ch = 0; ch < SymbolKey::BANK_SIZE; ++ch)
+        m_sfcodes[ch] = symbol(SymbolKey(SymbolKey::SFCODE, ch), int(0));
+}
+
 /**
  * @brief beginGroup - increases group level.
  * TODO: complete description
@@ -353,103 +678,42 @@ void Parser::endGroup()
     //assert(m_groupLevel > 0); //XXX!
     size_t symbolsStackLevels = m_symbolsStackLevels.empty() ? 0 :
                                 m_symbolsStackLevels.back();
-    while(m_symbolsStack.size() > symbolsStackLevels) {
-        SymbolStack::reference item = m_symbolsStack.back();
-        SymbolTable::iterator it = m_symbols.find(item.first);
 
-        int l = it->second.first;
-
-        if(l >= 0) {
-            it->second = item.second;
-            setSpecialSymbol(it->first, it->second.second);
+    // the entries were saved by namedSymbolEntry() and registerEntry(),
+    // so once the tables are not shared they are indexed directly
+    for(size_t n = m_symbolsStack.size(); n > symbolsStackLevels; --n) {
+        if(m_symbolsStack[n-1].action != RESTORE_LOCAL) {
+            if(!m_symbols.unique())
+                m_symbols.reset(new NamedSymbolTable(*m_symbols));
+            if(!m_registers.unique())
+                m_registers.reset(new SymbolTable(*m_registers));
+            break;
         }
+    }
+    NamedSymbolTable& symbols = *m_symbols;
+    SymbolTable& registers = *m_registers;
 
-        if(symbol("tracingrestores", int(0)) > 0) {
-            string str;
-            any value;
+    for(size_t n = m_symbolsStack.size(); n > symbolsStackLevels; --n) {
+        SavedSymbol& item = m_symbolsStack[n-1];
+        pair<int, Value>& entry = item.key.isRegister() ?
+                    registers[item.key.slot()] :
+                    item.action == RESTORE_LOCAL ?
+                    m_localSymbols[localSymbol(item.key.internedName())].entry :
+                    symbols[item.key.internedName()].entry;
 
-            if(l >= 0) {
-                str = "restoring ";
-                value = item.second.second;
-            } else {
-                str = "retaining ";
-                value = it->second.second;
-            }
+        int l = entry.first;
 
-            string escape = escapestr();
-            if(item.first == "font")
-                str += "current font";
-            else if(item.first.size() > 0 && item.first[0] == '\\')
-                str += escape + item.first.substr(1);
-            else if(item.first.size() > 0 && item.first[0] == '`')
-                str += item.first.substr(1);
-            else
-                str += escape + item.first;
-
-            str += "=";
-
-            if(value.empty()) {
-                str += "undefined";
-            } else if(value.type() == typeid(Command::ptr)) {
-                Command::ptr cmd = *unsafe_any_cast<Command::ptr>(&value);
-                shared_ptr<base::UserMacro> m =
-                    dynamic_pointer_cast<base::UserMacro >(cmd);
-                if(m) {
-                    str += m->texRepr(this, false, 38);
-                            //60 > str.length() ? 60-str.length() : 1);
-                } else {
-                    str += (cmd ? cmd->texRepr(this) : "undefined");
-                }
-                //std::remove_copy(r.begin(), r.end(),
-                //        std::back_inserter(str), '\n');
-            } else if(value.type() == typeid(base::ParshapeInfo)) {
-                str += boost::lexical_cast<string>(
-                    unsafe_any_cast<base::ParshapeInfo>(&value)
-                                        ->parshape.size());
-            } else if(value.type() == typeid(shared_ptr<base::FontInfo>)) {
-                shared_ptr<base::FontInfo> f =
-                    *unsafe_any_cast<shared_ptr<base::FontInfo> >(&value);
-                string fname = f ? f->selector : "";
-                if(!fname.empty() && fname[0] == '\\') {
-                    fname = escape + fname.substr(1);
-                } else {
-                    fname = escape + "FONT" + str;
-                }
-                str += fname;
-            } else if(value.type() == typeid(base::Box)) {
-                base::Box box = *unsafe_any_cast<base::Box>(&value);
-                if(box.value) {
-                    string w = base::InternalDimen::dimenToString(box.width);
-                    string h = base::InternalDimen::dimenToString(box.height);
-                    string s = base::InternalDimen::dimenToString(box.skip);
-                    str += "\n" + escape +
-                        (box.mode == RHORIZONTAL ? "hbox" : "vbox") +
-                        "(" + w.substr(0, w.size()-2) +
-                        "+" + s.substr(0, s.size()-2) +
-                        ")x" + h.substr(0, h.size()-2);
-                    if(box.mode == RVERTICAL)
-                        str += " []";
-                } else {
-                    str += "void";
-                }
-            } else if(value.type() == typeid(Token::list)) {
-                str += Token::texReprList(
-                        *unsafe_any_cast<Token::list>(&value), this, false, 34);
-                        //false, 70 > str.length() ? 70-str.length() : 1);
-            } else {
-                str += reprAny(value);
-            }
-
-            //if(str.size() > 72) {
-            //   str = str.substr(0, 72-5) + "\\ETC.";
-            //}
-
-            logger()->log(Logger::TRACING,
-                str, *this, Token::ptr());
+        if(l >= 0) {
+            entry = item.entry;
+            if(item.action != RESTORE_VALUE)
+                updateSpecialSymbol(item.action, item.field,
+                                    item.key.index(), entry.second);
         }
 
-        m_symbolsStack.pop_back();
+        if(m_tracingrestores > 0)
+            traceRestore(item.key, entry.second, l >= 0);
     }
+    m_symbolsStack.resize(symbolsStackLevels);
 
     pushBack(&m_aftergroupTokensStack.back());
 
@@ -458,25 +722,99 @@ void Parser::endGroup()
     --m_groupLevel;
 }
 
-Node::ptr Parser::rawExpandToken(Token::ptr token)
+void Parser::traceRestore(const SymbolKey& key, const Value& value,
+                          bool restored)
+{
+    string str = restored ? "restoring " : "retaining ";
+
+    string escape = escapestr();
+    string name = key.str();
+    if(name == "font")
+        str += "current font";
+    else if(name.size() > 0 && name[0] == '\\')
+        str += escape + name.substr(1);
+    else if(name.size() > 0 && name[0] == '`')
+        str += name.substr(1);
+    else
+        str += escape + name;
+
+    str += "=";
+
+    if(value.empty()) {
+        str += "undefined";
+    } else if(value.is<Command::ptr>()) {
+        Command::ptr cmd = *value.get<Command::ptr>();
+        shared_ptr<base::UserMacro> m =
+            dynamic_pointer_cast<base::UserMacro >(cmd);
+        if(m) {
+            str += m->texRepr(this, false, 38);
+                    //60 > str.length() ? 60-str.length() : 1);
+        } else {
+            str += (cmd ? cmd->texRepr(this) : "undefined");
+        }
+        //std::remove_copy(r.begin(), r.end(),
+        //        std::back_inserter(str), '\n');
+    } else if(value.is<base::ParshapeInfo>()) {
+        str += boost::lexical_cast<string>(
+            value.get<base::ParshapeInfo>()->parshape.size());
+    } else if(value.is<shared_ptr<base::FontInfo> >()) {
+        shared_ptr<base::FontInfo> f =
+            *value.get<shared_ptr<base::FontInfo> >();
+        string fname = f ? f->selector : "";
+        if(!fname.empty() && fname[0] == '\\') {
+            fname = escape + fname.substr(1);
+        } else {
+            fname = escape + "FONT" + str;
+        }
+        str += fname;
+    } else if(value.is<base::Box>()) {
+        const base::Box& box = *value.get<base::Box>();
+        if(box.value) {
+            string w = base::InternalDimen::dimenToString(box.width);
+            string h = base::InternalDimen::dimenToString(box.height);
+            string s = base::InternalDimen::dimenToString(box.skip);
+            str += "\n" + escape +
+                (box.mode == RHORIZONTAL ? "hbox" : "vbox") +
+                "(" + w.substr(0, w.size()-2) +
+                "+" + s.substr(0, s.size()-2) +
+                ")x" + h.substr(0, h.size()-2);
+            if(box.mode == RVERTICAL)
+                str += " []";
+        } else {
+            str += "void";
+        }
+    } else if(value.is<Token::list>()) {
+        str += Token::texReprList(
+                *value.get<Token::list>(), this, false, 34);
+                //false, 70 > str.length() ? 70-str.length() : 1);
+    } else {
+        str += value.repr();
+    }
+
+    //if(str.size() > 72) {
+    //   str = str.substr(0, 72-5) + "\\ETC.";
+    //}
+
+    logger()->log(Logger::TRACING,
+        str, *this, Token::ptr());
+}
+
+Token::ptr Parser::rawExpandToken(Token::ptr token)
 {
     if(m_lockToken) {
         if(token->type() == m_lockToken->type() &&
                 token->catCode() == m_lockToken->catCode() &&
                 token->value() == m_lockToken->value())
-            return Node::ptr();
+            return Token::ptr();
     }
 
     // chek m_symbols table for the comand
     Command::ptr cmd = symbol(token, Command::ptr());
 
-    // try to cast cmd to Macro. If cmd doesn't belong to the Macro class -
-    // dynamic_pointer_cast will return NULL pointer
-    Macro::ptr macro = dynamic_pointer_cast<Macro>(cmd);
-
     // return null-Nude if cmd is command but not a macro command
-    if(cmd && !macro)
-        return Node::ptr();
+    if(cmd && !cmd->is(Command::MACRO))
+        return Token::ptr();
+    Macro::ptr macro = static_pointer_cast<Macro>(cmd);
 
     /// Macro
     Node::ptr node(new Node("macro"));
@@ -505,7 +843,7 @@ Node::ptr Parser::rawExpandToken(Token::ptr token)
         //node->setValue(Token::list(1, token));
         node->setType("undefined_control_sequence");
 
-    } else if(dynamic_pointer_cast<ConditionalBegin>(macro)) {
+    } else if(macro->is(Command::CONDITIONAL_BEGIN)) {
         ConditionalBegin::ptr condBegin =
             static_pointer_cast<ConditionalBegin>(macro);
 
@@ -529,7 +867,7 @@ Node::ptr Parser::rawExpandToken(Token::ptr token)
         assert(m_conditionals.size() >= level);
         ConditionalInfo& cinfo = m_conditionals[level-1];
 
-        cinfo.ifcase = node->valueAny().type() == typeid(int);
+        cinfo.ifcase = node->valueAny().is<int>();
         if(cinfo.ifcase) {
             cinfo.value = node->value(int(0));
             cinfo.active = cinfo.value == 0;
@@ -541,7 +879,7 @@ Node::ptr Parser::rawExpandToken(Token::ptr token)
         cinfo.branch = 0;
         cinfo.parsed = true;
 
-        if(symbol("tracingcommands", int(0)) > 1/* && mode() != NULLMODE*/) {
+        if(m_tracingcommands > 1/* && mode() != NULLMODE*/) {
             string str;
             if(cinfo.ifcase) {
                 str = "case " +
@@ -560,7 +898,7 @@ Node::ptr Parser::rawExpandToken(Token::ptr token)
             pushBack(NULL);
         }
 
-    } else if(dynamic_pointer_cast<ConditionalOr>(macro)) {
+    } else if(macro->is(Command::CONDITIONAL_OR)) {
         if(!m_conditionals.empty() && !m_conditionals.back().parsed) {
             node->setValue(Token::list_ptr(
                 new Token::list(1, Token::create(
@@ -585,7 +923,7 @@ Node::ptr Parser::rawExpandToken(Token::ptr token)
                 pushBack(NULL);
             }
         }
-    } else if(dynamic_pointer_cast<ConditionalElse>(macro)) {
+    } else if(macro->is(Command::CONDITIONAL_ELSE)) {
         if(!m_conditionals.empty() && !m_conditionals.back().parsed) {
             node->setValue(Token::list_ptr(
                 new Token::list(1, Token::create(
@@ -614,7 +952,7 @@ Node::ptr Parser::rawExpandToken(Token::ptr token)
                 pushBack(NULL);
             }
         }
-    } else if(dynamic_pointer_cast<ConditionalEnd>(macro)) {
+    } else if(macro->is(Command::CONDITIONAL_END)) {
         if(!m_conditionals.empty() && !m_conditionals.back().parsed) {
             node->setValue(Token::list_ptr(
                 new Token::list(1, Token::create(
@@ -638,23 +976,23 @@ Node::ptr Parser::rawExpandToken(Token::ptr token)
         pushBack(NULL);
     }
 
-    // TODO: the next lines is horible. Either Node::value should return
-    //       a reference or the value itself should be Token::list_ptr.
+    // the expansion is read from the list as one frame of the queue; the
+    // list may be shared by the macro, so it is not changed
     Token::list_ptr newTokens = node->value(Token::list_ptr());
-    if(!newTokens) newTokens = Token::list_ptr(new Token::list());
-    // add some interesting token to the newTokens list
-    // this token have m_source - received from the node, lexer's file name !!!
-    newTokens->insert(newTokens->begin(),
-                Token::create(
+    if(newTokens) m_tokenQueue.push_front(newTokens);
+
+    // the token before the expansion: its source is the source of the
+    // node, which is concatenated only when it is read
+    shared_ptr<Token::list> sourceTokens(new Token::list());
+    appendNodeTokens(*node, *sourceTokens);
+    Token::ptr sourceToken = Token::create(
                     expanded ? Token::TOK_SKIPPED : token->type(),
-                    token->catCode(), token->value(), node->source(),
+                    token->catCode(), token->value(), string(),
                     0, 0, 0, 0,
-                    false, lexer()->fileNamePtr())
-            );
-#warning XXX node can consists from tokens from several files!
-    node->setValue(newTokens);
+                    false, lexer()->fileNamePtr());
+    sourceToken->setSourceTokens(sourceTokens);
 
-    return node;
+    return sourceToken;
 }
 
 Token::ptr Parser::rawNextToken(bool expand)
@@ -664,15 +1002,14 @@ Token::ptr Parser::rawNextToken(bool expand)
     while(true) {
         // chek m_tokenQueue. If it isn't empty extract one front token
         if(!m_tokenQueue.empty()) {
-            token = m_tokenQueue.front();
-            m_tokenQueue.pop_front();
+            token = m_tokenQueue.take();
         } else {
             if(m_endinputNow) {
                 endinputNow();
                 continue;
             }
 
-            token = m_lexer->nextToken();   // read next token
+            token = lexerNextToken();   // read next token
             if(token && !token->isSkipped())// if token is not skipped
                 m_lastToken = token;        // remember token as the last real
 
@@ -690,26 +1027,49 @@ Token::ptr Parser::rawNextToken(bool expand)
 
     // NOTE: this is only the part of program where "expand" variable is used
     if(token && token->isControl() && expand &&
-                m_noexpandTokens.count(token) == 0) {
-        Node::ptr node = rawExpandToken(token);
-        if(node) {
-            // get node value. It is not a children content!!!
-            Token::list_ptr newTokens = node->value(Token::list_ptr());
-            assert(newTokens && !newTokens->empty());
-
-            Token::list::reverse_iterator rIterEnd = newTokens->rend();
-            Token::list::reverse_iterator rIter = newTokens->rbegin();
-            for(; rIter+1 != rIterEnd; ++rIter) {
-                assert((*rIter)->source().empty());
-                m_tokenQueue.push_front(*rIter);
-            }
-            if(rIter != rIterEnd)
-                token = *rIter;
-        }
+                !token->isNoexpand()) {
+        Token::ptr sourceToken = rawExpandToken(token);
+        if(sourceToken)
+            token = sourceToken;
     }
     return token;
 }
 
+Token::ptr Parser::lexerNextToken()
+{
+    if(m_lexerBatchPos == m_lexerBatch.size()) {
+        m_lexerBatch.clear();
+        m_lexerBatchPositions.clear();
+        m_lexerBatchPos = 0;
+        if(!m_lexer->nextTokens(m_lexerBatch, LEXER_BATCH_SIZE,
+                                &m_lexerBatchPositions))
+            return Token::ptr();
+    }
+    return std::move(m_lexerBatch[m_lexerBatchPos++]);
+}
+
+void Parser::dropLexerBatch()
+{
+    if(m_lexerBatchPos < m_lexerBatch.size()) {
+        // the batch is never empty after the first token is taken
+        m_lexer->rewind(m_lexerBatchPositions[m_lexerBatchPos-1]);
+    }
+    m_lexerBatch.clear();
+    m_lexerBatchPositions.clear();
+    m_lexerBatchPos = 0;
+}
+
+void Parser::updateLineNo()
+{
+    static const InternedString::ptr inputlineno =
+                                    InternedString::intern("inputlineno");
+
+    if(!m_lexer->interactive() && m_lexer->lineNo() != m_lineNo) {
+        m_lineNo = m_lexer->lineNo();
+        setNamedSymbol(inputlineno.get(), int(m_lineNo), true);
+    }
+}
+
 Token::ptr Parser::nextToken(vector< Token::ptr >* tokenVector, bool expand)
 {
     if(m_tokenSource.empty())
@@ -722,11 +1082,7 @@ Token::ptr Parser::nextToken(vector< Token::ptr >* tokenVector, bool expand)
     }
 
     Token::ptr token = m_token;
-    // update m_lineNo
-    if(!m_lexer->interactive() && m_lexer->lineNo() != m_lineNo) {
-        m_lineNo = m_lexer->lineNo();
-        setSymbol("inputlineno", int(m_lineNo), true);
-    }
+    updateLineNo();
 
     m_tokenSource.clear();
     m_token.reset();
@@ -813,6 +1169,10 @@ Token::ptr Parser::peekToken(bool expand)
             // Return the rest of the document as skipped tokens
             Token::ptr token;
             while((token = rawNextToken(false))) {
+                // the tokens not read from the file may be shared
+                // by the macros
+                if(!token->lineNo())
+                    token = Token::ptr(new Token(*token));
                 token->setType(Token::TOK_SKIPPED);
                 m_tokenSource.push_back(token);
             }
@@ -905,17 +1265,26 @@ Token::ptr Parser::peekToken(bool expand)
     #endif
 }
 
+void Parser::clearNoexpand()
+{
+    BOOST_FOREACH(const Token::ptr& token, m_noexpandTokens)
+        token->setNoexpand(false);
+    m_noexpandTokens.clear();
+}
+
 void Parser::pushBack(vector< Token::ptr >* tokenVector)
 {
-    std::copy(m_tokenSource.rbegin(), m_tokenSource.rend(),
-                std::front_inserter(m_tokenQueue));
+    for(Token::list::reverse_iterator it = m_tokenSource.rbegin();
+                                        it != m_tokenSource.rend(); ++it)
+        m_tokenQueue.push_front(*it);
 
     m_tokenSource.clear();
     m_token.reset();
 
     if(tokenVector) {
-        std::copy(tokenVector->rbegin(), tokenVector->rend(),
-                    std::front_inserter(m_tokenQueue));
+        for(Token::list::reverse_iterator it = tokenVector->rbegin();
+                                        it != tokenVector->rend(); ++it)
+            m_tokenQueue.push_front(*it);
     }
     // NOTE: lastToken is NOT changed
 }
@@ -936,30 +1305,70 @@ void Parser::_inputStream(const string &fileName,
         return;
     }
 
-    m_inputStack.push_back(std::make_pair(m_lexer, m_tokenQueue));
+    _inputLexer(shared_ptr<Lexer>(new Lexer(fileName, istream, false, true)));
+}
+
+void Parser::_inputLexer(const shared_ptr<Lexer>& lexer)
+{
+    dropLexerBatch();
+    m_inputStack.push_back(std::make_pair(m_lexer, TokenQueue()));
+    m_inputStack.back().second.swap(m_tokenQueue);
 
-    shared_ptr<Lexer> lexer(new Lexer(fileName, istream, false, true));
+    lexer->setTokenArena(m_tokenArena);
     lexer->setEndlinechar(m_lexer->endlinechar());
     for(int n=0; n<256; ++n) {
         lexer->assignCatCode(n, m_lexer->getCatCode(n));
     }
 
     m_lexer = lexer;
-    m_tokenQueue.clear();
-    logger()->log(Logger::MESSAGE, "(" + fileName, *this, lastToken());
+    logger()->log(Logger::MESSAGE, "(" + lexer->fileName(),
+                                            *this, lastToken());
 }
 
 void Parser::bundleInput(const string &fileName) {
-    shared_ptr<std::istream> istream = m_bundle->get_file(fileName);
-    _inputStream(fileName, istream);
+    shared_ptr<InputBuffer> buffer;
+    if(m_prefetcher)
+        buffer = m_prefetcher->take(fileName);
+    if(!buffer)
+        buffer = m_bundle->get_file_buffer(fileName);
+
+    if(buffer) {
+        if(m_prefetcher)
+            prefetchInputs(buffer);
+        _inputLexer(shared_ptr<Lexer>(
+                        new Lexer(fileName, buffer, false, true)));
+    } else {
+        _inputStream(fileName, m_bundle->get_file(fileName));
+    }
+}
+
+void Parser::setPrefetch(bool enable)
+{
+    if(!enable) {
+        m_prefetcher.reset();
+    } else if(!m_prefetcher) {
+        m_prefetcher.reset(new Prefetcher(m_bundle));
+        shared_ptr<InputBuffer> buffer = m_lexer->buffer();
+        if(buffer)
+            prefetchInputs(buffer);
+    }
+}
+
+void Parser::prefetchInputs(const shared_ptr<InputBuffer>& buffer)
+{
+    // names are resolved here: bundles are not required to be thread-safe
+    BOOST_FOREACH(const string& name, Prefetcher::scanInputs(*buffer)) {
+        m_prefetcher->request(m_bundle->get_tex_filename(name));
+    }
 }
 
 void Parser::endinputNow()
 {
     if(m_inputStack.empty())
         return;
+    dropLexerBatch();
     m_lexer = m_inputStack.back().first;
-    m_tokenQueue = m_inputStack.back().second;
+    m_tokenQueue.swap(m_inputStack.back().second);
     m_inputStack.pop_back();
     m_endinput = false;
     m_endinputNow = false;
@@ -976,34 +1385,48 @@ void Parser::processTextCharacter(char ch, Token::ptr token)
 
     m_hasOutput = true;
 
-    int prevSpacefactor = symbol("spacefactor", true);
-    int spacefactor = symbol(
-        "sfcode" + boost::lexical_cast<string>(int(ch)), int(0));
+    static const InternedString::ptr name =
+                                    InternedString::intern("spacefactor");
+    int spacefactor = m_sfcodes[(unsigned char) ch];
 
     if(spacefactor != 0) {
-        if(prevSpacefactor > 1000 && spacefactor < 1000)
+        if(m_spacefactor > 1000 && spacefactor < 1000)
             spacefactor = 1000;
-        setSymbol("spacefactor", spacefactor, true);
+        // \spacefactor is always global, so setting it again is a no-op
+        if(spacefactor != m_spacefactor)
+            setNamedSymbol(name.get(), spacefactor, true);
     }
 }
 
 // TODO Bereziuk: Oh this magic numbers !!!
 void Parser::resetParagraphIndent()
 {
-    if(symbol("parshape", base::ParshapeInfo()).parshape.size() != 0)
-        setSymbol("parshape", base::ParshapeInfo());
-
-    if(symbol("hangindent", Dimen(0)).value != 0)
-        setSymbol("hangindent", Dimen(0));
-
-    if(symbol("hangafter", int(0)) != 1)
-        setSymbol("hangafter", int(1));
-
-    if(symbol("looseness", int(0)) != 0)
-        setSymbol("looseness", int(0));
-
-    if(symbol("spacefactor", int(0)) != 1000)
-        setSymbol("spacefactor", int(1000), true);
+    static const InternedString::ptr parshape =
+                                    InternedString::intern("parshape");
+    static const InternedString::ptr hangindent =
+                                    InternedString::intern("hangindent");
+    static const InternedString::ptr hangafter =
+                                    InternedString::intern("hangafter");
+    static const InternedString::ptr looseness =
+                                    InternedString::intern("looseness");
+    static const InternedString::ptr spacefactor =
+                                    InternedString::intern("spacefactor");
+
+    if(namedSymbolAny(parshape.get()).value(base::ParshapeInfo())
+                                                .parshape.size() != 0)
+        setNamedSymbol(parshape.get(), base::ParshapeInfo(), false);
+
+    if(namedSymbolAny(hangindent.get()).value(Dimen(0)).value != 0)
+        setNamedSymbol(hangindent.get(), Dimen(0), false);
+
+    if(namedSymbolAny(hangafter.get()).value(int(0)) != 1)
+        setNamedSymbol(hangafter.get(), int(1), false);
+
+    if(namedSymbolAny(looseness.get()).value(int(0)) != 0)
+        setNamedSymbol(looseness.get(), int(0), false);
+
+    if(m_spacefactor != 1000)
+        setNamedSymbol(spacefactor.get(), int(1000), true);
 }
 
 bool Parser::helperIsImplicitCharacter(Token::CatCode catCode, bool expand)
@@ -1021,22 +1444,52 @@ bool Parser::helperIsImplicitCharacter(Token::CatCode catCode, bool expand)
     return false;
 }
 
+void Parser::skipConditionalText(Token::list& tokens)
+{
+    // only the text read directly from the file can be skipped
+    if(!m_tokenSource.empty() || !m_tokenQueue.empty() || m_end ||
+            m_endinput || m_endinputNow || m_lexer->interactive())
+        return;
+
+    dropLexerBatch();
+    Lexer::TextPosition begin = m_lexer->textPosition();
+    Lexer::LinePosition before;
+    while(const InternedString* name = m_lexer->skipToControl(before)) {
+        const Command::ptr* cmd = namedSymbolAny(name).get<Command::ptr>();
+        if(cmd && *cmd && ((*cmd)->kind() & (Command::CONDITIONAL_BEGIN |
+                Command::CONDITIONAL_OR | Command::CONDITIONAL_ELSE |
+                Command::CONDITIONAL_END))) {
+            m_lexer->rewind(before);
+            break;
+        }
+    }
+
+    if(Token::ptr token = m_lexer->skippedToken(begin))
+        tokens.push_back(token);
+}
+
 Node::ptr Parser::parseFalseConditional(size_t level, bool sElse, bool sOr)
 {
     Node::ptr node(new Node("skipped_conditional"));
 
     Token::ptr token;
-    while((token = peekToken(false)) && m_conditionals.size() >= level) {
+    while(true) {
+        if(m_conditionals.size() >= level)
+            skipConditionalText(node->tokens());
+        if(!(token = peekToken(false)) || m_conditionals.size() < level)
+            break;
+
         Command::ptr cmd = symbol(token, Command::ptr());
         nextToken(&node->tokens(), false);
-        
-        if(dynamic_pointer_cast<ConditionalBegin>(cmd)) {
+        unsigned int kind = cmd ? cmd->kind() : 0;
+
+        if(kind & Command::CONDITIONAL_BEGIN) {
             ConditionalInfo cinfo;
             cinfo.parsed = false;
             cinfo.active = false;
             m_conditionals.push_back(cinfo);
 
-        } else if(dynamic_pointer_cast<ConditionalOr>(cmd)) {
+        } else if(kind & Command::CONDITIONAL_OR) {
             if(sOr && m_conditionals.size() == level) {
                 ConditionalInfo& cinfo = m_conditionals.back();
                 ++cinfo.branch;
@@ -1045,7 +1498,7 @@ Node::ptr Parser::parseFalseConditional(size_t level, bool sElse, bool sOr)
                     return node;
             }
 
-        } else if(dynamic_pointer_cast<ConditionalElse>(cmd)) {
+        } else if(kind & Command::CONDITIONAL_ELSE) {
             if(sElse && m_conditionals.size() == level) {
                 ConditionalInfo& cinfo = m_conditionals.back();
                 if(cinfo.ifcase) {
@@ -1060,7 +1513,7 @@ Node::ptr Parser::parseFalseConditional(size_t level, bool sElse, bool sOr)
                     return node;
             }
 
-        } else if(dynamic_pointer_cast<ConditionalEnd>(cmd)) {
+        } else if(kind & Command::CONDITIONAL_END) {
             if(m_conditionals.size() == level) {
                 m_conditionals.pop_back();
                 return node;
@@ -1077,7 +1530,7 @@ Node::ptr Parser::parseCommand(Command::ptr command)
 {
     Node::ptr node(new Node("command"));
 
-    if(dynamic_pointer_cast<base::Prefix>(command)) {
+    if(command->is(Command::PREFIX)) {
         std::set<string> prefixes;
         Token::ptr token;
         while(peekToken()) {
@@ -1102,7 +1555,7 @@ Node::ptr Parser::parseCommand(Command::ptr command)
                 resetNoexpand();
 
                 if(m_afterassignmentToken &&
-                        dynamic_pointer_cast<base::Assignment>(command)) {
+                        command->is(Command::ASSIGNMENT)) {
                     Token::list tokens(1, m_afterassignmentToken);
                     pushBack(&tokens);
                     m_afterassignmentToken.reset();
@@ -1123,7 +1576,7 @@ Node::ptr Parser::parseCommand(Command::ptr command)
         m_commandStack.pop_back();
 
         if(m_afterassignmentToken &&
-                dynamic_pointer_cast<base::Assignment>(command)) {
+                command->is(Command::ASSIGNMENT)) {
             Token::list tokens(1, m_afterassignmentToken);
             pushBack(&tokens);
             m_afterassignmentToken.reset();
@@ -2296,7 +2749,7 @@ Node::ptr Parser::parseTextWord()
 
 void Parser::traceCommand(Token::ptr token, bool expanding)
 {
-    int tracingcommands = symbol("tracingcommands", int(0));
+    int tracingcommands = m_tracingcommands;
     if(tracingcommands > 0) {
         string str;
         if(token->isControl()) {
@@ -2311,7 +2764,7 @@ void Parser::traceCommand(Token::ptr token, bool expanding)
                     return;
                 }
             }
-            if(dynamic_pointer_cast<Macro>(cmd)) {
+            if(cmd && cmd->is(Command::MACRO)) {
                 if(expanding) {
                     if(tracingcommands < 2) return;
                     if(dynamic_pointer_cast<base::UserMacro>(cmd)) return;
@@ -2398,6 +2851,9 @@ Node::ptr Parser::parseGroup(GroupType groupType)
             break;
         }
 
+        if(m_preambleEnd != string::npos && groupType == GROUP_DOCUMENT)
+            savePreamble(node);
+
         traceCommand(peekToken());
 
         if(helperIsImplicitCharacter(Token::CC_EGROUP)) {
@@ -2500,13 +2956,13 @@ Node::ptr Parser::parseGroup(GroupType groupType)
             Command::ptr cmd = symbol(peekToken(), Command::ptr());
             Node::ptr cmdNode;
             if(cmd) {
-                if(dynamic_pointer_cast<Begingroup>(cmd)) {
+                if(cmd->is(Command::BEGINGROUP)) {
                     beginGroup();
                     node->appendChild("group", parseGroup(GROUP_SUPER));
                     //pushBack(&m_aftergroupTokens);
                     //m_aftergroupTokens.clear();
                     endGroup();
-                } else if(dynamic_pointer_cast<Endgroup>(cmd)) {
+                } else if(cmd->is(Command::ENDGROUP)) {
                     if(groupType == GROUP_SUPER) {
                         node->appendChild("group_end", parseToken());
                         break;
@@ -2594,6 +3050,172 @@ Node::ptr Parser::parseGroup(GroupType groupType)
     return node;
 }
 
+namespace {
+
+// copies the nodes of a preamble saved by another parser, moving
+// their tokens to the main file of this parser
+class PreambleRebase
+{
+public:
+    PreambleRebase(Lexer& lexer, const string* fileName)
+        : m_lexer(lexer), m_fileName(fileName) {}
+
+    Token::ptr token(const Token::ptr& token) {
+        if(!token) return token;
+        Token::ptr& copy = m_tokens[token.get()];
+        if(copy) return copy;
+        if(const Token::list* parts = token->sourceTokens()) {
+            shared_ptr<Token::list> rebased(new Token::list(tokens(*parts)));
+            copy = m_lexer.rebase(Token::ptr(new Token(*token)), m_fileName);
+            copy->setSourceTokens(rebased);
+        } else {
+            copy = m_lexer.rebase(token, m_fileName);
+        }
+        return copy;
+    }
+
+    Token::list tokens(const Token::list& tokens) {
+        Token::list copy;
+        copy.reserve(tokens.size());
+        BOOST_FOREACH(const Token::ptr& t, tokens)
+            copy.push_back(token(t));
+        return copy;
+    }
+
+    Node::ptr node(const Node::ptr& node) {
+        Node::ptr copy(new Node(node->type()));
+        const Value& value = node->valueAny();
+        if(const Token::ptr* t = value.get<Token::ptr>()) {
+            copy->setValue(token(*t));
+        } else if(const Token::list* list = value.get<Token::list>()) {
+            copy->setValue(tokens(*list));
+        } else if(const Token::list_ptr* list = value.get<Token::list_ptr>()) {
+            copy->setValue(*list ? Token::list_ptr(new Token::list(
+                        tokens(**list))) : *list);
+        } else {
+            copy->setValue(value);
+        }
+        copy->tokens() = tokens(node->tokens());
+        BOOST_FOREACH(const Node::ChildrenList::value_type& child,
+                                                    node->children())
+            copy->appendChild(child.first, this->node(child.second));
+        return copy;
+    }
+
+protected:
+    Lexer& m_lexer;
+    const string* m_fileName;   //!< name of the file of the cached tokens
+    std::unordered_map<const Token*, Token::ptr> m_tokens;
+};
+
+} // namespace
+
+void Parser::restorePreamble(Node::ChildrenList& preamble)
+{
+    m_preambleEnd = string::npos;
+
+    // only a parser which has not read anything yet can skip the preamble
+    shared_ptr<InputBuffer> buffer = m_lexer->buffer();
+    if(!buffer || m_lexer->lineNo() != 0 || m_token ||
+                !m_tokenQueue.empty() || !m_inputStack.empty())
+        return;
+
+    size_t size = PreambleCache::preambleSize(buffer->data(), buffer->size());
+    if(size == string::npos)
+        return;
+
+    shared_ptr<const PreambleCache::Entry> entry =
+            m_preambleCache->find(buffer->data(), size, m_initFormat);
+    if(!entry || !m_lexer->restore(entry->checkpoint)) {
+        m_preambleEnd = size;
+        m_preambleFiles = m_tokenArena->fileCount();
+        return;
+    }
+
+    m_lexerBatch.clear();
+    m_lexerBatchPositions.clear();
+    m_lexerBatchPos = 0;
+
+    m_symbols = entry->format->m_symbols;
+    m_registers = entry->format->m_registers;
+    std::fill(m_localSymbols, m_localSymbols + LOCAL_SYMBOL_COUNT,
+              LocalSymbol());
+    updateParameters();
+    m_conditionals = entry->conditionals;
+    m_mode = entry->mode;
+    m_prevMode = entry->prevMode;
+    m_interaction = entry->interaction;
+    m_hasOutput = entry->hasOutput;
+    m_lineNo = entry->lineNo;
+
+    PreambleRebase rebase(*m_lexer, entry->fileName.get());
+    if(!entry->skipped.empty())
+        m_tokenQueue.push_front(Token::list_ptr(
+                    new Token::list(rebase.tokens(entry->skipped))));
+    BOOST_FOREACH(const Node::ChildrenList::value_type& child, entry->nodes)
+        preamble.push_back(std::make_pair(child.first,
+                                          rebase.node(child.second)));
+
+    base::initTime(*this);
+}
+
+void Parser::savePreamble(const Node::ptr& document)
+{
+    static const InternedString::ptr begin = InternedString::intern("\\begin");
+
+    if(!m_lexer->isOwnToken(m_token) ||
+                m_token->linePos() < m_preambleEnd)
+        return;
+
+    // the first token at or after the \begin{document} line
+    size_t preambleEnd = m_preambleEnd;
+    m_preambleEnd = string::npos;
+
+    if(m_token->linePos() != preambleEnd || m_token->charPos() != 0 ||
+            m_token->internedValue() != begin)
+        return;
+
+    // nothing but the lexer may hold the state of the parser
+    if(m_groupLevel != 0 || !m_tokenQueue.empty() || !m_inputStack.empty() ||
+            !m_symbolsStack.empty() || !m_commandStack.empty() ||
+            !m_aftergroupTokensStack.empty() || !m_noexpandTokens.empty() ||
+            m_afterassignmentToken || m_lockToken ||
+            m_end || m_endinput || m_endinputNow ||
+            m_tokenArena->fileCount() != m_preambleFiles)
+        return;
+
+    shared_ptr<PreambleCache::Entry> entry(new PreambleCache::Entry);
+    for(size_t n = 0; n + 1 < m_tokenSource.size(); ++n) {
+        const Token::ptr& token = m_tokenSource[n];
+        if(!m_lexer->isRebasable(token) || token->linePos() >= preambleEnd)
+            return;
+        entry->skipped.push_back(token);
+    }
+
+    shared_ptr<InputBuffer> buffer = m_lexer->buffer();
+    entry->text.assign(buffer->data(), preambleEnd);
+    entry->hash = PreambleCache::hash(buffer->data(), preambleEnd);
+    entry->fileName = m_lexer->sourceFile()->namePtr();
+    entry->initFormat = m_initFormat;
+    entry->format = dumpFormat();
+
+    entry->checkpoint.lineNo = m_token->lineNo() - 1;
+    entry->checkpoint.linePos = preambleEnd;
+    entry->checkpoint.endlinechar = m_lexer->endlinechar();
+    for(int ch = 0; ch < 256; ++ch)
+        entry->checkpoint.catCodes[ch] = m_lexer->getCatCode(ch);
+
+    entry->nodes = document->children();
+    entry->conditionals = m_conditionals;
+    entry->mode = m_mode;
+    entry->prevMode = m_prevMode;
+    entry->interaction = m_interaction;
+    entry->hasOutput = m_hasOutput;
+    entry->lineNo = m_lineNo;
+
+    m_preambleCache->insert(entry);
+}
+
 Node::ptr Parser::parse()
 {
     // print name of source file
@@ -2608,9 +3230,17 @@ Node::ptr Parser::parse()
     }
 
     setMode(VERTICAL);  // outside of any blocks
+
+    // the preamble seen by the cache is not parsed again
+    Node::ChildrenList preamble;
+    if(m_preambleCache)
+        restorePreamble(preamble);
+
     // parsing text
     Node::ptr document = parseGroup(GROUP_DOCUMENT);
     document->setType("document");
+    document->children().insert(document->children().begin(),
+                                preamble.begin(), preamble.end());
     
     // Some skipped tokens may still exists even when
     // peekToken reports EOF. Lets add that tokens to the last node.
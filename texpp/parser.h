@@ -22,10 +22,11 @@
 #include <texpp/common.h>
 #include <texpp/lexer.h>
 #include <texpp/command.h>
-#include <texpp/command.h>
+#include <texpp/value.h>
 
 #include <deque>
 #include <set>
+#include <unordered_map>
 #include <cassert>
 #include <climits>
 
@@ -41,6 +42,9 @@ using boost::unsafe_any_cast;
 class Lexer;
 class Logger;
 class Parser;
+class Prefetcher;
+class Format;
+class PreambleCache;
 
 namespace base {
     class ExpandafterMacro;
@@ -91,9 +95,9 @@ public:
     const string& type() const { return m_type; }
     void setType(const string& type) { m_type = type; }
 
-    void setValue(const any& value) { m_value = value; }
+    void setValue(const Value& value) { m_value = value; }
 
-    const any& valueAny() const { return m_value; }
+    const Value& valueAny() const { return m_value; }
 
     template<typename T>
     /**
@@ -102,15 +106,11 @@ public:
      * @return m_value casted to def type if m_value is the same type as def.
      *  Otherwise return def.
      */
-    T value(T def) const {
-        if(m_value.type() != typeid(T)) return def;
-        else return *unsafe_any_cast<T>(&m_value);
-    }
+    T value(T def) const { return m_value.value(def); }
 
-    // XXX: The following is a horrible hack required to
-    // XXX: overcome problems with RTTI across shared objects
-    // XXX: It will never work good and should be removed !
-    // XXX: The only solution is to NOT use boost::any
+    /**
+     * @return m_value if it is a string, otherwise empty string
+     */
     const string& valueString() const;
 
     const vector< Token::ptr >& tokens() const { return m_tokens; }
@@ -158,7 +158,7 @@ public:
 
 protected:
     string                  m_type;     // type of node
-    any                     m_value;    // main object in the node
+    Value                   m_value;    // main object in the node
     vector< Token::ptr >    m_tokens;   // set of tokens inside node.
     ChildrenList            m_children; // list of inner node+tag pairs
 };
@@ -169,12 +169,94 @@ class Bundle
 public:
     virtual string get_mainfile_name() = 0;
     virtual shared_ptr<std::istream> get_file(const string& fname) = 0;
+
+    /**
+     * @brief optional fast path for get_file(): returns the whole file
+     *      in memory (usually memory-mapped), or an empty pointer if
+     *      the bundle can only provide a stream
+     */
+    virtual shared_ptr<InputBuffer> get_file_buffer(const string&) {
+        return shared_ptr<InputBuffer>();
+    }
+
     virtual string get_bib_filename(const string& fname) = 0;
     virtual string get_tex_filename(const string& fname) = 0;
 protected:
 };
 
 
+/**
+ * @brief key of a parser symbol: either a register of one of the
+ *      register banks (\\count12, \\catcode`a) or an interned name.
+ *      Registers are stored in fixed-size arrays and named symbols in a
+ *      hash table keyed by the address of the interned name, so reading
+ *      them does not format a name or hash its text.
+ */
+class SymbolKey
+{
+public:
+    enum Bank { NONE = -1,
+                COUNT, DIMEN, SKIP, MUSKIP, TOKS, BOX,
+                CATCODE, LCCODE, UCCODE, SFCODE, MATHCODE, DELCODE,
+                BANK_COUNT };
+    enum { BANK_SIZE = 256 };
+
+    SymbolKey(): m_bank(NONE), m_index(0) {}
+
+    /**
+     * @brief register key. Out of range indexes give a table key with
+     *      the register-like name ("sfcode-61"), as it was before the
+     *      register banks
+     */
+    SymbolKey(Bank bank, int index);
+
+    /**
+     * @brief parses register names ("count12"), other names are table keys
+     */
+    explicit SymbolKey(const string& name);
+
+    /**
+     * @brief table key, without looking for a register name
+     */
+    static SymbolKey named(const string& name) {
+        return named(InternedString::intern(name).get());
+    }
+    static SymbolKey named(const InternedString* name) {
+        SymbolKey key; key.m_name = name; return key;
+    }
+
+    Bank bank() const { return m_bank; }
+    int index() const { return m_index; }
+    bool isRegister() const { return m_bank != NONE; }
+
+    // position in the register storage of the parser
+    size_t slot() const { return size_t(m_bank) * BANK_SIZE + m_index; }
+
+    // name in the symbol table; empty (NULL) for registers
+    const string& name() const { return m_name ? *m_name : EMPTY_NAME; }
+    const InternedString* internedName() const { return m_name.get(); }
+
+    // name shown to the user: "count12" for registers
+    string str() const;
+
+    static const string& bankName(Bank bank);
+
+    /**
+     * @brief returns the bank of registers named as the command (without
+     *      the escape character): "count" for \\count, NONE if there is no
+     *      such bank
+     */
+    static Bank bankByName(const string& name);
+
+protected:
+    Bank    m_bank;
+    int     m_index;
+    InternedString::ptr m_name;
+
+    static const string EMPTY_NAME;
+};
+
+
 class Parser
 {
 public:
@@ -198,9 +280,59 @@ public:
                      GROUP_DMATH,
                      GROUP_CUSTOM };
 
+    // the symbol tables hold (group level, value) pairs: the named symbols
+    // are keyed by the interned name, so a table holds only the names
+    // set in it; the registers are indexed by SymbolKey::slot()
+    struct NamedSymbol {
+        NamedSymbol(): entry(0, Value()), field(NULL), local(-1) {}
+        pair< int, Value >  entry;
+        int Parser::*       field;  // the mirror of the parameter, if any;
+                                    // set by namedSymbol()
+        int                 local;  // index in m_localSymbols, or -1;
+                                    // set by namedSymbol()
+        InternedString::ptr name;   // keeps the key of the entry alive
+    };
+    typedef std::unordered_map<
+        const InternedString*, NamedSymbol
+    > NamedSymbolTable;
+    typedef vector<
+        pair< int, Value >
+    > SymbolTable;
+
     Parser(shared_ptr<Bundle> bundle,
            shared_ptr<Logger> logger = shared_ptr<Logger>());
 
+    /**
+     * @brief creates the parser in the state saved in the format instead
+     *      of running base::initSymbols(). The tables of the format are
+     *      shared and copied on the first change.
+     */
+    Parser(shared_ptr<Bundle> bundle, shared_ptr<const Format> format,
+           shared_ptr<Logger> logger = shared_ptr<Logger>());
+
+    /**
+     * @brief saves the current state of the parser in a format, as
+     *      \\dump does. The tables are shared with the format, the parser
+     *      copies them on the next change. The symbols kept outside of the
+     *      table (see localSymbolNames()) are written to a copy of it.
+     * @return empty pointer inside of a group
+     */
+    shared_ptr<const Format> dumpFormat() const;
+
+    /**
+     * @brief number of named symbols in the table of the parser
+     */
+    size_t namedSymbolCount() const { return m_symbols->size(); }
+
+    /**
+     * @brief sets the cache of the preambles used by parse(), see
+     *      PreambleCache
+     */
+    void setPreambleCache(shared_ptr<PreambleCache> cache) {
+        m_preambleCache = cache;
+    }
+    shared_ptr<PreambleCache> preambleCache() const { return m_preambleCache; }
+
     Interaction interaction() const { return m_interaction; }
     void setInteraction(Interaction intr) { m_interaction = intr; }
 
@@ -254,16 +386,36 @@ public:
      */
     void pushBack(vector< Token::ptr >* tokenVector);
 
-    // void setNoexpand(Token::ptr token) { m_noexpandToken = token; }
-    void addNoexpand(Token::ptr token) { m_noexpandTokens.insert(token); }
+    /**
+     * @brief returns a copy of the token marked as not expandable until
+     *      resetNoexpand(). The token itself is not changed: it may be
+     *      shared by all expansions of a macro.
+     */
+    Token::ptr addNoexpand(Token::ptr token) {
+        Token::ptr copy = token->lcopy();
+        copy->setNoexpand(true);
+        m_noexpandTokens.push_back(copy);
+        return copy;
+    }
 
     /**
      * @brief move tokens from m_tokenSource to m_tokenQueue,
      *      clear m_noexpandTokens, m_tokenSource and m_token
      */
-    void resetNoexpand() { m_noexpandTokens.clear(); pushBack(NULL); }
+    void resetNoexpand() {
+        if(!m_noexpandTokens.empty()) clearNoexpand();
+        pushBack(NULL);
+    }
 
     void bundleInput(const string& fileName);
+
+    /**
+     * @brief when enabled, files named by literal \\input and \\include
+     *      arguments are loaded on a worker thread ahead of the parser.
+     *      Bundle::get_file_buffer() of the bundle must be thread-safe.
+     */
+    void setPrefetch(bool enable);
+    bool prefetch() const { return bool(m_prefetcher); }
     void end() { m_end = true; }
     void endinput() { m_endinput = true; }
 
@@ -397,7 +549,16 @@ public:
      * @param global: false - set valid only within current scope,
      *                true  - set valid for a whole document
      */
-    void setSymbol(const string& name, const any& value, bool global = false);
+    void setSymbol(const SymbolKey& key, const Value& value,
+                   bool global = false);
+
+    /**
+     * @brief compatibility form of setSymbol(): register names such as
+     *      "count12" or "catcode65" refer to the register banks
+     */
+    void setSymbol(const string& name, const Value& value, bool global = false) {
+        setSymbol(SymbolKey(name), value, global);
+    }
 
     /** @brief in case the token is control command - register token's symbol
      *      combination(command) in m_symbols table
@@ -406,31 +567,41 @@ public:
      *  @param global: false - set valid only within current scope,
      *                 true  - set valid for a whole document
      */
-    void setSymbol(Token::ptr token, const any& value, bool global = false) {
+    void setSymbol(Token::ptr token, const Value& value, bool global = false) {
         if(token && token->isControl())
-            setSymbol(token->value(), value, global);
+            setNamedSymbol(token->internedValue(), value, global);
     }
 
-    void setSymbolDefault(const string& name, const any& defaultValue);
-    
-    const any& symbolAny(const string& name) const;
-    const any& symbolAny(Token::ptr token) const {
-        if(!token || !token->isControl()) return EMPTY_ANY;
-        else return symbolAny(token->value());
+    void setSymbolDefault(const SymbolKey& key, const Value& defaultValue);
+    void setSymbolDefault(const string& name, const Value& defaultValue) {
+        setSymbolDefault(SymbolKey(name), defaultValue);
     }
-    
+
+    const Value& symbolAny(const SymbolKey& key) const {
+        if(key.isRegister()) return (*m_registers)[key.slot()].second;
+        else return namedSymbolAny(key.internedName());
+    }
+    const Value& symbolAny(const string& name) const {
+        return symbolAny(SymbolKey(name));
+    }
+    const Value& symbolAny(Token::ptr token) const {
+        if(!token || !token->isControl()) return EMPTY_VALUE;
+        else return namedSymbolAny(token->internedValue());
+    }
+
+    template<typename T>
+    T symbol(const SymbolKey& key, T def) const {
+        return symbolAny(key).value(def);
+    }
+
     template<typename T>
     T symbol(const string& name, T def) const {
-        const any& v = symbolAny(name);
-        if(v.type() != typeid(T)) return def;
-        else return *unsafe_any_cast<T>(&v);
+        return symbol(SymbolKey(name), def);
     }
 
     template<typename T>
     T symbol(Token::ptr token, T def) const {
-        const any& v = symbolAny(token);
-        if(v.type() != typeid(T)) return def;
-        else return *unsafe_any_cast<T>(&v);
+        return symbolAny(token).value(def);
     }
 
     template<typename T>
@@ -453,57 +624,189 @@ public:
      */
     // TODO: manage e==0 case
     string escapestr() const {
-        int e = symbol("escapechar", int(0));
+        int e = m_escapechar;
         return e >= 0 && e <= 255 ? string(1, e) : string();
     }
 
+    /**
+     * @brief values of the integer parameters read for almost every
+     *      token; they are equal to symbol(name, int(0))
+     */
+    int escapechar() const { return m_escapechar; }
+    int endlinechar() const { return m_endlinechar; }
+    int newlinechar() const { return m_newlinechar; }
+    int globaldefs() const { return m_globaldefs; }
+    int tracingonline() const { return m_tracingonline; }
+    int tracingmacros() const { return m_tracingmacros; }
+    int tracingcommands() const { return m_tracingcommands; }
+    int tracingrestores() const { return m_tracingrestores; }
+    int spacefactor() const { return m_spacefactor; }
+    int sfcode(unsigned char ch) const { return m_sfcodes[ch]; }
+
     //////// Others
     shared_ptr<Logger> logger() { return m_logger; }
     shared_ptr<Lexer> lexer() { return m_lexer; }
 
+    // storage for all tokens read by the parser
+    TokenArena::ptr tokenArena() const { return m_tokenArena; }
+
     static const string& banner() { return BANNER; }
 
 protected:
     void endinputNow();
+    void prefetchInputs(const shared_ptr<InputBuffer>& buffer);
 
 
     // TODO: this method is huge. So, documentation should be complited by time
     /**
      * @brief rawExpandToken expand control token. Chek m_symbols table for the comand
-     *  If the token is not a Macro - return null Node pointer.
+     *  If the token is not a Macro - return null pointer.
      *  If no such command in m_symbols table than
-     *      change type for the token to "undefined control sequence". Return
-     *      node object tagged as SKIPPED with this token inside
+     *      log "undefined control sequence" and return SKIPPED token
+     *      with the source of this token
      * @param token - command token to be expanded
-     * @return null Node pointer if command is not a Macro. Otherwise return
-     * expanding of Macro...
+     * @return null pointer if command is not a Macro. Otherwise push the
+     * expansion of the Macro to m_tokenQueue and return the token which
+     * carries the source of the expansion
      */
-    Node::ptr rawExpandToken(Token::ptr token);
+    Token::ptr rawExpandToken(Token::ptr token);
 
     /**
      * @brief read and return next token be it skipped or not
      * @return next token
      */
     Token::ptr rawNextToken(bool expand = true);
+
+    /**
+     * @brief returns the next token from the lexer. The tokens are read
+     *      from the lexer in batches (see Lexer::nextTokens())
+     */
+    Token::ptr lexerNextToken();
+
+    /**
+     * @brief drops the tokens of the current batch which are not used yet
+     *      and moves the lexer back to the first of them. Must be called
+     *      whenever the lexer settings (catcodes, endlinechar) change.
+     */
+    void dropLexerBatch();
+
+    /**
+     * @brief updates m_lineNo and \\inputlineno after the lexer moves
+     *      to a new line
+     */
+    void updateLineNo();
+
+    /**
+     * @brief skips the text of a false conditional branch up to the next
+     *      conditional command, keeping it in one skipped token
+     */
+    void skipConditionalText(Token::list& tokens);
+
     Node::ptr parseFalseConditional(size_t level,
                                     bool sElse = false, bool sOr = false);
-    void setSpecialSymbol(const string& name, const any& value);
+    void setSpecialRegister(const SymbolKey& key, const Value& value);
+
+    /**
+     * @brief what has to be updated besides the table when a symbol is
+     *      set or restored: the symbols mirrored in the lexer or in the
+     *      fields of the parser
+     */
+    enum RestoreAction {
+        RESTORE_VALUE,      // only the table
+        RESTORE_CATCODE,    // catcode of the lexer
+        RESTORE_SFCODE,     // m_sfcodes
+        RESTORE_PARAMETER,  // a field from parameterFields()
+        RESTORE_LOCAL       // m_localSymbols instead of the table, and
+                            // the parameter field if there is one
+    };
+    void updateSpecialSymbol(RestoreAction action, int Parser::* field,
+                             int index, const Value& value);
+
+    /**
+     * @brief logs the restored or retained value at the end of a group
+     */
+    void traceRestore(const SymbolKey& key, const Value& value, bool restored);
+
+    /**
+     * @brief the parameters mirrored in the fields of the parser
+     */
+    struct ParameterField {
+        InternedString::ptr name;
+        int Parser::* field;
+    };
+    static const vector<ParameterField>& parameterFields();
+    static int Parser::* parameterField(const InternedString* name);
+
+    /**
+     * @brief reads all the mirrored parameters from the symbol table,
+     *      after the table is replaced
+     */
+    void updateParameters();
+
+    /**
+     * @brief the symbols which every parse sets (\\inputlineno on each
+     *      line, \\spacefactor in the text, \\time and the date at the
+     *      start), so they are kept in m_localSymbols instead of the table,
+     *      which may be shared with a format and would be copied on the
+     *      first line. dumpFormat() writes them to the table of the format.
+     */
+    enum { LOCAL_SYMBOL_COUNT = 6 };
+    struct LocalSymbol {
+        LocalSymbol(): set(false), entry(0, Value()) {}
+        bool                set;    // the table entry is overridden
+        pair< int, Value >  entry;
+    };
+    static const vector<InternedString::ptr>& localSymbolNames();
+    static int localSymbol(const InternedString* name);
+
+    const Value& namedSymbolAny(const InternedString* name) const {
+        NamedSymbolTable::const_iterator it = m_symbols->find(name);
+        if(it == m_symbols->end())
+            return EMPTY_VALUE;
+        int local = it->second.local;
+        return local >= 0 && m_localSymbols[local].set ?
+                m_localSymbols[local].entry.second : it->second.entry.second;
+    }
+
+    /**
+     * @brief the symbol of the table, added if it is not there; the
+     *      parameter field of the name is looked up only when it is added
+     */
+    static NamedSymbol& namedSymbol(NamedSymbolTable& table,
+                                    const InternedString* name);
+    NamedSymbol& namedSymbolEntry(const InternedString* name);
+    pair<int, Value>& registerEntry(const SymbolKey& key);
+    void setNamedSymbol(const InternedString* name,
+                        const Value& value, bool global);
+    void setRegister(const SymbolKey& key, const Value& value, bool global);
 
     void _inputStream(const string &fileName, const shared_ptr<std::istream> &istream);
+    void _inputLexer(const shared_ptr<Lexer>& lexer);
     /**
      * @brief initialising of m_symbols by control comands and control
-     * variables. Filling m_catCodeTable lookup table for all 256 possible char
-     * values (char <-> category code). Appending time to the banner.
+     * variables (or taking them from the format). Filling m_catCodeTable
+     * lookup table for all 256 possible char values (char <-> category
+     * code). Appending time to the banner.
+     */
+    void init(const shared_ptr<const Format>& format);
+
+    /**
+     * @brief restores the state after the preamble of the main file from
+     *      the preamble cache, or prepares savePreamble() on a miss
+     * @param preamble - receives the nodes of the preamble on a hit
      */
-    void init();
+    void restorePreamble(Node::ChildrenList& preamble);
 
-    typedef std::deque<
-        Token::ptr
-    > TokenQueue;
+    /**
+     * @brief saves the state to the preamble cache when the next token is
+     *      the \\begin of the \\begin{document} line
+     */
+    void savePreamble(const Node::ptr& document);
 
-    typedef std::set<
-        Token::ptr
-    > TokenSet;
+    /**
+     * @brief removes the marks of m_noexpandTokens and clears it
+     */
+    void clearNoexpand();
 
     typedef std::vector<
         Command::ptr
@@ -516,17 +819,41 @@ protected:
     shared_ptr<Lexer>   m_lexer;
     shared_ptr<Logger>  m_logger;
     shared_ptr<Bundle>  m_bundle;
+    TokenArena::ptr     m_tokenArena;
+    shared_ptr<Prefetcher> m_prefetcher;
+    shared_ptr<const Format> m_initFormat;
+    shared_ptr<PreambleCache> m_preambleCache;
+    size_t          m_preambleEnd;  // the \begin{document} line to save
+                                    // the preamble at, or string::npos
+    size_t          m_preambleFiles;    // files read before the preamble
 
     Token::ptr      m_token;        // current token (in process)
     Token::list     m_tokenSource;  // token cache ("history") with actual token
                                     // at the end
 
     Token::ptr      m_lastToken;    // the last not skiped token
-    TokenSet        m_noexpandTokens;
+    Token::list     m_noexpandTokens;   // tokens marked by addNoexpand()
     TokenQueue      m_tokenQueue;   // token's buffer whitch is top priority for
                                     // rawNextToken() to get token
 
+    Token::list     m_lexerBatch;   // tokens read from m_lexer at once
+    vector<Lexer::LinePosition> m_lexerBatchPositions;
+    size_t          m_lexerBatchPos;    // next token in m_lexerBatch
+
     int             m_groupLevel;
+
+    // mirrors of the parameters, see parameterFields()
+    int             m_escapechar;
+    int             m_endlinechar;
+    int             m_newlinechar;
+    int             m_globaldefs;
+    int             m_tracingonline;
+    int             m_tracingmacros;
+    int             m_tracingcommands;
+    int             m_tracingrestores;
+    int             m_spacefactor;
+    int             m_sfcodes[SymbolKey::BANK_SIZE];    // the SFCODE bank
+
     bool            m_end;          // stop parsing when true
     bool            m_endinput;
     bool            m_endinputNow;
@@ -540,17 +867,22 @@ protected:
     };
     vector<ConditionalInfo> m_conditionals;
 
-    typedef std::unordered_map<
-        string, pair< int, any >
-    > SymbolTable;
-
-    typedef vector<
-        pair<string, pair<int, any> >
-    > SymbolStack;
+    // the save stack: the symbol, its saved entry, and how to restore it
+    struct SavedSymbol {
+        SymbolKey           key;
+        pair<int, Value>    entry;
+        RestoreAction       action;
+        int Parser::*       field;  // for RESTORE_PARAMETER
+    };
+    typedef vector<SavedSymbol> SymbolStack;
 
-    SymbolTable     m_symbols;      // dictionary of known symbols and commands
+    // the tables may be shared with formats: they are changed only
+    // through namedSymbolEntry() and registerEntry(), which copy them
+    shared_ptr<NamedSymbolTable> m_symbols; // known symbols and commands
+    shared_ptr<SymbolTable> m_registers; // register banks, see SymbolKey
     SymbolStack     m_symbolsStack;
     vector<size_t>  m_symbolsStackLevels;
+    LocalSymbol     m_localSymbols[LOCAL_SYMBOL_COUNT]; // see localSymbol()
 
     size_t          m_lineNo;   // current line number in file
     Mode            m_mode;     // current mode for TeXpp's "state automat"
@@ -574,10 +906,12 @@ protected:
 
     InputStack m_inputStack;
 
-    static any EMPTY_ANY;
+    static Value EMPTY_VALUE;
     static string BANNER;
 
     friend class base::ExpandafterMacro;
+    friend class Format;
+    friend class PreambleCache;
 };
 
 } // namespace texpp
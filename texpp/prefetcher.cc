@@ -0,0 +1,164 @@
+/*  This file is part of texpp library.
+    Copyright (C) 2009 Vladimir Kuznetsov <ks.vladimir@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <texpp/prefetcher.h>
+#include <texpp/parser.h>
+
+#include <algorithm>
+
+namespace texpp {
+
+namespace {
+
+const size_t PAGE_SIZE = 4096;
+
+inline bool isLetter(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+inline bool isSpace(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+} // namespace
+
+Prefetcher::Prefetcher(shared_ptr<Bundle> bundle)
+    : m_bundle(bundle), m_stop(false)
+{
+    m_thread = std::thread(&Prefetcher::run, this);
+}
+
+Prefetcher::~Prefetcher()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_queueCond.notify_one();
+    m_thread.join();
+}
+
+void Prefetcher::request(const string& fileName)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(!m_requested.insert(fileName).second)
+            return;
+        m_files[fileName].state = QUEUED;
+        m_queue.push_back(fileName);
+    }
+    m_queueCond.notify_one();
+}
+
+shared_ptr<InputBuffer> Prefetcher::take(const string& fileName)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    std::unordered_map<string, File>::iterator it = m_files.find(fileName);
+    if(it == m_files.end())
+        return shared_ptr<InputBuffer>();
+
+    if(it->second.state == QUEUED) {
+        // the caller loads it at once rather than waiting for the queue
+        m_queue.erase(std::find(m_queue.begin(), m_queue.end(), fileName));
+        m_files.erase(it);
+        return shared_ptr<InputBuffer>();
+    }
+
+    while(it->second.state != READY) {
+        m_readyCond.wait(lock);
+        it = m_files.find(fileName);
+    }
+
+    shared_ptr<InputBuffer> buffer = it->second.buffer;
+    m_files.erase(it);
+    return buffer;
+}
+
+void Prefetcher::run()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while(true) {
+        while(!m_stop && m_queue.empty())
+            m_queueCond.wait(lock);
+        if(m_stop)
+            break;
+
+        string fileName = m_queue.front();
+        m_queue.pop_front();
+        m_files[fileName].state = LOADING;
+        lock.unlock();
+
+        shared_ptr<InputBuffer> buffer = m_bundle->get_file_buffer(fileName);
+        if(buffer) {
+            // fault in the pages of the mapping here, not in the parser
+            const volatile char* data = buffer->data();
+            size_t size = buffer->size();
+            for(size_t pos = 0; pos < size; pos += PAGE_SIZE)
+                (void) data[pos];
+        }
+
+        lock.lock();
+        File& file = m_files[fileName];
+        file.state = READY;
+        file.buffer = buffer;
+        m_readyCond.notify_all();
+    }
+}
+
+vector<string> Prefetcher::scanInputs(const InputBuffer& buffer)
+{
+    vector<string> names;
+    const char* p = buffer.data();
+    const char* end = p + buffer.size();
+
+    while(p < end) {
+        char c = *p++;
+        if(c == '%') {
+            while(p < end && *p != '\n' && *p != '\r') ++p;
+            continue;
+        } else if(c != '\\') {
+            continue;
+        }
+
+        const char* word = p;
+        while(p < end && isLetter(*p)) ++p;
+        if(!(p - word == 5 && std::equal(word, p, "input")) &&
+                !(p - word == 7 && std::equal(word, p, "include")))
+            continue;
+
+        // the same rules as Parser::parseFileName()
+        while(p < end && isSpace(*p)) ++p;
+        if(p < end && *p == '{') ++p;
+        while(p < end && isSpace(*p)) ++p;
+
+        const char* begin = p;
+        while(p < end && !isSpace(*p) && *p != '\n' && *p != '\r' &&
+                *p != '{' && *p != '}' && *p != '%' && *p != '\\') ++p;
+
+        string name(begin, p);
+        if(!name.empty() && name.find('#') == string::npos)
+            names.push_back(name);
+    }
+
+    return names;
+}
+
+} // namespace texpp
+
@@ -0,0 +1,100 @@
+/*  This file is part of texpp library.
+    Copyright (C) 2009 Vladimir Kuznetsov <ks.vladimir@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef __TEXPP_PREFETCHER_H
+#define __TEXPP_PREFETCHER_H
+
+#include <texpp/common.h>
+#include <texpp/inputbuffer.h>
+
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace texpp {
+
+class Bundle;
+
+/**
+ * @brief loads input files on a worker thread before the parser reaches
+ *      them. Names are resolved by the parser thread; the worker only
+ *      calls Bundle::get_file_buffer(), which must be thread-safe for
+ *      bundles used with the prefetcher.
+ */
+class Prefetcher
+{
+public:
+    typedef shared_ptr<Prefetcher> ptr;
+
+    explicit Prefetcher(shared_ptr<Bundle> bundle);
+    ~Prefetcher();
+
+    /**
+     * @brief queues the file for loading; files requested before are
+     *      ignored
+     */
+    void request(const string& fileName);
+
+    /**
+     * @brief returns the prefetched buffer of the file and forgets it.
+     *      Waits if the file is being loaded right now.
+     * @return empty pointer if the file was not requested, is not loaded
+     *      yet, or the bundle can not provide it as a buffer
+     */
+    shared_ptr<InputBuffer> take(const string& fileName);
+
+    /**
+     * @brief finds literal arguments of \\input and \\include in the text.
+     *      Commented out lines and arguments containing macros are
+     *      skipped.
+     */
+    static vector<string> scanInputs(const InputBuffer& buffer);
+
+protected:
+    void run();
+
+    enum State { QUEUED, LOADING, READY };
+    struct File {
+        State state;
+        shared_ptr<InputBuffer> buffer;
+    };
+
+    shared_ptr<Bundle>      m_bundle;
+
+    std::mutex              m_mutex;
+    std::condition_variable m_queueCond;    // new request or stop
+    std::condition_variable m_readyCond;    // a file is loaded
+    std::deque<string>      m_queue;
+    std::unordered_map<string, File> m_files;
+    std::unordered_set<string> m_requested;
+    bool                    m_stop;
+
+    std::thread             m_thread;
+
+private:
+    Prefetcher(const Prefetcher&);
+    Prefetcher& operator=(const Prefetcher&);
+};
+
+} // namespace texpp
+
+#endif
+
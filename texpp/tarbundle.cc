@@ -0,0 +1,355 @@
+/*  This file is part of texpp library.
+    Copyright (C) 2009 Vladimir Kuznetsov <ks.vladimir@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <texpp/tarbundle.h>
+#include <texpp/inputbuffer.h>
+#include <texpp/kpsewhich.h>
+
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <algorithm>
+
+#include <boost/foreach.hpp>
+#include <boost/algorithm/string/join.hpp>
+
+#include <zlib.h>
+
+namespace texpp {
+
+namespace {
+
+const size_t TAR_BLOCK = 512;
+const size_t READ_CHUNK = 1 << 16;
+
+/**
+ * @brief view of one archive member; keeps the archive alive
+ */
+class MemberInputBuffer: public InputBuffer
+{
+public:
+    MemberInputBuffer(shared_ptr<string> archive, size_t offset, size_t size)
+        : m_archive(archive) {
+        m_data = m_archive->data() + offset;
+        m_size = size;
+    }
+
+protected:
+    shared_ptr<string> m_archive;
+};
+
+// reads the whole file, decompressing it on the fly if it is gzipped
+bool readArchive(const string& fileName, string& data)
+{
+    std::ifstream file(fileName.c_str(), std::ios::in | std::ios::binary);
+    if(!file)
+        return false;
+
+    vector<char> in(READ_CHUNK);
+    vector<char> out(READ_CHUNK);
+
+    file.read(&in[0], in.size());
+    size_t avail = file.gcount();
+
+    if(avail < 2 || (unsigned char)(in[0]) != 0x1f ||
+                    (unsigned char)(in[1]) != 0x8b) {
+        // not compressed
+        while(avail > 0) {
+            data.append(&in[0], avail);
+            file.read(&in[0], in.size());
+            avail = file.gcount();
+        }
+        return !file.bad();
+    }
+
+    z_stream stream;
+    std::memset(&stream, 0, sizeof(stream));
+    if(inflateInit2(&stream, 16 + MAX_WBITS) != Z_OK)
+        return false;
+
+    int ret = Z_OK;
+    while(avail > 0) {
+        stream.next_in = reinterpret_cast<Bytef*>(&in[0]);
+        stream.avail_in = avail;
+
+        while(stream.avail_in > 0) {
+            stream.next_out = reinterpret_cast<Bytef*>(&out[0]);
+            stream.avail_out = out.size();
+
+            ret = inflate(&stream, Z_NO_FLUSH);
+            if(ret != Z_OK && ret != Z_STREAM_END)
+                break;
+            data.append(&out[0], out.size() - stream.avail_out);
+
+            // concatenated gzip members
+            if(ret == Z_STREAM_END && stream.avail_in > 0)
+                inflateReset(&stream);
+        }
+        if(ret != Z_OK && ret != Z_STREAM_END)
+            break;
+
+        file.read(&in[0], in.size());
+        avail = file.gcount();
+    }
+
+    // flush the output which did not fit the last buffer
+    while(ret == Z_OK) {
+        stream.next_out = reinterpret_cast<Bytef*>(&out[0]);
+        stream.avail_out = out.size();
+        ret = inflate(&stream, Z_NO_FLUSH);
+        if(ret != Z_OK && ret != Z_STREAM_END)
+            break;
+        data.append(&out[0], out.size() - stream.avail_out);
+        if(stream.avail_out > 0)
+            break;
+    }
+
+    inflateEnd(&stream);
+    return ret == Z_STREAM_END;
+}
+
+size_t parseOctal(const char* field, size_t len)
+{
+    // GNU base-256 encoding for sizes which do not fit the field
+    if((unsigned char)(field[0]) & 0x80) {
+        size_t value = (unsigned char)(field[0]) & 0x7f;
+        for(size_t n = 1; n < len; ++n)
+            value = (value << 8) | (unsigned char)(field[n]);
+        return value;
+    }
+
+    size_t value = 0;
+    size_t n = 0;
+    while(n < len && field[n] == ' ') ++n;
+    for(; n < len && field[n] >= '0' && field[n] <= '7'; ++n)
+        value = value * 8 + (field[n] - '0');
+    return value;
+}
+
+string parseString(const char* field, size_t len)
+{
+    return string(field, std::find(field, field + len, '\0'));
+}
+
+bool checkHeader(const char* header)
+{
+    size_t sum = 0;
+    for(size_t n = 0; n < TAR_BLOCK; ++n)
+        sum += (n >= 148 && n < 156) ? ' ' : (unsigned char)(header[n]);
+    return sum == parseOctal(header + 148, 8);
+}
+
+bool isZeroBlock(const char* block)
+{
+    for(size_t n = 0; n < TAR_BLOCK; ++n)
+        if(block[n]) return false;
+    return true;
+}
+
+// returns the "path" record of a pax extended header
+string paxPath(const char* data, size_t size)
+{
+    size_t pos = 0;
+    while(pos < size) {
+        size_t len = 0;
+        size_t p = pos;
+        while(p < size && data[p] >= '0' && data[p] <= '9')
+            len = len * 10 + (data[p++] - '0');
+        if(len == 0 || pos + len > size || p >= size || data[p] != ' ')
+            break;
+
+        string record(data + p + 1, data + pos + len);
+        if(!record.empty() && record[record.size()-1] == '\n')
+            record.resize(record.size()-1);
+        if(record.compare(0, 5, "path=") == 0)
+            return record.substr(5);
+
+        pos += len;
+    }
+    return string();
+}
+
+} // namespace
+
+TarBundle::TarBundle(const string& archiveName, const string& mainFileName)
+    : m_archiveName(archiveName), m_mainFileName(mainFileName),
+      m_data(new string), m_valid(false)
+{
+    m_valid = read();
+    if(m_valid && m_mainFileName.empty())
+        findMainFile();
+}
+
+bool TarBundle::read()
+{
+    if(!readArchive(m_archiveName, *m_data))
+        return false;
+
+    if(readTar())
+        return true;
+
+    // a single compressed file
+    m_index.clear();
+    m_members.clear();
+    m_index["main.tex"] = std::make_pair(size_t(0), m_data->size());
+    m_members.push_back("main.tex");
+    return true;
+}
+
+bool TarBundle::readTar()
+{
+    const char* data = m_data->data();
+    size_t size = m_data->size();
+    size_t pos = 0;
+    string longName;
+
+    if(size < TAR_BLOCK || !checkHeader(data))
+        return false;
+
+    while(pos + TAR_BLOCK <= size) {
+        const char* header = data + pos;
+        if(isZeroBlock(header))
+            break;
+        if(!checkHeader(header))
+            return false;
+
+        size_t fileSize = parseOctal(header + 124, 12);
+        size_t offset = pos + TAR_BLOCK;
+        if(offset + fileSize > size || offset + fileSize < offset)
+            return false;
+
+        char type = header[156];
+        if(type == 'L') {
+            // GNU long name of the next member
+            longName = parseString(data + offset, fileSize);
+        } else if(type == 'x') {
+            longName = paxPath(data + offset, fileSize);
+        } else if(type == '0' || type == '\0' || type == '7') {
+            string name = longName;
+            if(name.empty()) {
+                name = parseString(header, 100);
+                if(std::memcmp(header + 257, "ustar", 5) == 0 &&
+                                        header[345] != '\0')
+                    name = parseString(header + 345, 155) + "/" + name;
+            }
+            name = normalizeName(name);
+            if(!name.empty()) {
+                if(m_index.find(name) == m_index.end())
+                    m_members.push_back(name);
+                // later copies of a member replace earlier ones
+                m_index[name] = std::make_pair(offset, fileSize);
+            }
+            longName.clear();
+        } else if(type != 'g') {
+            longName.clear();
+        }
+
+        pos = offset + (fileSize + TAR_BLOCK - 1) / TAR_BLOCK * TAR_BLOCK;
+    }
+
+    return true;
+}
+
+void TarBundle::findMainFile()
+{
+    BOOST_FOREACH(const string& name, m_members) {
+        if(name.size() < 4 || name.compare(name.size()-4, 4, ".tex") != 0)
+            continue;
+        const pair<size_t, size_t>& member = m_index[name];
+        string text(*m_data, member.first, member.second);
+        if(text.find("\\documentclass") != string::npos ||
+                text.find("\\documentstyle") != string::npos) {
+            m_mainFileName = name;
+            return;
+        }
+    }
+}
+
+string TarBundle::normalizeName(const string& fname)
+{
+    vector<string> parts;
+    size_t pos = 0;
+    while(pos <= fname.size()) {
+        size_t end = fname.find('/', pos);
+        if(end == string::npos) end = fname.size();
+        string part = fname.substr(pos, end - pos);
+        if(part == "..") {
+            if(!parts.empty()) parts.pop_back();
+        } else if(!part.empty() && part != ".") {
+            parts.push_back(part);
+        }
+        pos = end + 1;
+    }
+    return boost::join(parts, "/");
+}
+
+bool TarBundle::hasMember(const string& fname) const
+{
+    return m_index.find(normalizeName(fname)) != m_index.end();
+}
+
+shared_ptr<std::istream> TarBundle::get_file(const string& fname)
+{
+    MemberIndex::const_iterator it = m_index.find(normalizeName(fname));
+    shared_ptr<std::istringstream> stream(new std::istringstream);
+    if(it == m_index.end())
+        stream->setstate(std::ios::failbit);
+    else
+        stream->str(m_data->substr(it->second.first, it->second.second));
+    return stream;
+}
+
+shared_ptr<InputBuffer> TarBundle::get_file_buffer(const string& fname)
+{
+    MemberIndex::const_iterator it = m_index.find(normalizeName(fname));
+    if(it == m_index.end())
+        return shared_ptr<InputBuffer>();
+    return shared_ptr<InputBuffer>(new MemberInputBuffer(
+                        m_data, it->second.first, it->second.second));
+}
+
+string TarBundle::get_tex_filename(const string& fname)
+{
+    string name = normalizeName(fname);
+    if(m_index.find(name) != m_index.end())
+        return name;
+    string extended = kpseextend(name);
+    if(m_index.find(extended) != m_index.end())
+        return extended;
+    return name;
+}
+
+string TarBundle::get_bib_filename(const string& fname)
+{
+    string name = normalizeName(fname);
+    if(m_index.find(name) != m_index.end())
+        return name;
+    if(m_index.find(name + ".bbl") != m_index.end())
+        return name + ".bbl";
+
+    // bibtex writes the bibliography to <jobname>.bbl
+    size_t dot = m_mainFileName.rfind('.');
+    string jobBbl = m_mainFileName.substr(0, dot) + ".bbl";
+    if(m_index.find(jobBbl) != m_index.end())
+        return jobBbl;
+
+    return name + ".bbl";
+}
+
+} // namespace texpp
+
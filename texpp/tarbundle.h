@@ -0,0 +1,104 @@
+/*  This file is part of texpp library.
+    Copyright (C) 2009 Vladimir Kuznetsov <ks.vladimir@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef __TEXPP_TARBUNDLE_H
+#define __TEXPP_TARBUNDLE_H
+
+#include <texpp/common.h>
+#include <texpp/parser.h>
+
+#include <unordered_map>
+
+namespace texpp {
+
+/**
+ * @brief bundle serving the files of a tar or tar.gz archive (such as an
+ *      arXiv source package) from memory, without extracting it.
+ *      The archive is decompressed once when the bundle is created and
+ *      the files are looked up in an index of its members. A gzip file
+ *      which does not contain a tar archive is served as a single file
+ *      named main.tex.
+ */
+class TarBundle: public Bundle
+{
+public:
+    typedef shared_ptr<TarBundle> ptr;
+
+    /**
+     * @param archiveName - name of the archive on disk
+     * @param mainFileName - member to parse; when empty the first .tex
+     *      member containing \\documentclass or \\documentstyle is used
+     */
+    explicit TarBundle(const string& archiveName,
+                       const string& mainFileName = string());
+
+    /**
+     * @brief false if the archive can not be read or is corrupted
+     */
+    bool isValid() const { return m_valid; }
+
+    const string& archiveName() const { return m_archiveName; }
+
+    /**
+     * @brief names of the regular files in the archive, in archive order
+     */
+    const vector<string>& members() const { return m_members; }
+    bool hasMember(const string& fname) const;
+
+    string get_mainfile_name() { return m_mainFileName; }
+
+    /**
+     * @brief returns a stream reading the member; the stream is in the
+     *      failed state if there is no such member
+     */
+    shared_ptr<std::istream> get_file(const string& fname);
+
+    /**
+     * @brief returns the member without copying it; thread-safe
+     */
+    shared_ptr<InputBuffer> get_file_buffer(const string& fname);
+
+    string get_bib_filename(const string& fname);
+    string get_tex_filename(const string& fname);
+
+    /**
+     * @brief removes "." and ".." components and leading slashes
+     */
+    static string normalizeName(const string& fname);
+
+protected:
+    bool read();
+    bool readTar();
+    void findMainFile();
+
+    typedef std::unordered_map<
+        string, pair<size_t, size_t>
+    > MemberIndex;  // name -> (offset, size) in m_data
+
+    string              m_archiveName;
+    string              m_mainFileName;
+    shared_ptr<string>  m_data;         // decompressed archive
+    MemberIndex         m_index;
+    vector<string>      m_members;
+    bool                m_valid;
+};
+
+} // namespace texpp
+
+#endif
+
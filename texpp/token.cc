@@ -22,6 +22,12 @@
 
 #include <sstream>
 #include <iomanip>
+#include <cstdlib>
+#include <mutex>
+#include <unordered_map>
+#ifdef WINDOWS
+#include <malloc.h>
+#endif
 
 #include <boost/foreach.hpp>
 #include <boost/lexical_cast.hpp>
@@ -71,12 +77,346 @@ const texpp::string catCodeNames[] = {
     "CC_INVALID",
     "CC_NONE",
 };
+
+// values of the tokens which the lexer creates most often; the
+// references are never dropped, so the strings are never freed
+struct StaticValues {
+    typedef texpp::InternedString InternedString;
+    InternedString::ptr empty;
+    InternedString::ptr chars[256];
+    InternedString::ptr actives[256];
+    InternedString::ptr par;
+
+    StaticValues() {
+        empty = InternedString::intern(texpp::string());
+        for(int n = 0; n < 256; ++n) {
+            chars[n] = InternedString::intern(texpp::string(1, char(n)));
+            actives[n] = InternedString::intern(
+                                texpp::string("`") + char(n));
+        }
+        par = InternedString::intern("\\par");
+    }
+};
+
+const StaticValues& staticValues()
+{
+    static const StaticValues values;
+    return values;
+}
 } // namespace
 
 namespace texpp {
 
+namespace {
+// the strings which are referenced now; a string is removed from the
+// table when its last reference is dropped
+struct InternTable {
+    typedef std::unordered_map<texpp::string,
+                    const texpp::InternedString*> Map;
+    std::mutex mutex;
+    Map map;
+};
+
+InternTable& internTable()
+{
+    static InternTable table;
+    return table;
+}
+} // namespace
+
+InternedString::ptr InternedString::intern(const string& str)
+{
+    InternTable& table = internTable();
+    std::lock_guard<std::mutex> lock(table.mutex);
+    InternTable::Map::iterator it = table.map.find(str);
+    if(it == table.map.end())
+        it = table.map.insert(std::make_pair(str,
+                                new InternedString(str))).first;
+    return ptr(it->second);
+}
+
+InternedString::ptr InternedString::find(const string& str)
+{
+    InternTable& table = internTable();
+    std::lock_guard<std::mutex> lock(table.mutex);
+    InternTable::Map::const_iterator it = table.map.find(str);
+    return it != table.map.end() ? ptr(it->second) : ptr();
+}
+
+void intrusive_ptr_release(const InternedString* str)
+{
+    // the count goes from one to zero only under the lock, as intern()
+    // takes new references to the strings of the table under it
+    unsigned int count = str->m_refCount.load(std::memory_order_relaxed);
+    while(count > 1) {
+        if(str->m_refCount.compare_exchange_weak(count, count - 1,
+                                        std::memory_order_release,
+                                        std::memory_order_relaxed))
+            return;
+    }
+
+    InternTable& table = internTable();
+    std::lock_guard<std::mutex> lock(table.mutex);
+    if(str->m_refCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        table.map.erase(*str);
+        delete str;
+    }
+}
+
 string Token::EMPTY_STRING;
 
+static_assert(sizeof(Token) <= 32, "Token should fit into 32 bytes");
+
+Token::Token(Type type, CatCode catCode,
+            const string& value, const string& source,
+            size_t linePos, size_t lineNo,
+            size_t charPos, size_t charEnd,
+            bool lastInLine, shared_ptr<string> fileName)
+    : m_linePos(linePos), m_lineNo(lineNo),
+      m_charPos(charPos), m_charEnd(charEnd),
+      m_refCount(0), m_fileId(0),
+      m_type(type), m_catCode(catCode), m_lastInLine(lastInLine),
+      m_flags(0)
+{
+    InternedString::ptr interned = internValue(type, value);
+    if(!interned || !source.empty() || fileName) {
+        m_data.text = new Text;
+        m_flags |= HAS_TEXT;
+        m_data.text->value = value;
+        m_data.text->interned = interned;
+        if(!source.empty()) {
+            m_data.text->source = source;
+            m_data.text->hasSource = true;
+        }
+        m_data.text->fileName = fileName;
+    } else {
+        m_data.value = interned.detach();
+        m_flags |= INTERNED | OWNS_VALUE;
+    }
+}
+
+Token::Token(const Token& other)
+    : m_data(other.m_data),
+      m_linePos(other.m_linePos), m_lineNo(other.m_lineNo),
+      m_charPos(other.m_charPos), m_charEnd(other.m_charEnd),
+      m_refCount(0), m_fileId(0),
+      m_type(other.m_type), m_catCode(other.m_catCode),
+      m_lastInLine(other.m_lastInLine),
+      m_flags(other.m_flags & VALUE_FLAGS)
+{
+    if(m_flags & HAS_TEXT) {
+        m_data.text = new Text(*other.m_data.text);
+    } else if(m_flags & INTERNED) {
+        // the copy can outlive the arena of other
+        intrusive_ptr_add_ref(interned());
+        m_flags |= OWNS_VALUE;
+    }
+
+    if(other.m_fileId) {
+        // the copy can outlive the arena of other
+        Text* t = text();
+        if(!t->hasSource) {
+            t->source = other.source();
+            t->hasSource = !t->source.empty();
+        }
+        t->fileName = other.fileNamePtr();
+    }
+}
+
+Token& Token::operator=(const Token& other)
+{
+    if(this != &other) {
+        Token copy(other);
+        std::swap(m_data, copy.m_data);
+        std::swap(m_linePos, copy.m_linePos);
+        std::swap(m_lineNo, copy.m_lineNo);
+        std::swap(m_charPos, copy.m_charPos);
+        std::swap(m_charEnd, copy.m_charEnd);
+        std::swap(m_fileId, copy.m_fileId);
+
+        // bit fields can not be swapped with std::swap
+        unsigned char type = m_type, catCode = m_catCode,
+                      lastInLine = m_lastInLine, flags = m_flags & VALUE_FLAGS;
+        m_type = copy.m_type;
+        m_catCode = copy.m_catCode;
+        m_lastInLine = copy.m_lastInLine;
+        m_flags = (m_flags & ~VALUE_FLAGS) | (copy.m_flags & VALUE_FLAGS);
+        copy.m_type = type;
+        copy.m_catCode = catCode;
+        copy.m_lastInLine = lastInLine;
+        copy.m_flags = (copy.m_flags & ~VALUE_FLAGS) | flags;
+    }
+    return *this;
+}
+
+void Token::destroy() const
+{
+    if(m_flags & IN_ARENA) {
+        TokenArena* arena = TokenArena::of(this);
+        this->~Token();
+        arena->deallocate(const_cast<Token*>(this));
+    } else {
+        delete this;
+    }
+}
+
+Token::Text* Token::text()
+{
+    if(!(m_flags & HAS_TEXT)) {
+        Text* t = new Text;
+        t->value = *m_data.value;
+        if(m_flags & INTERNED) // takes the reference of the token, if any
+            t->interned.reset(interned(), !(m_flags & OWNS_VALUE));
+        m_data.text = t;
+        m_flags = (m_flags & ~(INTERNED | OWNS_VALUE)) | HAS_TEXT;
+    }
+    return m_data.text;
+}
+
+const shared_ptr<string>& Token::fileNamePtr() const
+{
+    static const shared_ptr<string> noFile;
+    if(m_fileId)
+        return sourceFile()->namePtr();
+    else if(m_flags & HAS_TEXT)
+        return m_data.text->fileName;
+    return noFile;
+}
+
+const InternedString* Token::staticValue(const string& value)
+{
+    const StaticValues& values = staticValues();
+    if(value.empty())
+        return values.empty.get();
+    else if(value.size() == 1)
+        return values.chars[(unsigned char) value[0]].get();
+    else if(value.size() == 2 && value[0] == '`')
+        return values.actives[(unsigned char) value[1]].get();
+    else if(value == *values.par)
+        return values.par.get();
+    return NULL;
+}
+
+const InternedString* Token::staticValue(char ch)
+{
+    return staticValues().chars[(unsigned char) ch].get();
+}
+
+InternedString::ptr Token::internValue(Type type, const string& value)
+{
+    InternedString::ptr interned(staticValue(value));
+    if(!interned && type != TOK_SKIPPED)
+        interned = InternedString::intern(value);
+    return interned;
+}
+
+const InternedString* Token::internOwnValue()
+{
+    Text* t = text();
+    if(!t->interned)
+        t->interned = InternedString::intern(t->value);
+    return t->interned.get();
+}
+
+void Token::setValue(const string& value)
+{
+    InternedString::ptr interned = internValue(type(), value);
+    if(interned && !(m_flags & HAS_TEXT)) {
+        if(m_flags & OWNS_VALUE)
+            intrusive_ptr_release(this->interned());
+        m_data.value = interned.detach();
+        m_flags |= INTERNED | OWNS_VALUE;
+    } else {
+        Text* t = text();
+        t->value = value;
+        t->interned = interned;
+    }
+}
+
+string Token::source() const
+{
+    string str;
+    appendSource(str);
+    return str;
+}
+
+void Token::setSource(const string& source)
+{
+    Text* t = text();
+    t->source = source;
+    t->hasSource = true;
+    t->sourceTokens.reset();
+}
+
+void Token::setSourceTokens(const shared_ptr<const list>& tokens)
+{
+    Text* t = text();
+    t->source.clear();
+    t->hasSource = false;
+    t->sourceTokens = tokens;
+}
+
+void Token::appendSource(string& str) const
+{
+    if((m_flags & HAS_TEXT) && m_data.text->hasSource) {
+        str += m_data.text->source;
+    } else if(const list* tokens = sourceTokens()) {
+        BOOST_FOREACH(const Token::ptr& token, *tokens)
+            token->appendSource(str);
+    } else if(m_fileId && m_charEnd > m_charPos) {
+        const InputBuffer& buffer = *sourceFile()->buffer();
+        size_t begin = std::min(size_t(m_linePos + m_charPos), buffer.size());
+        size_t end = std::min(size_t(m_linePos + m_charEnd), buffer.size());
+        str.append(buffer.data() + begin, end - begin);
+    }
+}
+
+void Token::appendSource(string& str, const string& fileName) const
+{
+    if(const list* tokens = sourceTokens()) {
+        BOOST_FOREACH(const Token::ptr& token, *tokens)
+            token->appendSource(str, fileName);
+    } else if(this->fileName() == fileName) {
+        appendSource(str);
+    }
+}
+
+Token::ptr Token::lcopy() const
+{
+    if(!(m_flags & IN_ARENA)) {
+        return Token::ptr(new Token(type(), catCode(), value(), string(),
+                                0, 0, 0, 0,
+                                //m_lineNo, m_charEnd, m_charEnd,
+                                m_lastInLine, fileNamePtr()));
+    }
+
+    // copies of the tokens from the arena go to the same arena
+    TokenArena* arena = TokenArena::of(this);
+    if(!(m_flags & HAS_TEXT)) {
+        if(m_flags & OWNS_VALUE)
+            arena->holdName(interned());
+        Token::ptr token = arena->create(type(), catCode(),
+                        m_data.value, 0, 0, 0, 0, bool(m_lastInLine),
+                        unsigned(m_fileId));
+        token->m_flags |= m_flags & INTERNED;
+        return token;
+    }
+
+    const Text* t = m_data.text;
+    if(t->interned)
+        arena->holdName(t->interned.get());
+    Token::ptr token = arena->create(type(), catCode(),
+                        t->interned ? t->interned.get() : &EMPTY_STRING,
+                        0, 0, 0, 0, bool(m_lastInLine), unsigned(m_fileId));
+    if(t->interned)
+        token->m_flags |= INTERNED;
+    else
+        token->setValue(t->value);
+    if(t->fileName)
+        token->text()->fileName = t->fileName;
+    return token;
+}
+
 string Token::texReprControl(const string& commandName,
                              Parser* parser, bool space)
 {
@@ -90,7 +430,7 @@ string Token::texReprControl(const string& commandName,
                 str += "csname" + escape + "endcsname";
             }
             if(space && (str.size() > 2 || Token::CC_LETTER == parser->symbol(
-                 "catcode" + boost::lexical_cast<string>(int(str[1])), int(0)))) {
+                 SymbolKey(SymbolKey::CATCODE, int(str[1])), int(0)))) {
                 str += ' ';
             }
         } else if(str[0] == '`') {
@@ -123,9 +463,9 @@ string Token::texReprList(const Token::list& tokens,
 string Token::texRepr(Parser* parser) const
 {
     if(isControl()) {
-        return Token::texReprControl(m_value, parser);
+        return Token::texReprControl(value(), parser);
     } else if(isCharacter()) {
-        return m_value;
+        return value();
     } else {
         return string();
     }
@@ -134,7 +474,7 @@ string Token::texRepr(Parser* parser) const
 string Token::meaning(Parser* parser) const
 {
     if(isCharacter()) {
-        return catCodeLongNames[m_catCode] + " " + m_value;
+        return catCodeLongNames[m_catCode] + " " + value();
     } else if(isControl()) {
         return texRepr(parser);
     } else if(isSkipped()) {
@@ -148,8 +488,8 @@ string Token::repr() const
     std::ostringstream r;
     r << "Token(Token::" << (m_type < 3 ? typeNames[m_type] : "")
       << ", Token::" << (m_catCode < 16 ? catCodeNames[m_catCode] : "")
-      << ", " << reprString(m_value)
-      << ", " << reprString(m_source)
+      << ", " << reprString(value())
+      << ", " << reprString(source())
       << ", " << m_linePos << ", " << m_lineNo
       << ", " << m_charPos << ", " << m_charEnd << ")";
       //<< ", \"" << reprString(source()) << "\")";
@@ -157,5 +497,82 @@ string Token::repr() const
     return r.str();
 }
 
-} // namespace texpp
+static_assert(alignof(Token) <= TokenArena::HEADER_SIZE,
+              "tokens must not overlap the block header");
+
+TokenArena::TokenArena()
+    : m_refCount(0), m_next(NULL), m_end(NULL), m_free(NULL),
+      m_files(1)    // index 0 means "no file"
+{
+}
+
+TokenArena::~TokenArena()
+{
+    BOOST_FOREACH(const InternedString* name, m_names)
+        intrusive_ptr_release(name);
+
+    BOOST_FOREACH(void* block, m_blocks) {
+#ifndef WINDOWS
+        std::free(block);
+#else
+        _aligned_free(block);
+#endif
+    }
+}
+
+void* TokenArena::newBlock()
+{
+    m_blocks.reserve(m_blocks.size() + 1);
 
+    void* block = NULL;
+#ifndef WINDOWS
+    if(::posix_memalign(&block, BLOCK_SIZE, BLOCK_SIZE) != 0)
+        block = NULL;
+#else
+    block = _aligned_malloc(BLOCK_SIZE, BLOCK_SIZE);
+#endif
+    if(!block)
+        throw std::bad_alloc();
+
+    // the header of the block lets TokenArena::of() find the arena
+    *static_cast<TokenArena**>(block) = this;
+    m_blocks.push_back(block);
+
+    m_next = static_cast<char*>(block) + HEADER_SIZE;
+    m_end = static_cast<char*>(block) + BLOCK_SIZE;
+    return block;
+}
+
+unsigned int TokenArena::addFile(const shared_ptr<SourceFile>& file)
+{
+    if(m_files.size() > 0xffff)
+        return 0;
+    m_files.push_back(file);
+    return m_files.size() - 1;
+}
+
+void* TokenArena::allocate()
+{
+    void* slot;
+    if(m_free) {
+        slot = m_free;
+        m_free = m_free->next;
+    } else {
+        if(size_t(m_end - m_next) < sizeof(Token))
+            newBlock();
+        slot = m_next;
+        m_next += sizeof(Token);
+    }
+    ++m_refCount;   // the token keeps the arena alive
+    return slot;
+}
+
+void TokenArena::deallocate(void* slot)
+{
+    FreeSlot* freeSlot = static_cast<FreeSlot*>(slot);
+    freeSlot->next = m_free;
+    m_free = freeSlot;
+    intrusive_ptr_release(this);    // may delete the arena
+}
+
+} // namespace texpp
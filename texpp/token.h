@@ -20,12 +20,59 @@
 #define __TEXPP_TOKEN_H
 
 #include <texpp/common.h>
+#include <texpp/inputbuffer.h>
 #include <boost/pool/singleton_pool.hpp>
+#include <atomic>
+#include <deque>
+#include <new>
+#include <unordered_set>
+#include <utility>
+#include <stdint.h>
 
 namespace texpp {
 
 class Parser;
+class Lexer;
 class Token;
+class TokenArena;
+
+/**
+ * @brief string interned for the whole process. Equal strings are
+ *      interned once, so the parser can key the symbols by the address
+ *      of the name instead of hashing the names of control sequences.
+ *      The strings are reference counted and freed with the last
+ *      reference; tokens, token arenas and symbol tables hold them.
+ */
+class InternedString: public string
+{
+public:
+    typedef intrusive_ptr<const InternedString> ptr;
+
+    /**
+     * @brief returns the interned string equal to str. Can be called
+     *      from any thread.
+     */
+    static ptr intern(const string& str);
+
+    /**
+     * @brief returns the interned string equal to str, or an empty
+     *      pointer if str is not interned now
+     */
+    static ptr find(const string& str);
+
+    friend void intrusive_ptr_add_ref(const InternedString* str) {
+        str->m_refCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    friend void intrusive_ptr_release(const InternedString* str);
+
+private:
+    explicit InternedString(const string& str): string(str), m_refCount(0) {}
+    InternedString(const InternedString&);
+    InternedString& operator=(const InternedString&);
+
+    mutable std::atomic<unsigned int> m_refCount;
+};
 
 /**
  * @brief The Token class designet to store single semantic objects used in
@@ -40,7 +87,7 @@ class Token;
 class Token
 {
 public:
-    typedef shared_ptr<Token> ptr;
+    typedef intrusive_ptr<Token> ptr;
     typedef vector<Token::ptr> list;
     typedef shared_ptr<list> list_ptr;
 
@@ -84,15 +131,26 @@ public:
             size_t linePos = 0, size_t lineNo = 0,
             size_t charPos = 0, size_t charEnd = 0,
             bool lastInLine = false,
-            shared_ptr<string> fileName = shared_ptr<string>())
-        : m_type(type), m_catCode(catCode), m_value(value), m_source(source),
-          m_linePos(linePos), m_lineNo(lineNo),
-          m_charPos(charPos), m_charEnd(charEnd),
-          m_lastInLine(lastInLine), m_fileName(fileName) {}
+            shared_ptr<string> fileName = shared_ptr<string>());
+
+    /**
+     * @brief copy constructor. The copy does not refer to the file table
+     *      of the arena: the source and the file name of the token read
+     *      from the file are copied into the new token.
+     */
+    Token(const Token& other);
+    Token& operator=(const Token& other);
+    ~Token() {
+        if(m_flags & HAS_TEXT)
+            delete m_data.text;
+        else if(m_flags & OWNS_VALUE)
+            intrusive_ptr_release(interned());
+    }
 
     /**
-     * @brief Token pointer constructor. Create Token object and return shared
-     *      pointer on object
+     * @brief Token pointer constructor. Create Token object on the heap
+     *      and return pointer on object. Tokens of the parsed files are
+     *      created by TokenArena::create() instead.
      */
     static Token::ptr create(Type type = TOK_SKIPPED,
             CatCode catCode = CC_INVALID,
@@ -108,17 +166,65 @@ public:
 
     //! @page Setters and Getters
 
-    Type type() const { return m_type; }
+    Type type() const { return Type(m_type); }
     void setType(Type type) { m_type = type; }
 
-    CatCode catCode() const { return m_catCode; }
+    CatCode catCode() const { return CatCode(m_catCode); }
     void setCatCode(CatCode catCode) { m_catCode = catCode; }
 
-    const string& value() const { return m_value; }
-    void setValue(const string& value) { m_value = value; }
+    const string& value() const {
+        return (m_flags & HAS_TEXT) ? m_data.text->value : *m_data.value;
+    }
+    void setValue(const string& value);
+
+    /**
+     * @brief value of the token as an interned string, valid as long as
+     *      the token exists. The values of control sequences are interned
+     *      when the token is created, so this is a plain field read for
+     *      them; other values are interned and kept by the token on the
+     *      first call.
+     */
+    const InternedString* internedValue() const {
+        if(m_flags & HAS_TEXT) {
+            if(m_data.text->interned)
+                return m_data.text->interned.get();
+        } else if(m_flags & INTERNED) {
+            return interned();
+        }
+        return const_cast<Token*>(this)->internOwnValue();
+    }
+
+    /**
+     * @brief token's origin text. For the tokens read from the file it is
+     *      cut from the text of the file on request.
+     */
+    string source() const;
+    void setSource(const string& source);
+
+    /**
+     * @brief appends source() to str
+     */
+    void appendSource(string& str) const;
+
+    /**
+     * @brief appends the part of source() which comes from the file
+     *      fileName to str
+     */
+    void appendSource(string& str, const string& fileName) const;
 
-    const string& source() const { return m_source; }
-    void setSource(const string& source) { m_source = source; }
+    /**
+     * @brief sets the source of the token to the sources of the given
+     *      tokens. It is concatenated only when it is read, and each
+     *      part keeps its own file.
+     */
+    void setSourceTokens(const shared_ptr<const list>& tokens);
+
+    /**
+     * @brief tokens set by setSourceTokens() or NULL
+     */
+    const list* sourceTokens() const {
+        return (m_flags & HAS_TEXT) ? m_data.text->sourceTokens.get() : NULL;
+    }
 
     size_t linePos() const { return m_linePos; }
     void setLinePos(size_t linePos) { m_linePos = linePos; }
@@ -154,7 +260,7 @@ public:
      */
     bool isCharacter(char checkChar) const {
         return m_type == TOK_CHARACTER &&
-                m_value[0] == checkChar;
+                value()[0] == checkChar;
     }
 
     /**
@@ -164,7 +270,7 @@ public:
      */
     bool isCharacter(char checkChar, CatCode cat) const {
         return m_type == TOK_CHARACTER &&
-                m_value[0] == checkChar &&
+                value()[0] == checkChar &&
                 m_catCode == cat;
     }
 
@@ -183,19 +289,35 @@ public:
      */
     bool isLastInLine() const { return m_lastInLine; }
 
+    /**
+     * @brief the parser does not expand the token while it is marked,
+     *      see Parser::addNoexpand()
+     */
+    bool isNoexpand() const { return m_flags & NOEXPAND; }
+    void setNoexpand(bool noexpand) {
+        if(noexpand) m_flags |= NOEXPAND;
+        else m_flags &= ~NOEXPAND;
+    }
+
     /**
      * @brief return source file name for token
      * @return address of source file name
      */
     const string& fileName() const {
-        return m_fileName ? *m_fileName : EMPTY_STRING;
+        const shared_ptr<string>& name = fileNamePtr();
+        return name ? *name : EMPTY_STRING;
     }
 
     /**
-     * @brief return pointer to name of token's source file. Getter for
-     *      m_fileName varable
+     * @brief return pointer to name of token's source file
      */
-    shared_ptr<string> fileNamePtr() const { return m_fileName; }
+    const shared_ptr<string>& fileNamePtr() const;
+
+    /**
+     * @brief the file of the token read from the file (or NULL); such
+     *      tokens are kept by the TokenArena which created them
+     */
+    const SourceFile* sourceFile() const;
 
     /**
      * @brief represent m_value of token
@@ -229,11 +351,7 @@ public:
      *  - charEnd
      * @return pointer to the token
      */
-    Token::ptr lcopy() const {
-        return Token::create(m_type, m_catCode, m_value, "", 0, 0, 0, 0,
-            //m_lineNo, m_charEnd, m_charEnd,
-            m_lastInLine, m_fileName);
-    }
+    Token::ptr lcopy() const;
 
     /**
      * @brief represent commandName. Assumed that string name is name of command.
@@ -276,24 +394,309 @@ public:
     static string texReprList(const Token::list& tokens,
             Parser* parser = NULL, bool param = false, size_t limit = 0);
 
+    /**
+     * @brief returns static copy of one of the values often used by
+     *      the lexer (characters, active characters, "\\par"), or NULL.
+     *      Static values are interned and never freed.
+     */
+    static const InternedString* staticValue(const string& value);
+    static const InternedString* staticValue(char ch);
+
+    /**
+     * @brief Token::ptr reference counting. The counter is not atomic:
+     *      tokens of one parse must be used from one thread at a time.
+     */
+    friend void intrusive_ptr_add_ref(const Token* token) {
+        ++token->m_refCount;
+    }
+
+    friend void intrusive_ptr_release(const Token* token) {
+        if(--token->m_refCount == 0)
+            token->destroy();
+    }
+
 protected:
-    Type        m_type;     //!< type of token
-    CatCode     m_catCode;  //!< category code for token
-    string      m_value;    //!< meaning(semantic) of token
-    string      m_source;   //!< token's origin text
+    friend class Lexer;
+    friend class TokenArena;
+
+    /**
+     * @brief constructor of the token read from the file. The value must
+     *      be owned by the file (or be interned), the source is the text of
+     *      the file between (linePos + charPos) and (linePos + charEnd).
+     *      The file is given by its index in the file table of the arena,
+     *      so such tokens can only be created by TokenArena::create().
+     */
+    Token(Type type, CatCode catCode, const string* value,
+            size_t linePos, size_t lineNo, size_t charPos, size_t charEnd,
+            bool lastInLine, unsigned int fileId)
+        : m_linePos(linePos), m_lineNo(lineNo),
+          m_charPos(charPos), m_charEnd(charEnd),
+          m_refCount(0), m_fileId(fileId),
+          m_type(type), m_catCode(catCode), m_lastInLine(lastInLine),
+          m_flags(0) { m_data.value = value; }
+
+    void destroy() const;
+
+    /**
+     * @brief interned value for a token of the given type: static values
+     *      and values of all tokens except the skipped ones are interned,
+     *      the skipped ones (comments) are rarely used as names.
+     *      Returns an empty pointer if the value should not be interned.
+     */
+    static InternedString::ptr internValue(Type type, const string& value);
+
+    /**
+     * @brief interns the value of the token, see internedValue()
+     */
+    const InternedString* internOwnValue();
+
+    /**
+     * @brief m_data.value of the token with the INTERNED flag
+     */
+    const InternedString* interned() const {
+        return static_cast<const InternedString*>(m_data.value);
+    }
+
+    enum Flags {
+        IN_ARENA = 1,   //!< token is allocated by TokenArena
+        HAS_TEXT = 2,   //!< m_data.text is used instead of m_data.value
+        INTERNED = 4,   //!< m_data.value is an InternedString
+        NOEXPAND = 8,   //!< marked by setNoexpand()
+        OWNS_VALUE = 16,    //!< the interned m_data.value is referenced
+                            //!< by the token, not by its arena
+        VALUE_FLAGS = HAS_TEXT | INTERNED | OWNS_VALUE
+    };
+
+    /**
+     * @brief value, source and file name of the token which are not
+     *      backed by the file (for example of tokens created by the parser)
+     */
+    struct Text {
+        Text(): hasSource(false) {}
+        string  value;
+        InternedString::ptr interned;   //!< value if it is interned
+        string  source;
+        bool    hasSource;
+        shared_ptr<const list> sourceTokens;   //!< source, if not hasSource
+        shared_ptr<string> fileName;
+    };
+
+    Text* text();
+
+    union Data {
+        const string* value;    //!< interned string or string owned by
+                                //!< the file of the token; the interned
+                                //!< strings of the tokens created by the
+                                //!< lexer are referenced by the arena
+        Text* text;             //!< owned value and source
+    };
+
+    // The fields are ordered to pack the token into 32 bytes; positions
+    // are limited to 4G, which is enough for any sensible TeX file.
+    Data        m_data;     //!< meaning(semantic) of token
 
-    size_t      m_linePos;  //!< total number of symbols above current line
-    size_t      m_lineNo;   //!< current line number in source file
-    size_t      m_charPos;  //!< position of tekon`s begin (on current line)
-    size_t      m_charEnd;  //!< position of token`s end (on current line)
+    uint32_t    m_linePos;  //!< total number of symbols above current line
+    uint32_t    m_lineNo;   //!< current line number in source file
+    uint32_t    m_charPos;  //!< position of tekon`s begin (on current line)
+    uint32_t    m_charEnd;  //!< position of token`s end (on current line)
 
-    bool        m_lastInLine;   //!< ID: is this Token the last in the line
+    mutable uint32_t m_refCount;    //!< number of Token::ptr to token
+    uint16_t    m_fileId;   //!< index in the file table of the arena
+                            //!< or 0 if the token is not read from a file
 
-    shared_ptr<string> m_fileName;  //!< tex file name - source file for this token
+    unsigned char m_type: 2;        //!< type of token
+    unsigned char m_catCode: 5;     //!< category code for token
+    unsigned char m_lastInLine: 1;  //!< ID: is this Token the last in the line
+    unsigned char m_flags;          //!< Flags
 
     static string EMPTY_STRING;
 };
 
+/**
+ * @brief storage for all tokens of one parse. Tokens are placed one after
+ *      another in large blocks instead of being allocated one by one; the
+ *      memory of the destroyed tokens is reused for the new ones and all
+ *      blocks are freed at once when the arena and all its tokens are gone.
+ *      Each live token keeps the arena alive.
+ */
+class TokenArena
+{
+public:
+    typedef intrusive_ptr<TokenArena> ptr;
+
+    enum {
+        BLOCK_SIZE = 64*1024,   //!< size and alignment of the blocks
+        HEADER_SIZE = 64        //!< space reserved at the block start
+    };
+
+    TokenArena();
+    ~TokenArena();
+
+    /**
+     * @brief constructs a token in the arena
+     */
+    template<typename... Args>
+    Token::ptr create(Args&&... args) {
+        Token* token = new (allocate()) Token(std::forward<Args>(args)...);
+        token->m_flags |= Token::IN_ARENA;
+        return Token::ptr(token);
+    }
+
+    /**
+     * @brief adds the file to the file table of the arena
+     * @return index of the file in the table, or 0 if the table is full
+     */
+    unsigned int addFile(const shared_ptr<SourceFile>& file);
+
+    /**
+     * @brief keeps the interned string until the arena is freed. The
+     *      tokens of the arena refer to such strings without counting
+     *      the references one by one.
+     */
+    void holdName(const InternedString* name) {
+        if(m_names.insert(name).second)
+            intrusive_ptr_add_ref(name);
+    }
+
+    /**
+     * @brief returns the file by its index in the file table
+     */
+    const shared_ptr<SourceFile>& file(unsigned int fileId) const {
+        return m_files[fileId];
+    }
+
+    /**
+     * @brief number of entries in the file table
+     */
+    size_t fileCount() const { return m_files.size(); }
+
+    /**
+     * @brief number of blocks allocated by the arena
+     */
+    size_t blockCount() const { return m_blocks.size(); }
+
+    /**
+     * @brief returns the arena of the token created by create()
+     */
+    static TokenArena* of(const Token* token) {
+        return *reinterpret_cast<TokenArena* const*>(
+                reinterpret_cast<size_t>(token) & ~size_t(BLOCK_SIZE - 1));
+    }
+
+    friend void intrusive_ptr_add_ref(TokenArena* arena) {
+        ++arena->m_refCount;
+    }
+
+    friend void intrusive_ptr_release(TokenArena* arena) {
+        if(--arena->m_refCount == 0)
+            delete arena;
+    }
+
+protected:
+    friend class Token;
+
+    void* allocate();
+    void deallocate(void* slot);
+    void* newBlock();
+
+    struct FreeSlot { FreeSlot* next; };
+
+    unsigned int    m_refCount; //!< owners of the arena and live tokens
+    vector<void*>   m_blocks;
+    char*           m_next;     //!< first never used slot of the last block
+    char*           m_end;      //!< end of the last block
+    FreeSlot*       m_free;     //!< slots of the destroyed tokens
+    vector<shared_ptr<SourceFile> > m_files;    //!< files of the tokens
+    std::unordered_set<const InternedString*> m_names;  //!< see holdName()
+
+private:
+    TokenArena(const TokenArena&);
+    TokenArena& operator=(const TokenArena&);
+};
+
+inline const SourceFile* Token::sourceFile() const
+{
+    return m_fileId ? TokenArena::of(this)->file(m_fileId).get() : NULL;
+}
+
+/**
+ * @brief tokens waiting to be read by the parser before the input. Like
+ *      the input stack of TeX it is a stack of frames: a frame is either
+ *      one token or a range of a shared token list (for example the result
+ *      of a macro expansion), which is pushed at once and read by moving
+ *      a cursor. The lists of the frames must not be changed.
+ */
+class TokenQueue
+{
+public:
+    typedef shared_ptr<const Token::list> list_ptr;
+
+    bool empty() const { return m_frames.empty(); }
+
+    const Token::ptr& front() const {
+        const Frame& frame = m_frames.back();
+        return frame.list ? (*frame.list)[frame.pos] : frame.token;
+    }
+
+    void pop_front() {
+        Frame& frame = m_frames.back();
+        if(!frame.list || ++frame.pos == frame.list->size())
+            m_frames.pop_back();
+    }
+
+    /**
+     * @brief removes the first token and returns it
+     */
+    Token::ptr take() {
+        Frame& frame = m_frames.back();
+        if(!frame.list) {
+            Token::ptr token(std::move(frame.token));
+            m_frames.pop_back();
+            return token;
+        }
+        Token::ptr token((*frame.list)[frame.pos]);
+        if(++frame.pos == frame.list->size())
+            m_frames.pop_back();
+        return token;
+    }
+
+    void push_front(const Token::ptr& token) {
+        m_frames.push_back(Frame());
+        m_frames.back().token = token;
+    }
+
+    /**
+     * @brief inserts the tokens of the list starting from pos before
+     *      the other tokens without copying them
+     */
+    void push_front(const list_ptr& list, size_t pos = 0) {
+        if(pos < list->size()) {
+            m_frames.push_back(Frame());
+            m_frames.back().list = list;
+            m_frames.back().pos = pos;
+        }
+    }
+
+    void push_back(const Token::ptr& token) {
+        m_frames.push_front(Frame());
+        m_frames.front().token = token;
+    }
+
+    void clear() { m_frames.clear(); }
+    void swap(TokenQueue& other) { m_frames.swap(other.m_frames); }
+
+protected:
+    struct Frame {
+        Frame(): pos(0) {}
+        Token::ptr  token;  //!< the token, if list is empty
+        list_ptr    list;
+        size_t      pos;    //!< the next token of the list
+    };
+
+    // the first token is in the last frame; tokens are added at both ends
+    std::deque<Frame> m_frames;
+};
+
 } // namespace texpp
 
 #endif
@@ -0,0 +1,126 @@
+/*  This file is part of texpp library.
+    Copyright (C) 2009 Vladimir Kuznetsov <ks.vladimir@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#include <texpp/value.h>
+#include <texpp/command.h>
+
+#include <texpp/base/dimen.h>
+#include <texpp/base/glue.h>
+#include <texpp/base/box.h>
+#include <texpp/base/font.h>
+#include <texpp/base/parshape.h>
+
+namespace texpp {
+
+namespace {
+
+typedef shared_ptr<const void> SharedPtr;
+
+template<typename T>
+inline void copyAs(char* data, const char* other)
+{
+    new (data) T(*reinterpret_cast<const T*>(other));
+}
+
+template<typename T>
+inline void destroyAs(char* data)
+{
+    reinterpret_cast<T*>(data)->~T();
+}
+
+} // namespace
+
+void Value::construct(const any& value)
+{
+    new (m_data) SharedPtr(boost::make_shared<any>(value));
+}
+
+void Value::copy(const Value& other)
+{
+    switch(other.m_type) {
+        case TOKEN: copyAs<Token::ptr>(m_data, other.m_data); break;
+        case COMMAND: copyAs<Command::ptr>(m_data, other.m_data); break;
+        case FONT: copyAs<base::FontInfo::ptr>(m_data, other.m_data); break;
+        case TOKEN_LIST_PTR:
+            copyAs<Token::list_ptr>(m_data, other.m_data); break;
+        default: copyAs<SharedPtr>(m_data, other.m_data); break;
+    }
+}
+
+void Value::destroy()
+{
+    switch(m_type) {
+        case TOKEN: destroyAs<Token::ptr>(m_data); break;
+        case COMMAND: destroyAs<Command::ptr>(m_data); break;
+        case FONT: destroyAs<base::FontInfo::ptr>(m_data); break;
+        case TOKEN_LIST_PTR: destroyAs<Token::list_ptr>(m_data); break;
+        default: destroyAs<SharedPtr>(m_data); break;
+    }
+    m_type = EMPTY;
+}
+
+any Value::toAny() const
+{
+    switch(m_type) {
+        case EMPTY: return any();
+        case INT: return *get<int>();
+        case DIMEN: return *get<base::Dimen>();
+        case TOKEN: return *get<Token::ptr>();
+        case COMMAND: return *get<Command::ptr>();
+        case FONT: return *get<base::FontInfo::ptr>();
+        case TOKEN_LIST_PTR: return *get<Token::list_ptr>();
+        case GLUE: return *get<base::Glue>();
+        case STRING: return *get<string>();
+        case TOKEN_LIST: return *get<Token::list>();
+        case BOX: return *get<base::Box>();
+        case PARSHAPE: return *get<base::ParshapeInfo>();
+        case OTHER: break;
+    }
+    return *SharedValueTraits<any, OTHER>::get(m_data);
+}
+
+bool Value::same(const Value& other) const
+{
+    if(m_type != other.m_type)
+        return false;
+
+    switch(m_type) {
+        case EMPTY: return true;
+        case INT: return *get<int>() == *other.get<int>();
+        case DIMEN:
+            return get<base::Dimen>()->value == other.get<base::Dimen>()->value;
+        case TOKEN: return *get<Token::ptr>() == *other.get<Token::ptr>();
+        case COMMAND: return *get<Command::ptr>() == *other.get<Command::ptr>();
+        case FONT:
+            return *get<base::FontInfo::ptr>() ==
+                        *other.get<base::FontInfo::ptr>();
+        case TOKEN_LIST_PTR:
+            return *get<Token::list_ptr>() == *other.get<Token::list_ptr>();
+        default: break;
+    }
+    return *reinterpret_cast<const SharedPtr*>(m_data) ==
+                *reinterpret_cast<const SharedPtr*>(other.m_data);
+}
+
+string Value::repr() const
+{
+    return reprAny(toAny());
+}
+
+} // namespace texpp
+
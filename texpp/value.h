@@ -0,0 +1,235 @@
+/*  This file is part of texpp library.
+    Copyright (C) 2009 Vladimir Kuznetsov <ks.vladimir@gmail.com>
+
+    This library is free software; you can redistribute it and/or
+    modify it under the terms of the GNU Lesser General Public
+    License as published by the Free Software Foundation; either
+    version 2.1 of the License, or (at your option) any later version.
+
+    This library is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+    Lesser General Public License for more details.
+
+    You should have received a copy of the GNU Lesser General Public
+    License along with this library; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+*/
+
+#ifndef __TEXPP_VALUE_H
+#define __TEXPP_VALUE_H
+
+#include <texpp/common.h>
+#include <texpp/token.h>
+
+#include <boost/make_shared.hpp>
+#include <cstring>
+#include <new>
+
+namespace texpp {
+
+class Command;
+
+namespace base {
+    struct Dimen;
+    struct Glue;
+    struct Box;
+    struct ParshapeInfo;
+    struct FontInfo;
+} // namespace base
+
+template<typename T> struct ValueTraits;
+
+/**
+ * @brief value of a parser symbol or of a node. The types used by the
+ *      parser are tagged by the Type enumeration: testing the type is an
+ *      integer comparison, and ints, dimens and pointers are stored in
+ *      the value itself, so assigning them does not allocate. Bigger
+ *      values (glue, strings, token lists, boxes) are allocated once and
+ *      shared by the copies. Values of any other type (for example the
+ *      objects set from python) are stored in boost::any.
+ */
+class Value
+{
+public:
+    enum Type {
+        EMPTY, INT, DIMEN,      // stored in place, copied bitwise
+        TOKEN,                  // Token::ptr
+        COMMAND,                // Command::ptr
+        FONT,                   // shared_ptr<base::FontInfo>
+        TOKEN_LIST_PTR,         // Token::list_ptr
+        GLUE, STRING, TOKEN_LIST, BOX, PARSHAPE,
+        OTHER                   // boost::any
+    };
+
+    Value(): m_align(), m_type(EMPTY) {}
+    Value(const Value& other): m_type(EMPTY) { assign(other); }
+    ~Value() { if(m_type > DIMEN) destroy(); }
+
+    template<typename T>
+    Value(const T& value): m_align(), m_type(EMPTY) {
+        ValueTraits<T>::construct(m_data, value);
+        m_type = Type(ValueTraits<T>::TYPE);
+    }
+
+    Value(const char* value);
+
+    /**
+     * @brief stores the boost::any as it is (with the OTHER type)
+     */
+    Value(const any& value): m_align(), m_type(EMPTY) {
+        construct(value);
+        m_type = OTHER;
+    }
+
+    Value& operator=(const Value& other) {
+        if(this != &other) {
+            if(m_type > DIMEN) destroy();
+            assign(other);
+        }
+        return *this;
+    }
+
+    Type type() const { return m_type; }
+    bool empty() const { return m_type == EMPTY; }
+
+    /**
+     * @brief returns the stored object if it has type T, NULL otherwise
+     */
+    template<typename T>
+    const T* get() const {
+        return m_type == Type(ValueTraits<T>::TYPE) ?
+                    ValueTraits<T>::get(m_data) : NULL;
+    }
+
+    template<typename T>
+    bool is() const { return get<T>() != NULL; }
+
+    /**
+     * @return the stored object if it has type T, def otherwise
+     */
+    template<typename T>
+    T value(T def) const {
+        const T* v = get<T>();
+        return v ? *v : def;
+    }
+
+    /**
+     * @brief copy of the value in boost::any
+     */
+    any toAny() const;
+
+    /**
+     * @brief represent the value in string format, see reprAny()
+     */
+    string repr() const;
+
+    /**
+     * @brief true if the values are equal ints or dimens or refer to
+     *      the same object
+     */
+    bool same(const Value& other) const;
+
+protected:
+    void assign(const Value& other) {
+        if(other.m_type <= DIMEN)
+            std::memcpy(m_data, other.m_data, sizeof(m_data));
+        else
+            copy(other);
+        m_type = other.m_type;
+    }
+
+    void construct(const any& value);
+    void copy(const Value& other);
+    void destroy();
+
+    // zeroed by the constructors, as assign() copies all of it bitwise
+    union {
+        char        m_data[2*sizeof(void*)];
+        void*       m_align[2];
+    };
+    Type            m_type;
+};
+
+/**
+ * @brief the types stored in place
+ */
+template<typename T, Value::Type type>
+struct InlineValueTraits
+{
+    enum { TYPE = type };
+
+    static void construct(char* data, const T& value) {
+        static_assert(sizeof(T) <= 2*sizeof(void*), "too big to store in place");
+        new (data) T(value);
+    }
+    static const T* get(const char* data) {
+        return reinterpret_cast<const T*>(data);
+    }
+};
+
+/**
+ * @brief the types allocated once and shared by the copies
+ */
+template<typename T, Value::Type type>
+struct SharedValueTraits
+{
+    enum { TYPE = type };
+    typedef shared_ptr<const void> Ptr;
+
+    static void construct(char* data, const T& value) {
+        new (data) Ptr(boost::make_shared<T>(value));
+    }
+    static const T* get(const char* data) {
+        return static_cast<const T*>(reinterpret_cast<const Ptr*>(data)->get());
+    }
+};
+
+/**
+ * @brief all other types are stored in boost::any
+ */
+template<typename T>
+struct ValueTraits: SharedValueTraits<any, Value::OTHER>
+{
+    static void construct(char* data, const T& value) {
+        new (data) Ptr(boost::make_shared<any>(value));
+    }
+    static const T* get(const char* data) {
+        return any_cast<T>(SharedValueTraits<any, Value::OTHER>::get(data));
+    }
+};
+
+template<> struct ValueTraits<int>:
+    InlineValueTraits<int, Value::INT> {};
+template<> struct ValueTraits<base::Dimen>:
+    InlineValueTraits<base::Dimen, Value::DIMEN> {};
+template<> struct ValueTraits<Token::ptr>:
+    InlineValueTraits<Token::ptr, Value::TOKEN> {};
+template<> struct ValueTraits<shared_ptr<Command> >:
+    InlineValueTraits<shared_ptr<Command>, Value::COMMAND> {};
+template<> struct ValueTraits<shared_ptr<base::FontInfo> >:
+    InlineValueTraits<shared_ptr<base::FontInfo>, Value::FONT> {};
+template<> struct ValueTraits<Token::list_ptr>:
+    InlineValueTraits<Token::list_ptr, Value::TOKEN_LIST_PTR> {};
+
+template<> struct ValueTraits<base::Glue>:
+    SharedValueTraits<base::Glue, Value::GLUE> {};
+template<> struct ValueTraits<string>:
+    SharedValueTraits<string, Value::STRING> {};
+template<> struct ValueTraits<Token::list>:
+    SharedValueTraits<Token::list, Value::TOKEN_LIST> {};
+template<> struct ValueTraits<base::Box>:
+    SharedValueTraits<base::Box, Value::BOX> {};
+template<> struct ValueTraits<base::ParshapeInfo>:
+    SharedValueTraits<base::ParshapeInfo, Value::PARSHAPE> {};
+
+inline Value::Value(const char* value): m_align(), m_type(EMPTY)
+{
+    ValueTraits<string>::construct(m_data, string(value));
+    m_type = STRING;
+}
+
+} // namespace texpp
+
+#endif
+
@@ -20,6 +20,7 @@
 #include <boost/any.hpp>
 
 #include <texpp/command.h>
+#include <texpp/value.h>
 
 #include <string>
 
@@ -66,6 +67,30 @@ namespace {
 
   };
 
+  struct value_to_python_object
+  {
+    static PyObject* convert(const texpp::Value& v)
+    {
+      using namespace boost::python;
+      using namespace texpp;
+
+      switch(v.type()) {
+        case Value::EMPTY:
+          return incref(object().ptr());
+        case Value::INT:
+          return incref(object(*v.get<int>()).ptr());
+        case Value::STRING:
+          return incref(object(*v.get<std::string>()).ptr());
+        case Value::COMMAND:
+          return incref(object(*v.get<Command::ptr>()).ptr());
+        case Value::OTHER:
+          return boost_any_to_python_object::convert(v.toAny());
+        default:
+          return incref(object(v.repr()).ptr());
+      }
+    }
+  };
+
   struct python_object_to_boost_any
   {
     static void register_conversion() {
@@ -117,6 +142,54 @@ namespace {
       data->convertible = storage;
     }
   };
+
+  struct python_object_to_value
+  {
+    static void register_conversion() {
+      using namespace boost::python;
+      converter::registry::push_back(
+        &convertible,
+        &construct,
+        type_id< texpp::Value >());
+    }
+
+    static void *convertible(PyObject *obj_ptr) {
+      return obj_ptr;
+    }
+
+    static void construct(
+      PyObject *obj_ptr,
+      boost::python::converter::rvalue_from_python_stage1_data *data)
+    {
+      using namespace boost::python;
+      using namespace texpp;
+
+      typedef converter::rvalue_from_python_storage<
+                            Value > rvalue_t;
+      void *storage = ((rvalue_t *) data)->storage.bytes;
+
+      if(obj_ptr == Py_None) {
+          new (storage) Value();
+      } else if(PyInt_Check(obj_ptr)) {
+          new (storage) Value(int(PyInt_AS_LONG(obj_ptr)));
+      } else if(PyString_Check(obj_ptr)) {
+          new (storage) Value(std::string(
+            PyString_AS_STRING(obj_ptr), PyString_GET_SIZE(obj_ptr) ));
+      } else {
+          object value_object((handle<>(borrowed(obj_ptr))));
+
+          extract<Command::ptr> cmd(value_object);
+          if(cmd.check()) {
+              new (storage) Value(Command::ptr(cmd));
+          } else {
+              // stored in boost::any
+              new (storage) Value(boost::any(value_object));
+          }
+      }
+
+      data->convertible = storage;
+    }
+  };
 }
 
 void export_boost_any()
@@ -128,5 +201,10 @@ void export_boost_any()
         boost_any_to_python_object>();
 
     python_object_to_boost_any::register_conversion();
-}
 
+    to_python_converter<
+        texpp::Value,
+        value_to_python_object>();
+
+    python_object_to_value::register_conversion();
+}
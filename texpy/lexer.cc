@@ -30,6 +30,13 @@ public:
 };
 }*/
 
+namespace {
+std::string lexer_line(const texpp::Lexer& lexer, size_t n)
+{
+    return lexer.line(n).to_string();
+}
+} // namespace
+
 void export_lexer()
 {
     using namespace boost::python;
@@ -42,10 +49,8 @@ void export_lexer()
         .def("nextToken", &Lexer::nextToken)
         .def("fileName", &Lexer::fileName, 
                 return_value_policy<copy_const_reference>())
-        .def("line", (const string& (Lexer::*)() const) &Lexer::line,
-                return_value_policy<copy_const_reference>())
-        .def("line", (const string& (Lexer::*)(size_t) const) &Lexer::line,
-                return_value_policy<copy_const_reference>())
+        .def("line", (string (Lexer::*)() const) &Lexer::line)
+        .def("line", &lexer_line)
         .def("lineNo", &Lexer::lineNo)
         .def("endlinechar", &Lexer::endlinechar)
         .def("setEndlinechar", &Lexer::setEndlinechar)
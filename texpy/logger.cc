@@ -30,14 +30,14 @@ class LoggerWrap: public Log, public wrapper<Log>
 {
 public:
     bool log(Logger::Level level, const string& message,
-                    Parser& parser, shared_ptr<Token> token) {
+                    Parser& parser, Token::ptr token) {
         if(override f = this->get_override("log"))
             return f(level, message, parser, token);
         return this->Log::log(level, message, parser, token);
     }
 
     bool default_log(Logger::Level level, const string& message,
-                    Parser& parser, shared_ptr<Token> token) {
+                    Parser& parser, Token::ptr token) {
         return this->Log::log(level, message, parser, token);
     }
 };
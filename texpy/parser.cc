@@ -18,6 +18,9 @@
 
 #include <boost/python.hpp>
 #include <texpp/parser.h>
+#include <texpp/tarbundle.h>
+#include <texpp/filebundle.h>
+#include <texpp/format.h>
 
 #include <boost/any.hpp>
 #include <memory>
@@ -41,16 +44,16 @@ public:
         : Parser(fileName, const_cast<std::auto_ptr<std::istream>&>(file),
                     interactive, logger) {}
 
-    const any& symbol0(const string& name) const {
+    const Value& symbol0(const string& name) const {
         return Parser::symbolAny(name);
     }
-    const any& symbol1(Token::ptr token) const {
+    const Value& symbol1(Token::ptr token) const {
         return Parser::symbolAny(token);
     }
-    void setSymbol0(const string& name, const any& value) {
+    void setSymbol0(const string& name, const Value& value) {
         Parser::setSymbol(name, value);
     }
-    void setSymbol1(Token::ptr token, const any& value) {
+    void setSymbol1(Token::ptr token, const Value& value) {
         Parser::setSymbol(token, value);
     }
 
@@ -96,13 +99,40 @@ void export_bundle()
     using namespace texpp;
     using boost::any;
 
-    scope scopeBundle = class_<BundleWrap,
+    class_<BundleWrap,
             boost::noncopyable >("Bundle", init<>())
             .def("get_mainfile_name", pure_virtual(&Bundle::get_mainfile_name))
             .def("get_file", pure_virtual(&Bundle::get_file))
             .def("get_bib_filename", pure_virtual(&Bundle::get_bib_filename))
             .def("get_tex_filename", pure_virtual(&Bundle::get_tex_filename))
     ;
+
+    class_<TarBundle, bases<Bundle>, shared_ptr<TarBundle>,
+            boost::noncopyable >("TarBundle",
+                init<std::string, optional<std::string> >())
+            .def("isValid", &TarBundle::isValid)
+            .def("archiveName", &TarBundle::archiveName,
+                    return_value_policy<copy_const_reference>())
+            .def("members", &TarBundle::members,
+                    return_value_policy<copy_const_reference>())
+            .def("hasMember", &TarBundle::hasMember)
+            .def("get_mainfile_name", &TarBundle::get_mainfile_name)
+            .def("get_bib_filename", &TarBundle::get_bib_filename)
+            .def("get_tex_filename", &TarBundle::get_tex_filename)
+            .def("normalizeName", &TarBundle::normalizeName)
+            .staticmethod("normalizeName")
+    ;
+
+    class_<FileBundle, bases<Bundle>, shared_ptr<FileBundle>,
+            boost::noncopyable >("FileBundle",
+                init<std::string, optional<std::string> >())
+            .def("workdir", &FileBundle::workdir,
+                    return_value_policy<copy_const_reference>())
+            .def("path", &FileBundle::path)
+            .def("get_mainfile_name", &FileBundle::get_mainfile_name)
+            .def("get_bib_filename", &FileBundle::get_bib_filename)
+            .def("get_tex_filename", &FileBundle::get_tex_filename)
+    ;
 }
 
 BOOST_PYTHON_MEMBER_FUNCTION_OVERLOADS(
@@ -166,6 +196,10 @@ void export_node()
         .def(vector_indexing_suite< std::vector<size_t> >())
     ;
 
+    class_< std::vector<std::string> >("StringVector")
+        .def(vector_indexing_suite< std::vector<std::string> >())
+    ;
+
     class_<Node::ChildrenList>("ChildrenList")
         .def(vector_indexing_suite<Node::ChildrenList, true >())
     ;
@@ -188,6 +222,58 @@ PARSER_OVERLOADS(parseToken, 0, 1)
 PARSER_OVERLOADS(parseGeneralText, 1, 2)
 PARSER_OVERLOADS(parseControlSequence, 0, 1)
 
+// python holds formats as shared_ptr<Format>
+texpp::shared_ptr<texpp::Format> Parser_dumpFormat(const texpp::Parser& parser)
+{
+    return boost::const_pointer_cast<texpp::Format>(parser.dumpFormat());
+}
+
+texpp::Parser* Parser_createWithFormat(
+        texpp::shared_ptr<texpp::Bundle> bundle,
+        texpp::shared_ptr<texpp::Format> format)
+{
+    return new texpp::Parser(bundle, format);
+}
+
+texpp::Parser* Parser_createWithFormatAndLogger(
+        texpp::shared_ptr<texpp::Bundle> bundle,
+        texpp::shared_ptr<texpp::Format> format,
+        texpp::shared_ptr<texpp::Logger> logger)
+{
+    return new texpp::Parser(bundle, format, logger);
+}
+
+texpp::shared_ptr<texpp::Format> Format_load(
+        const std::string& fileName, const texpp::Format& base)
+{
+    return boost::const_pointer_cast<texpp::Format>(
+                texpp::Format::load(fileName, base));
+}
+
+void export_format()
+{
+    using namespace boost::python;
+    using namespace texpp;
+
+    class_<Format, shared_ptr<Format>, boost::noncopyable>("Format", no_init)
+        .def("save", (bool (Format::*)(const string&, const Format&) const)(
+                        &Format::save))
+        .def("load", &Format_load)
+        .staticmethod("load")
+        .def("endlinechar", &Format::endlinechar)
+        .def("catCode", &Format::catCode)
+        ;
+
+    class_<PreambleCache, shared_ptr<PreambleCache>, boost::noncopyable>(
+                "PreambleCache", init<optional<size_t> >())
+        .def("size", &PreambleCache::size)
+        .def("maxSize", &PreambleCache::maxSize)
+        .def("hits", &PreambleCache::hits)
+        .def("misses", &PreambleCache::misses)
+        .def("clear", &PreambleCache::clear)
+        ;
+}
+
 void export_parser()
 {
     using namespace boost::python;
@@ -196,10 +282,18 @@ void export_parser()
 
     export_node();
     export_bundle();
+    export_format();
 
     scope scopeParser = class_<Parser, boost::noncopyable >("Parser",
              init<shared_ptr<Bundle>, shared_ptr<Logger> >())
         .def(init<shared_ptr<Bundle> >())
+        .def("__init__", make_constructor(&Parser_createWithFormat))
+        .def("__init__", make_constructor(&Parser_createWithFormatAndLogger))
+        .def("dumpFormat", &Parser_dumpFormat)
+        .def("setPreambleCache", &Parser::setPreambleCache)
+        .def("preambleCache", &Parser::preambleCache)
+        .def("setPrefetch", &Parser::setPrefetch)
+        .def("prefetch", &Parser::prefetch)
 
         .def("parse", &Parser::parse)
 
@@ -223,16 +317,16 @@ void export_parser()
         .def("parseFileName", &Parser::parseFileName)
 
         // Symbols
-        .def("symbol", (const any& (Parser::*)(const string&) const)(
+        .def("symbol", (const Value& (Parser::*)(const string&) const)(
                         &Parser::symbolAny),
                         return_value_policy<return_by_value>())
-        .def("symbol", (const any& (Parser::*)(Token::ptr) const)(
+        .def("symbol", (const Value& (Parser::*)(Token::ptr) const)(
                         &Parser::symbolAny),
                         return_value_policy<return_by_value>())
-        .def("setSymbol", (void (Parser::*)(const string&, const any&, bool))
+        .def("setSymbol", (void (Parser::*)(const string&, const Value&, bool))
                         (&Parser::setSymbol),
                         Parser_setSymbol_overloads())
-        .def("setSymbol", (void (Parser::*)(Token::ptr, const any&, bool))
+        .def("setSymbol", (void (Parser::*)(Token::ptr, const Value&, bool))
                         (&Parser::setSymbol),
                         Parser_setSymbol_overloads())
         //.def("setSymbol", &ParserWrap::setSymbol0)
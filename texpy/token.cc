@@ -27,7 +27,7 @@ void export_token_class()
     using namespace boost::python;
     using namespace texpp;
 
-    scope scope_Token = class_<Token, shared_ptr<Token> >(
+    scope scope_Token = class_<Token, Token::ptr >(
             "Token", init<Token::Type, Token::CatCode, const string&,
                     const string&, size_t, size_t, size_t>())
         .def(init<Token::Type, Token::CatCode,
@@ -45,9 +45,7 @@ void export_token_class()
         .add_property("value", make_function(&Token::value,
                     return_value_policy<copy_const_reference>()),
                     &Token::setValue)
-        .add_property("source", make_function(&Token::source,
-                    return_value_policy<copy_const_reference>()),
-                    &Token::setSource)
+        .add_property("source", &Token::source, &Token::setSource)
         .add_property("linePos", &Token::lineNo, &Token::setLinePos)
         .add_property("lineNo", &Token::lineNo, &Token::setLineNo)
         .add_property("charPos", &Token::charPos, &Token::setCharPos)
@@ -102,8 +100,8 @@ void export_token()
     using namespace texpp;
     export_token_class();
 
-    class_<std::vector< shared_ptr<Token> > >("TokenList")
-        .def(vector_indexing_suite<std::vector< shared_ptr<Token> >, true >())
+    class_<std::vector< Token::ptr > >("TokenList")
+        .def(vector_indexing_suite<std::vector< Token::ptr >, true >())
     ;
 }
 